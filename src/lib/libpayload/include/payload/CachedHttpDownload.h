@@ -0,0 +1,107 @@
+#ifndef PAYLOAD_EXTRACT_CACHED_HTTP_DOWNLOAD_H
+#define PAYLOAD_EXTRACT_CACHED_HTTP_DOWNLOAD_H
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "HttpDownload.h"
+
+namespace skkk {
+	class CacheEntry {
+		public:
+			std::list<std::string>::iterator lruIt;
+			uint64_t size = 0;
+	};
+
+	/**
+	 * Key and size of the remote file, copied out of the lock for each request since
+	 * setUrl may reset them meanwhile.
+	 */
+	class CacheResource {
+		public:
+			std::string key;
+			uint64_t fileSize = 0;
+	};
+
+	/**
+	 * On-disk cache in front of another HttpDownload. The remote file is split into
+	 * CHUNK_SIZE chunks, each stored as one file named after the url (without query),
+	 * the ETag or Last-Modified of the file and the chunk index. Least recently used
+	 * chunks are removed once the cache grows over maxSize, the file mtime is the
+	 * access time, so the order survives restarts.
+	 *
+	 * Without a validator the remote file can not be told apart from a newer one,
+	 * requests then go to the upstream directly.
+	 */
+	class CachedHttpDownload : public HttpDownload {
+		static constexpr uint64_t CHUNK_SIZE = 1024 * 1024;
+
+		std::shared_ptr<HttpDownload> upstream;
+		std::string cacheDir;
+		uint64_t maxSize = 0;
+
+		mutable std::mutex resourceMutex;
+		mutable bool isResourceInit = false;
+		// Empty if the remote file is not cacheable
+		mutable std::string resourceKey;
+		mutable uint64_t remoteFileSize = 0;
+
+		mutable std::mutex lruMutex;
+		mutable std::list<std::string> lru;
+		mutable std::unordered_map<std::string, CacheEntry> entries;
+		mutable uint64_t totalSize = 0;
+
+		mutable std::atomic_uint64_t hitBytes = 0;
+		mutable std::atomic_uint64_t missBytes = 0;
+
+		public:
+			CachedHttpDownload(const std::shared_ptr<HttpDownload> &upstream, const std::string &url,
+			                   const std::string &cacheDir, uint64_t maxSize);
+
+			void setUrl(const std::string &url) override;
+
+			uint64_t getFileSize() const override;
+
+			std::string getValidator() const override;
+
+			std::tuple<bool, long> download(std::string &data, uint64_t offset, uint64_t length) const override;
+
+			std::tuple<bool, long> download(FileBuffer &fb, uint64_t offset, uint64_t length) const override;
+
+			std::tuple<bool, long> download(FileBuffer &fb, uint64_t fbDataOffset, uint64_t offset,
+			                                uint64_t length) const override;
+
+			std::string getStats() const override;
+
+		private:
+			void loadEntries();
+
+			bool initResource(CacheResource &resource) const;
+
+			std::string getChunkPath(const std::string &name) const;
+
+			bool readChunk(const CacheResource &resource, uint64_t chunk, uint8_t *buf, uint64_t offset,
+			               uint64_t length) const;
+
+			void writeChunk(const CacheResource &resource, uint64_t chunk, const uint8_t *data,
+			                uint64_t length) const;
+
+			void touchEntry(const std::string &name, uint64_t size) const;
+
+			/**
+			 * @return the result of the upstream request
+			 */
+			std::tuple<bool, long> fetchChunks(const CacheResource &resource, uint64_t firstChunk,
+			                                   uint64_t lastChunk, uint8_t *buf, uint64_t offset,
+			                                   uint64_t length) const;
+
+			std::tuple<bool, long> read(const CacheResource &resource, uint8_t *buf, uint64_t offset,
+			                            uint64_t length) const;
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_CACHED_HTTP_DOWNLOAD_H
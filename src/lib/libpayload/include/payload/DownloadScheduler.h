@@ -0,0 +1,258 @@
+#ifndef PAYLOAD_EXTRACT_DOWNLOADSCHEDULER_H
+#define PAYLOAD_EXTRACT_DOWNLOADSCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "HedgeRunner.h"
+
+namespace skkk {
+	class DownloadMetrics {
+		public:
+			uint32_t limit = 0;
+			uint32_t peakLimit = 0;
+			uint32_t maxLimit = 0;
+			uint32_t inFlight = 0;
+			uint32_t decodeLimit = 0;
+			uint32_t decoding = 0;
+			bool isPaused = false;
+			// Bytes per second, 0 is unlimited
+			uint64_t rateLimit = 0;
+			uint64_t totalBytes = 0;
+			uint64_t failCount = 0;
+			uint64_t hedgeCount = 0;
+			// Bytes per second of the last completed window
+			double throughput = 0;
+	};
+
+	/**
+	 * Limits the number of range requests in flight, independent of the decode threads.
+	 * The limit follows the measured throughput AIMD style: after each window of limit
+	 * completed requests it grows by one while throughput still improves, it shrinks to
+	 * 3/4 when throughput drops and is halved on a failed request.
+	 *
+	 * The cap, the decode threads, a bandwidth limit and pausing can be changed while
+	 * downloading, e.g. by the remote control. Waiting requests see a change at once,
+	 * requests in flight run to the end and new ones follow the new settings.
+	 */
+	class DownloadScheduler {
+		mutable std::mutex mutex;
+		std::condition_variable cv;
+		// Range workers of a partition, the cap can not be raised above it
+		uint32_t poolLimit = 1;
+		uint32_t maxLimit = 1;
+		uint32_t limit = 1;
+		uint32_t inFlight = 0;
+		// Range tasks handed to the pool and not finished, at most limit
+		uint32_t tasks = 0;
+		uint32_t decodeLimit = 1;
+		uint32_t decoding = 0;
+		bool isPaused = false;
+
+		// Bytes per second, a request starts once the ones before it are paid for
+		uint64_t rateLimit = 0;
+		std::chrono::steady_clock::time_point rateNext;
+		uint64_t totalBytes = 0;
+
+		uint64_t windowBytes = 0;
+		uint32_t windowCount = 0;
+		std::chrono::steady_clock::time_point windowStart;
+		double lastThroughput = 0;
+
+		// Seconds per byte of recent successful requests, ring buffer
+		static constexpr uint32_t LATENCY_SAMPLES = 64;
+		std::vector<double> latencySamples;
+		uint32_t latencyIndex = 0;
+
+		uint32_t peakLimit = 1;
+		uint64_t failCount = 0;
+		uint64_t hedgeCount = 0;
+		std::atomic_bool isFailed = false;
+		// Set while a remote control can replace the url
+		std::atomic_bool isUrlReplaceable = false;
+		uint64_t urlVersion = 0;
+
+		// Threads of the hedged requests
+		static constexpr uint32_t HEDGE_THREADS = 4;
+		HedgeRunner hedgeRunner{HEDGE_THREADS};
+
+		void resetWindow();
+
+		void chargeRate(uint64_t bytes, std::chrono::steady_clock::time_point now);
+
+		public:
+			DownloadScheduler(uint32_t initialLimit, uint32_t maxLimit, uint32_t decodeLimit);
+
+			/**
+			 * Blocks until a request of bytes may start.
+			 */
+			void acquire(uint64_t bytes);
+
+			/**
+			 * Blocks the thread queuing a range task until the task may run, with a request
+			 * slot of bytes already taken unless bytes is 0. Pool threads shared by several
+			 * jobs then neither wait for the first slot nor are held beyond the limit of a job.
+			 */
+			void acquireTask(uint64_t bytes);
+
+			void releaseTask();
+
+			/**
+			 * Like acquire, but returns false instead of waiting.
+			 */
+			bool tryAcquire(uint64_t bytes);
+
+			void release(uint64_t bytes, bool isSuccess, std::chrono::steady_clock::duration elapsed);
+
+			/**
+			 * Gives back the slot of a request that was cancelled, neither a success nor a failure.
+			 */
+			void releaseUnused();
+
+			/**
+			 * Time after which a request of bytes is slower than percentile of the recent
+			 * requests, 0 while there are too few samples.
+			 */
+			std::chrono::milliseconds getHedgeDelay(uint64_t bytes, uint32_t percentile) const;
+
+			void addHedge();
+
+			HedgeRunner &getHedgeRunner();
+
+			/**
+			 * A range failed after all retries, the remote is treated as dead and
+			 * other ranges give up without retrying.
+			 */
+			void setFailed();
+
+			bool hasFailed() const;
+
+			/**
+			 * A new url was set, ranges may download again and the ones waiting for it are woken.
+			 * @return true if a range had given up before
+			 */
+			bool resetFailed();
+
+			/**
+			 * Ranges denied by an expired url wait for a new one instead of giving up.
+			 */
+			void setUrlReplaceable(bool replaceable);
+
+			bool getUrlReplaceable() const;
+
+			uint64_t getUrlVersion() const;
+
+			/**
+			 * Waits up to timeout for a url newer than version.
+			 */
+			void waitUrlChange(uint64_t version, std::chrono::milliseconds timeout);
+
+			/**
+			 * Blocks until downloaded data may be decoded.
+			 */
+			void acquireDecode();
+
+			void releaseDecode();
+
+			uint32_t getMaxLimit() const;
+
+			/**
+			 * Initial cap, the number of range workers needed to reach any later cap.
+			 */
+			uint32_t getPoolLimit() const;
+
+			/**
+			 * Cap of the adaptive limit, clamped to [1, initial cap].
+			 */
+			void setMaxLimit(uint32_t maxLimit);
+
+			void setDecodeLimit(uint32_t decodeLimit);
+
+			/**
+			 * Bytes per second of all requests together, 0 is unlimited.
+			 */
+			void setRateLimit(uint64_t rateLimit);
+
+			void setPaused(bool paused);
+
+			DownloadMetrics getMetrics() const;
+
+			std::string getStats() const;
+	};
+
+	/**
+	 * One request slot of a DownloadScheduler, a nullptr scheduler does not limit.
+	 */
+	class DownloadSlot {
+		DownloadScheduler *scheduler = nullptr;
+		uint64_t bytes = 0;
+		bool isOwned = true;
+		bool isSuccess = false;
+		bool isCancelled = false;
+		std::chrono::steady_clock::time_point start;
+
+		public:
+			DownloadSlot(DownloadScheduler *scheduler, uint64_t bytes)
+				: scheduler(scheduler),
+				  bytes(bytes) {
+				if (scheduler) scheduler->acquire(bytes);
+				start = std::chrono::steady_clock::now();
+			}
+
+			/**
+			 * Takes over a slot already acquired, e.g. by acquireTask.
+			 */
+			DownloadSlot(DownloadScheduler *scheduler, uint64_t bytes, std::adopt_lock_t)
+				: scheduler(scheduler),
+				  bytes(bytes) {
+				start = std::chrono::steady_clock::now();
+			}
+
+			/**
+			 * Does not wait, ownsSlot() tells if a slot was free.
+			 */
+			DownloadSlot(DownloadScheduler *scheduler, uint64_t bytes, std::try_to_lock_t)
+				: bytes(bytes) {
+				if (scheduler) {
+					isOwned = scheduler->tryAcquire(bytes);
+					if (isOwned) this->scheduler = scheduler;
+				}
+				start = std::chrono::steady_clock::now();
+			}
+
+			DownloadSlot(const DownloadSlot &other) = delete;
+
+			DownloadSlot &operator=(const DownloadSlot &other) = delete;
+
+			~DownloadSlot() {
+				if (!scheduler) return;
+				if (isCancelled && !isSuccess) {
+					scheduler->releaseUnused();
+				} else {
+					scheduler->release(bytes, isSuccess, std::chrono::steady_clock::now() - start);
+				}
+			}
+
+			bool ownsSlot() const {
+				return isOwned;
+			}
+
+			void setSuccess(bool success) {
+				isSuccess = success;
+			}
+
+			/**
+			 * The request was stopped because another one finished first.
+			 */
+			void setCancelled() {
+				isCancelled = true;
+			}
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_DOWNLOADSCHEDULER_H
@@ -1,6 +1,8 @@
 #ifndef PAYLOAD_EXTRACT_EXTRACTCONFIG_H
 #define PAYLOAD_EXTRACT_EXTRACTCONFIG_H
 
+#include <atomic>
+#include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -12,7 +14,10 @@
 #if defined(ENABLE_HTTP_CPR)
 #include "httpDownloadImpl/CprHttpDownload.h"
 #endif
+#include "PartitionSink.h"
 #include "PayloadDefs.h"
+#include "RetryPolicy.h"
+#include "WorkerPool.h"
 
 namespace skkk {
 	enum ExtractResult {
@@ -27,9 +32,22 @@ namespace skkk {
 		RET_EXTRACT_CREATE_FILE_FAIL,
 		RET_EXTRACT_THREAD_NUM_ERROR,
 		RET_EXTRACT_FAIL_SKIP,
-		RET_EXTRACT_FAIL_EXIT
+		RET_EXTRACT_FAIL_EXIT,
+		RET_EXTRACT_VERIFY_FAIL
 	};
 
+	/**
+	 * Progress of a partition, done and total count operations.
+	 */
+	using ProgressCallback = std::function<void(const std::string &partName, uint64_t done, uint64_t total)>;
+
+	class PartitionInfo;
+
+	/**
+	 * Sink of a partition, nullptr fails the partition.
+	 */
+	using SinkFactory = std::function<std::unique_ptr<PartitionSink>(const PartitionInfo &info)>;
+
 	class ExtractConfig {
 		std::mutex _mutex;
 
@@ -38,6 +56,11 @@ namespace skkk {
 			std::string oldDir;
 			std::string outDir;
 			std::string outConfigPath;
+			std::string cacheDir;
+			// Dir of manifest index files, empty disables the index
+			std::string indexDir;
+			// URL mode, further urls of the same file besides payloadPath
+			std::vector<std::string> mirrorUrls;
 			std::map<std::string, std::string> outConfig;
 			std::string targetName;
 			std::vector<std::string> targets;
@@ -52,14 +75,42 @@ namespace skkk {
 			bool isIncremental = false;
 			bool isExcludeMode = false;
 			bool isVerifyUpdate = false;
+			// Only check existing images in the out dir, nothing is written
+			bool isVerifyImages = false;
 			bool isSilent = false;
 			bool isUrl = false;
 			bool remoteUpdate = false;
 			bool sslVerification = true;
 			uint32_t threadNum = 0;
+			// URL mode, nearby operation data is fetched in one range request, see RangePlanner
+			uint64_t rangeTargetSize = 8 * 1024 * 1024;
+			uint64_t rangeGapTolerance = 64 * 1024;
+			// URL mode, 0 keeps one session per thread, otherwise HTTP/2 streams in flight
+			uint32_t http2Streams = 0;
+			uint32_t http2Connections = 2;
+			// URL mode, cap of the adaptive range requests in flight, 0 is max(threads * 4, 16)
+			uint32_t downloadMaxInFlight = 0;
+			RetryPolicy retryPolicy;
+			// File mode, bytes of upcoming operation data advised to the kernel ahead, 0 disables
+			uint64_t prefetchBudget = 256 * 1024 * 1024;
+			// Stream mode, operation data read ahead of the decoders
+			uint64_t streamBufferSize = 256 * 1024 * 1024;
+			// URL mode, size limit of the chunk cache in cacheDir
+			uint64_t cacheMaxSize = 4ULL * 1024 * 1024 * 1024;
 			uint32_t hardwareConcurrency = std::thread::hardware_concurrency();
 			uint32_t limitHardwareConcurrency = hardwareConcurrency * 3;
 			std::shared_ptr<HttpDownload> httpDownload;
+			// Batch mode, pools shared by all payloads, each partition starts its own if unset
+			std::shared_ptr<WorkerPool> workerPool;
+			std::shared_ptr<WorkerPool> downloadPool;
+			// Tasks of different jobs on the shared pools are run in turn
+			uint64_t jobId = 0;
+			// Called instead of printing the progress, on every percent and at the end
+			ProgressCallback progressCallback;
+			// Partitions are written to the sinks it creates instead of out files
+			SinkFactory sinkFactory;
+			// May be set from any thread, operations that did not start yet fail with -ECANCELED
+			std::atomic_bool isCancelled = false;
 
 		public:
 			ExtractConfig() = default;
@@ -87,6 +138,18 @@ namespace skkk {
 
 			virtual const std::map<std::string, std::string> &getOutConfig() const;
 
+			virtual const std::vector<std::string> &getMirrorUrls() const;
+
+			virtual void addMirrorUrl(const std::string &url);
+
+			virtual const std::string &getCacheDir() const;
+
+			virtual void setCacheDir(const std::string &path);
+
+			virtual const std::string &getIndexDir() const;
+
+			virtual void setIndexDir(const std::string &path);
+
 			virtual const std::string &getTargetName() const;
 
 			virtual void setTargetName(const std::string &name);
@@ -95,6 +158,11 @@ namespace skkk {
 
 			virtual void setTargets(const std::vector<std::string> &target);
 
+			/**
+			 * Download backend of one url, HTTP/2 when enabled.
+			 */
+			std::shared_ptr<HttpDownload> createHttpDownload(const std::string &url) const;
+
 			virtual const std::shared_ptr<HttpDownload> &getHttpDownloadImpl();
 	};
 }
@@ -3,8 +3,10 @@
 
 #include <functional>
 
+#include "DownloadScheduler.h"
 #include "HttpDownload.h"
 #include "PartitionInfo.h"
+#include "RetryPolicy.h"
 
 namespace skkk {
 	class FileWriter {
@@ -12,12 +14,32 @@ namespace skkk {
 		                                        uint8_t *dest, uint64_t destSize)>;
 
 		const std::shared_ptr<HttpDownload> &httpDownload;
+		// Optional, null outside of url mode
+		DownloadScheduler *downloadScheduler;
+		const RetryPolicy &retryPolicy;
 
 		public:
-			FileWriter(const std::shared_ptr<HttpDownload> &httpDownload);
+			FileWriter(const std::shared_ptr<HttpDownload> &httpDownload, DownloadScheduler *downloadScheduler,
+			           const RetryPolicy &retryPolicy);
 
 			int urlRead(uint8_t *buf, const FileOperation &operation) const;
 
+			/**
+			 * hasSlot: the caller took the request slot of the first attempt, see
+			 * DownloadScheduler::acquireTask, it is released in any case.
+			 */
+			int urlRead(uint8_t *buf, uint64_t offset, uint64_t length, bool hasSlot = false) const;
+
+			/**
+			 * One download attempt, duplicated once it runs longer than the hedge
+			 * delay of the scheduler, the first request to finish wins.
+			 */
+			std::tuple<bool, long> downloadHedged(const std::vector<ScatterSegment> &segments,
+			                                      uint64_t offset, uint64_t length) const;
+
+			int urlReadScatter(const std::vector<ScatterSegment> &segments, uint64_t offset, uint64_t length,
+			                   bool hasSlot = false) const;
+
 			int commonWrite(const decompressPtr &decompress, const uint8_t *payloadData, uint8_t *outData,
 			                const FileOperation &operation) const;
 
@@ -31,9 +53,9 @@ namespace skkk {
 
 			int zstdWrite(const uint8_t *payloadData, uint8_t *outData, const FileOperation &operation) const;
 
-			static int extentsRead(const uint8_t *inData, uint8_t *data, const std::vector<Extent> &extents);
+			static int extentsRead(const uint8_t *inData, uint8_t *data, std::span<const Extent> extents);
 
-			static int extentsWrite(uint8_t *outData, const uint8_t *srcData, const std::vector<Extent> &extents);
+			static int extentsWrite(uint8_t *outData, const uint8_t *srcData, std::span<const Extent> extents);
 
 			static int sourceCopy(const uint8_t *inData, uint8_t *outData, const FileOperation &operation);
 
@@ -42,6 +64,26 @@ namespace skkk {
 
 			int writeDataByType(const uint8_t *payloadData, const uint8_t *inData, uint8_t *outData,
 			                    const FileOperation &operation) const;
+
+			/**
+			 * Copy of operation whose dst extents, kept in bufExtents, are laid out back to
+			 * back from offset 0.
+			 */
+			static FileOperation getBufferOperation(const FileOperation &operation, std::vector<Extent> &bufExtents);
+
+			/**
+			 * Same as writeDataByType, but the dst extents are laid out back to back in buf,
+			 * buf holds operation.dstTotalLength bytes.
+			 */
+			int writeDataToBuffer(const uint8_t *payloadData, const uint8_t *inData, uint8_t *buf,
+			                      const FileOperation &operation) const;
+
+			/**
+			 * Same as writeDataByType, but the payload data is taken from rangeData, which holds
+			 * the payload bytes starting at rangeOffset, nothing is downloaded.
+			 */
+			static int writeDataFromRange(const uint8_t *rangeData, uint64_t rangeOffset, const uint8_t *inData,
+			                              uint8_t *outData, const FileOperation &operation);
 	};
 }
 
@@ -0,0 +1,60 @@
+#ifndef PAYLOAD_EXTRACT_HEDGERUNNER_H
+#define PAYLOAD_EXTRACT_HEDGERUNNER_H
+
+#include <chrono>
+#include <cinttypes>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace skkk {
+	/**
+	 * Runs tasks after a delay on a few threads kept for the whole download, started
+	 * with the first task. A task cancelled before its time never starts, so a range
+	 * that finishes in time costs no thread, and the http sessions of the threads
+	 * are reused by later hedges.
+	 */
+	class HedgeRunner {
+		using Task = std::function<void()>;
+
+		public:
+			using Key = std::pair<std::chrono::steady_clock::time_point, uint64_t>;
+
+		private:
+			std::mutex mutex;
+			std::condition_variable cv;
+			// Earliest first
+			std::map<Key, Task> queue;
+			uint64_t nextId = 0;
+			bool isStopping = false;
+			uint32_t threadNum = 1;
+			std::vector<std::thread> threads;
+
+		public:
+			explicit HedgeRunner(uint32_t threadNum);
+
+			HedgeRunner(const HedgeRunner &other) = delete;
+
+			HedgeRunner &operator=(const HedgeRunner &other) = delete;
+
+			/**
+			 * Tasks not started yet are dropped.
+			 */
+			~HedgeRunner();
+
+			Key schedule(std::chrono::steady_clock::duration delay, Task task);
+
+			/**
+			 * @return true if the task was removed before it started
+			 */
+			bool cancel(const Key &key);
+
+		private:
+			void run();
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_HEDGERUNNER_H
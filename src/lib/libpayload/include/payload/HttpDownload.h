@@ -1,15 +1,17 @@
 #ifndef PAYLOAD_EXTRACT_HTTP_DOWNLOAD_H
 #define PAYLOAD_EXTRACT_HTTP_DOWNLOAD_H
 
+#include <atomic>
 #include <cinttypes>
 #include <tuple>
 #include <string>
+#include <vector>
 
 namespace skkk {
 	class FileBuffer {
 		public:
 			uint8_t *data = nullptr;
-			uint32_t offset = 0;
+			uint64_t offset = 0;
 
 		public:
 			FileBuffer(uint8_t *data, uint64_t offset);
@@ -17,6 +19,47 @@ namespace skkk {
 			~FileBuffer() { data = nullptr; }
 	};
 
+	/**
+	 * Consumer of downloaded bytes as they arrive.
+	 */
+	class DataSink {
+		public:
+			virtual ~DataSink() = default;
+
+			/**
+			 * @return false aborts the download
+			 */
+			virtual bool write(const uint8_t *data, uint64_t length) = 0;
+
+			/**
+			 * Called before the range is downloaded again.
+			 */
+			virtual void reset() = 0;
+	};
+
+	class ScatterSegment {
+		public:
+			// Both nullptr drops the bytes
+			uint8_t *data = nullptr;
+			DataSink *sink = nullptr;
+			uint64_t length = 0;
+
+		public:
+			explicit ScatterSegment(uint64_t length)
+				: length(length) {
+			}
+
+			ScatterSegment(uint8_t *data, uint64_t length)
+				: data(data),
+				  length(length) {
+			}
+
+			ScatterSegment(DataSink *sink, uint64_t length)
+				: sink(sink),
+				  length(length) {
+			}
+	};
+
 	class HttpDownload {
 		public:
 			std::string url;
@@ -33,6 +76,11 @@ namespace skkk {
 
 			virtual uint64_t getFileSize() const;
 
+			/**
+			 * ETag or Last-Modified of the remote file, empty if unknown.
+			 */
+			virtual std::string getValidator() const;
+
 			virtual std::tuple<bool, long> download(std::string &data, uint64_t offset, uint64_t length) const;
 
 
@@ -40,6 +88,20 @@ namespace skkk {
 
 			virtual std::tuple<bool, long> download(FileBuffer &fb, uint64_t fbDataOffset, uint64_t offset,
 			                                        uint64_t length) const;
+
+			/**
+			 * Range [offset, offset + length) is written across segments in order,
+			 * the segment lengths add up to length. Setting cancel aborts the transfer.
+			 * The default downloads into a temporary buffer and copies from it.
+			 */
+			virtual std::tuple<bool, long> downloadScatter(const std::vector<ScatterSegment> &segments,
+			                                               uint64_t offset, uint64_t length,
+			                                               const std::atomic_bool *cancel = nullptr) const;
+
+			/**
+			 * Connection statistics of the implementation, empty if not supported.
+			 */
+			virtual std::string getStats() const;
 	};
 }
 
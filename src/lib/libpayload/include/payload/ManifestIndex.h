@@ -0,0 +1,127 @@
+#ifndef PAYLOAD_EXTRACT_MANIFEST_INDEX_H
+#define PAYLOAD_EXTRACT_MANIFEST_INDEX_H
+
+#include <cinttypes>
+#include <memory>
+#include <string>
+
+#include "PartitionInfo.h"
+
+namespace skkk {
+	class IndexMapping;
+	class PayloadInfo;
+
+#pragma pack(push, 8)
+	/**
+	 * Offset and length of a string in the string section.
+	 */
+	struct IndexString {
+		uint64_t offset;
+		uint64_t length;
+	};
+
+	struct IndexHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t headerSize;
+		uint32_t partitionRecordSize;
+		uint32_t operationRecordSize;
+		uint32_t extentRecordSize;
+		uint32_t blockSize;
+		uint64_t payloadSize;
+		uint64_t payloadOffset;
+		uint64_t inPayloadOffset;
+		uint64_t manifestSize;
+		uint64_t manifestHash;
+		int32_t partitionSize;
+		uint32_t minorVersion;
+		IndexString securityPatchLevel;
+		// DynamicPartitionMetadata message of the manifest
+		IndexString dynamicPartitionMetadata;
+		uint64_t partitionsOffset;
+		uint64_t partitionCount;
+		uint64_t operationsOffset;
+		uint64_t operationCount;
+		uint64_t extentsOffset;
+		uint64_t extentCount;
+		uint64_t stringsOffset;
+		uint64_t stringsSize;
+	};
+
+	struct IndexPartition {
+		IndexString name;
+		uint64_t size;
+		uint32_t blockSize;
+		uint32_t fecRoots;
+		IndexString oldHash;
+		uint64_t oldHashSize;
+		IndexString newHash;
+		uint64_t newHashSize;
+		uint32_t hasHashTreeDataExtent;
+		uint32_t hasFecDataExtent;
+		Extent hashTreeDataExtent;
+		Extent hashTreeExtent;
+		IndexString hashTreeAlgorithm;
+		IndexString hashTreeSalt;
+		Extent fecDataExtent;
+		Extent fecExtent;
+		uint64_t firstOperation;
+		uint64_t operationCount;
+	};
+
+	/**
+	 * FileOperation with the extents as indexes into the extent section.
+	 */
+	struct IndexOperation {
+		uint32_t type;
+		uint32_t reserved;
+		uint64_t dataOffset;
+		uint64_t dataLength;
+		uint64_t srcExtentIndex;
+		uint64_t srcExtentCount;
+		uint64_t srcTotalLength;
+		uint64_t dstExtentIndex;
+		uint64_t dstExtentCount;
+		uint64_t dstTotalLength;
+		uint8_t srcDataSha256Hash[OPERATION_HASH_SIZE];
+		uint8_t dataSha256Hash[OPERATION_HASH_SIZE];
+	};
+#pragma pack(pop)
+
+	/**
+	 * Sidecar file with the partition and operation tables of a payload, named after the
+	 * payload size and a hash of the manifest. The file is mapped, extents are used in
+	 * place and the operation records of a partition are only rebased onto the mapping
+	 * once it is selected, the manifest is not parsed at all.
+	 *
+	 * Records are written in host byte order, an index of another host is rejected by
+	 * the record sizes in the header and rebuilt.
+	 */
+	class ManifestIndex {
+		static constexpr char INDEX_MAGIC[8] = {'P', 'E', 'I', 'N', 'D', 'E', 'X', 0};
+		static constexpr uint32_t INDEX_VERSION = 1;
+
+		PayloadInfo &payloadInfo;
+		std::string path;
+		uint64_t payloadSize = 0;
+		uint64_t manifestHash = 0;
+		std::shared_ptr<IndexMapping> mapping;
+		const IndexHeader *header = nullptr;
+
+		public:
+			ManifestIndex(PayloadInfo &payloadInfo, const std::string &indexDir, uint64_t payloadSize);
+
+			const std::string &getPath() const;
+
+			bool load();
+
+			bool loadOperations(PartitionInfo &info) const;
+
+			bool save() const;
+
+		private:
+			bool isHeaderValid(const IndexHeader &header, uint64_t fileSize) const;
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_MANIFEST_INDEX_H
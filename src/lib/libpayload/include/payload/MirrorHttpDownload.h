@@ -0,0 +1,85 @@
+#ifndef PAYLOAD_EXTRACT_MIRROR_HTTP_DOWNLOAD_H
+#define PAYLOAD_EXTRACT_MIRROR_HTTP_DOWNLOAD_H
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "HttpDownload.h"
+
+namespace skkk {
+	class Mirror {
+		public:
+			std::shared_ptr<HttpDownload> httpDownload;
+			std::string url;
+			// Bytes per second, exponentially weighted, 0 until the first request completes
+			double throughput = 0;
+			uint32_t inFlight = 0;
+			uint32_t failStreak = 0;
+			std::chrono::steady_clock::time_point retryAfter;
+			uint64_t requestCount = 0;
+			uint64_t failCount = 0;
+			uint64_t bytes = 0;
+
+		public:
+			Mirror(const std::shared_ptr<HttpDownload> &httpDownload, const std::string &url)
+				: httpDownload(httpDownload),
+				  url(url) {
+			}
+	};
+
+	/**
+	 * Spreads range requests over several urls of the same file. Each request goes to
+	 * the mirror with the best measured throughput per request in flight, a failed
+	 * request is retried once on every other mirror, and the failed mirror is left
+	 * alone for a while that doubles with each failure in a row.
+	 */
+	class MirrorHttpDownload : public HttpDownload {
+		mutable std::mutex mutex;
+		mutable std::vector<Mirror> mirrors;
+		uint64_t fileSize = 0;
+		std::string validator;
+
+		int pickMirror(const std::vector<bool> &tried) const;
+
+		void finishRequest(int index, uint64_t bytes, std::chrono::steady_clock::duration elapsed,
+		                   bool isSuccess) const;
+
+		template<typename F>
+		std::tuple<bool, long> downloadFromMirrors(uint64_t length, F &&fetch) const;
+
+		public:
+			MirrorHttpDownload(const std::vector<std::shared_ptr<HttpDownload>> &httpDownloads,
+			                   const std::vector<std::string> &urls);
+
+			/**
+			 * Drops mirrors that do not answer, and those whose size, ETag or Last-Modified
+			 * differ from the first one that does.
+			 * @return number of usable mirrors
+			 */
+			uint32_t verifyMirrors();
+
+			void setUrl(const std::string &url) override;
+
+			uint64_t getFileSize() const override;
+
+			std::string getValidator() const override;
+
+			std::tuple<bool, long> download(std::string &data, uint64_t offset, uint64_t length) const override;
+
+			std::tuple<bool, long> download(FileBuffer &fb, uint64_t offset, uint64_t length) const override;
+
+			std::tuple<bool, long> download(FileBuffer &fb, uint64_t fbDataOffset, uint64_t offset,
+			                                uint64_t length) const override;
+
+			std::tuple<bool, long> downloadScatter(const std::vector<ScatterSegment> &segments,
+			                                       uint64_t offset, uint64_t length,
+			                                       const std::atomic_bool *cancel = nullptr) const override;
+
+			std::string getStats() const override;
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_MIRROR_HTTP_DOWNLOAD_H
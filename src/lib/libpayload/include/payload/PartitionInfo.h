@@ -1,20 +1,20 @@
 #ifndef PAYLOAD_EXTRACT_PAYLOADPARTITIONINFO_H
 #define PAYLOAD_EXTRACT_PAYLOADPARTITIONINFO_H
 
+#include <array>
 #include <atomic>
 #include <cinttypes>
 #include <memory>
 #include <mutex>
+#include <span>
 #include <string>
 #include <vector>
 
 namespace skkk {
+	static constexpr uint32_t OPERATION_HASH_SIZE = 32;
+
 	class Extent {
 		public:
-			uint64_t blockSize = 0;
-			uint64_t startBlock = 0;
-			uint64_t numBlocks = 0;
-
 			// Offset of data in image
 			uint64_t dataOffset = 0;
 			// data length
@@ -23,66 +23,47 @@ namespace skkk {
 		public:
 			Extent() = default;
 
-			Extent(uint64_t blockSize, uint64_t startBlock, uint64_t numBlocks) : blockSize(blockSize),
-				startBlock(startBlock), numBlocks(numBlocks) {
-				dataOffset = startBlock * blockSize;
-				dataLength = numBlocks * blockSize;
+			Extent(uint64_t blockSize, uint64_t startBlock, uint64_t numBlocks)
+				: dataOffset(startBlock * blockSize),
+				  dataLength(numBlocks * blockSize) {
 			}
 	};
 
+	/**
+	 * Fixed size operation record, the extents point into the storage owned by
+	 * PartitionInfo::extentStorage, a vector built from the manifest or the mapping
+	 * of the ManifestIndex. Errors are kept in PartitionInfo::operationErrors.
+	 */
 	class FileOperation {
 		public:
-			std::string partName;
+			// Index in PartitionInfo::operations
+			uint32_t index = 0;
 			uint32_t type = 0;
 
-			std::string url;
-
-			// data block size
-			uint32_t blockSize = 0;
-
 			// Offset of data in payload.bin
 			uint64_t dataOffset = 0;
 			// length in Data
 			uint64_t dataLength = 0;
 
 			// src_ext
-			std::vector<Extent> srcExtents;
-			uint64_t srcLength = 0;
+			std::span<const Extent> srcExtents;
 			uint64_t srcTotalLength = 0;
 
 			// dst_ext
-			std::vector<Extent> dstExtents;
-			uint64_t dstLength = 0;
+			std::span<const Extent> dstExtents;
 			uint64_t dstTotalLength = 0;
 
-			// src sha256
-			std::string srcDataSha256Hash;
-
-			// data sha256
-			std::string dataSha256Hash;
+			// src sha256, all zero if not set
+			std::array<uint8_t, OPERATION_HASH_SIZE> srcDataSha256Hash{};
 
-			// status
-			mutable std::string excInfo;
+			// data sha256, all zero if not set
+			std::array<uint8_t, OPERATION_HASH_SIZE> dataSha256Hash{};
+	};
 
+	class OperationError {
 		public:
-			FileOperation() = default;
-
-			FileOperation(const std::string &partName, uint32_t type, uint32_t blockSize, uint64_t dataOffset,
-			              uint64_t dataLength,
-			              uint64_t srcLength, uint64_t dstLength, const std::string &srcDataSha256Hash,
-			              const std::string &dataSha256Hash)
-				: partName(partName),
-				  type(type),
-				  blockSize(blockSize),
-				  dataOffset(dataOffset),
-				  dataLength(dataLength),
-				  srcLength(srcLength),
-				  dstLength(dstLength),
-				  srcDataSha256Hash(srcDataSha256Hash),
-				  dataSha256Hash(dataSha256Hash) {
-			}
-
-			void initExcInfo(int errCode) const;
+			uint32_t index = 0;
+			int errCode = 0;
 	};
 
 	class PartitionInfo {
@@ -126,12 +107,20 @@ namespace skkk {
 			// Simple info
 			std::string simpleInfo;
 
+			// Position of the partition in the manifest or the manifest index
+			uint32_t sourceIndex = 0;
+			// Operations are built on demand by PayloadInfo::initOperations
+			bool isOperationsInit = false;
 			std::vector<FileOperation> operations;
+			// Owner of the extents the operations point into, shared by copies of the info
+			std::shared_ptr<const void> extentStorage;
 
 			// status
 			std::shared_ptr<std::atomic_int> extractProgress = std::make_shared<std::atomic_int>(0);
 			mutable bool isExtractionSuccessful = false;
 			mutable std::vector<std::string> excInfos;
+			// Failed operations, only these get a message in excInfos
+			mutable std::vector<OperationError> operationErrors;
 
 		public:
 			PartitionInfo() = default;
@@ -144,6 +133,8 @@ namespace skkk {
 
 			bool checkExtractionSuccessful() const;
 
+			void initExcInfo(const FileOperation &operation, int errCode) const;
+
 			void initExcInfoByInitFd(const std::string &path, int errCode) const;
 
 			void initExcInfos() const;
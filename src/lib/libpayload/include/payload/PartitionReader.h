@@ -0,0 +1,96 @@
+#ifndef PAYLOAD_EXTRACT_PARTITIONREADER_H
+#define PAYLOAD_EXTRACT_PARTITIONREADER_H
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ExtractConfig.h"
+#include "PayloadInfo.h"
+
+namespace skkk {
+	class OperationExtent {
+		public:
+			// Offset of the dst extent in the image
+			uint64_t offset = 0;
+			uint64_t length = 0;
+			// Offset in the output of the operation
+			uint64_t bufferOffset = 0;
+			// Index in PartitionInfo::operations
+			uint32_t index = 0;
+	};
+
+	/**
+	 * dst extents of all operations of a partition sorted by offset, the old image is
+	 * mapped for the operations of an incremental payload.
+	 */
+	class PartitionIndex {
+		public:
+			PartitionInfo *info = nullptr;
+			std::vector<OperationExtent> extents;
+			int inFd = -1;
+			const uint8_t *inData = nullptr;
+			uint64_t inDataSize = 0;
+	};
+
+	class DecodedEntry {
+		public:
+			std::list<uint64_t>::iterator lruIt;
+			std::shared_ptr<const std::vector<uint8_t>> data;
+	};
+
+	/**
+	 * Random access to the images of a payload without extracting them. A read only
+	 * runs the operations whose dst extents overlap it, in url mode only their payload
+	 * data is downloaded. The output of each operation is kept in an in-memory cache,
+	 * least recently used first out once it grows over maxCacheSize.
+	 *
+	 * Blocks no operation writes read as zero. Stream payloads are not supported.
+	 */
+	class PartitionReader {
+		const ExtractConfig &config;
+		std::shared_ptr<PayloadInfo> payloadInfo;
+		uint64_t maxCacheSize = 0;
+
+		std::mutex indexMutex;
+		std::map<std::string, std::unique_ptr<PartitionIndex>> indexes;
+
+		std::mutex lruMutex;
+		// Keys are sourceIndex << 32 | operation index
+		std::list<uint64_t> lru;
+		std::unordered_map<uint64_t, DecodedEntry> entries;
+		uint64_t totalSize = 0;
+
+		public:
+			PartitionReader(const ExtractConfig &config, const std::shared_ptr<PayloadInfo> &payloadInfo,
+			                uint64_t maxCacheSize);
+
+			~PartitionReader();
+
+			PartitionReader(const PartitionReader &other) = delete;
+
+			PartitionReader &operator=(const PartitionReader &other) = delete;
+
+			/**
+			 * Reads up to length bytes of the image at offset, less at the end of the image.
+			 * @return bytes read or a negative errno, -ENOENT if there is no such partition
+			 */
+			int64_t pread(const std::string &partition, uint64_t offset, uint8_t *buf, uint64_t length);
+
+		private:
+			int getIndex(const std::string &partition, PartitionIndex *&index);
+
+			std::shared_ptr<const std::vector<uint8_t>> getCached(uint64_t key);
+
+			void putCached(uint64_t key, const std::shared_ptr<const std::vector<uint8_t>> &data);
+
+			int decodeOperations(const PartitionIndex &index, const std::vector<FileOperation> &operations,
+			                     std::unordered_map<uint32_t, std::shared_ptr<const std::vector<uint8_t>>> &decoded);
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_PARTITIONREADER_H
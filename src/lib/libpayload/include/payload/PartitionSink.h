@@ -0,0 +1,69 @@
+#ifndef PAYLOAD_EXTRACT_PARTITIONSINK_H
+#define PAYLOAD_EXTRACT_PARTITIONSINK_H
+
+#include <cinttypes>
+#include <map>
+#include <span>
+#include <vector>
+
+namespace skkk {
+	/**
+	 * Destination of a partition in place of its out file. Operations finish in any
+	 * order, write() gets the bytes of each dst extent at its offset in the image.
+	 * Calls for one partition never overlap, the sink needs no locking of its own.
+	 */
+	class PartitionSink {
+		public:
+			virtual ~PartitionSink() = default;
+
+			/**
+			 * @return false stops the partition, the operations left fail with -ECANCELED
+			 */
+			virtual bool write(uint64_t offset, std::span<const uint8_t> data) = 0;
+
+			/**
+			 * Called once after the last write, success is false if an operation failed
+			 * or the extraction was cancelled.
+			 */
+			virtual bool finish(bool success) { return success; }
+	};
+
+	/**
+	 * Consumer of the image in order, from offset 0 up to the partition size.
+	 */
+	class PartitionStreamSink {
+		public:
+			virtual ~PartitionStreamSink() = default;
+
+			virtual bool write(std::span<const uint8_t> data) = 0;
+
+			virtual bool finish(bool success) { return success; }
+	};
+
+	/**
+	 * PartitionSink in front of a PartitionStreamSink. Writes ahead of the stream are
+	 * held until the bytes before them arrive, blocks no operation writes are zero.
+	 * Operations are queued in payload order, which in full payloads is image order,
+	 * so only about one operation per worker is held.
+	 */
+	class OrderedPartitionSink : public PartitionSink {
+		PartitionStreamSink &stream;
+		uint64_t size = 0;
+		uint64_t position = 0;
+		std::map<uint64_t, std::vector<uint8_t>> pending;
+
+		public:
+			OrderedPartitionSink(PartitionStreamSink &stream, uint64_t size);
+
+			bool write(uint64_t offset, std::span<const uint8_t> data) override;
+
+			bool finish(bool success) override;
+
+		private:
+			bool writeZero(uint64_t length);
+
+			bool flushPending();
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_PARTITIONSINK_H
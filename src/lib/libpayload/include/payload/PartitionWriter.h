@@ -1,16 +1,23 @@
 #ifndef PAYLOAD_EXTRACT_PARTITIONWRITER_H
 #define PAYLOAD_EXTRACT_PARTITIONWRITER_H
 
+#include <condition_variable>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
 
+#include "DownloadScheduler.h"
 #include "FileWriter.h"
+#include "PartitionSink.h"
 #include "PayloadInfo.h"
+#include "RangePlanner.h"
+#include "verify/ImageVerifier.h"
 #include "verify/VerifyWriter.h"
 
 namespace skkk {
+	class Prefetcher;
+
 	class PartitionWriteContext {
 		public:
 			const PartitionInfo &partitionInfo;
@@ -20,18 +27,137 @@ namespace skkk {
 			const uint8_t *inData;
 			uint8_t *outData;
 			const bool isIncremental;
+			// Woken after each operation
+			Prefetcher &prefetcher;
 
 		public:
 			PartitionWriteContext(const PartitionInfo &partitionInfo, const FileWriter &fileWriter,
 			                      const FileOperation &operation, const uint8_t *payloadData, const uint8_t *inData,
-			                      uint8_t *outData, bool isIncremental)
+			                      uint8_t *outData, bool isIncremental, Prefetcher &prefetcher)
 				: partitionInfo(partitionInfo),
 				  fileWriter(fileWriter),
 				  operation(operation),
 				  payloadData(payloadData),
 				  inData(inData),
 				  outData(outData),
-				  isIncremental(isIncremental) {
+				  isIncremental(isIncremental),
+				  prefetcher(prefetcher) {
+			}
+	};
+
+	class PartitionRangeWriteContext {
+		public:
+			const PartitionInfo &partitionInfo;
+			const FileWriter &fileWriter;
+			const RangeGroup &group;
+			const uint8_t *inData;
+			uint8_t *outData;
+			// Limits the operations decoded at once to the thread count
+			DownloadScheduler &scheduler;
+
+		public:
+			PartitionRangeWriteContext(const PartitionInfo &partitionInfo, const FileWriter &fileWriter,
+			                           const RangeGroup &group, const uint8_t *inData, uint8_t *outData,
+			                           DownloadScheduler &scheduler)
+				: partitionInfo(partitionInfo),
+				  fileWriter(fileWriter),
+				  group(group),
+				  inData(inData),
+				  outData(outData),
+				  scheduler(scheduler) {
+			}
+	};
+
+	/**
+	 * Bytes of operation data read from the stream but not decoded yet. One operation
+	 * larger than the limit is still let through when nothing else is buffered.
+	 */
+	class StreamBufferLimit {
+		std::mutex mutex;
+		std::condition_variable cv;
+		uint64_t used = 0;
+		uint64_t limit = 0;
+
+		public:
+			explicit StreamBufferLimit(uint64_t limit);
+
+			void acquire(uint64_t size);
+
+			void release(uint64_t size);
+	};
+
+	class PartitionStreamData {
+		public:
+			int inFd = -1;
+			int outFd = -1;
+			uint64_t inDataSize = 0;
+			const uint8_t *inData = nullptr;
+			uint64_t outDataSize = 0;
+			uint8_t *outData = nullptr;
+			bool isReady = false;
+	};
+
+	class PartitionStreamWriteContext {
+		public:
+			const PartitionInfo &partitionInfo;
+			const FileOperation &operation;
+			const PartitionStreamData &partitionData;
+			StreamBufferLimit &bufferLimit;
+			std::atomic_int &progress;
+			// Operation data, released once decoded
+			Buffer<uint8_t> data;
+
+		public:
+			PartitionStreamWriteContext(const PartitionInfo &partitionInfo, const FileOperation &operation,
+			                            const PartitionStreamData &partitionData, StreamBufferLimit &bufferLimit,
+			                            std::atomic_int &progress)
+				: partitionInfo(partitionInfo),
+				  operation(operation),
+				  partitionData(partitionData),
+				  bufferLimit(bufferLimit),
+				  progress(progress) {
+			}
+	};
+
+	/**
+	 * State shared by the tasks of a partition written to a sink.
+	 */
+	class PartitionSinkData {
+		public:
+			PartitionSink &sink;
+			// Serializes the sink calls
+			std::mutex mutex;
+			// The sink failed or the extraction was cancelled
+			std::atomic_bool isStopped = false;
+			// File mode, nullptr in url mode where the ranges are downloaded
+			const uint8_t *payloadData = nullptr;
+			const uint8_t *inData = nullptr;
+			// Url mode, limits the operations decoded at once
+			DownloadScheduler *scheduler = nullptr;
+
+		public:
+			explicit PartitionSinkData(PartitionSink &sink)
+				: sink(sink) {
+			}
+	};
+
+	class PartitionSinkWriteContext {
+		public:
+			const PartitionInfo &partitionInfo;
+			const FileWriter &fileWriter;
+			const RangeGroup &group;
+			PartitionSinkData &sinkData;
+			const std::atomic_bool &isCancelled;
+
+		public:
+			PartitionSinkWriteContext(const PartitionInfo &partitionInfo, const FileWriter &fileWriter,
+			                          const RangeGroup &group, PartitionSinkData &sinkData,
+			                          const std::atomic_bool &isCancelled)
+				: partitionInfo(partitionInfo),
+				  fileWriter(fileWriter),
+				  group(group),
+				  sinkData(sinkData),
+				  isCancelled(isCancelled) {
 			}
 	};
 
@@ -39,12 +165,17 @@ namespace skkk {
 		std::mutex _mutex;
 		const std::shared_ptr<PayloadInfo> &payloadInfo;
 		const ExtractConfig &config;
+		// Url mode only, shared by all partitions
+		std::shared_ptr<DownloadScheduler> downloadScheduler;
 		std::vector<PartitionInfo> partitions;
 		std::shared_ptr<VerifyWriter> verifyWriter;
+		std::shared_ptr<ImageVerifier> imageVerifier;
 
 		public:
 			explicit PartitionWriter(const std::shared_ptr<PayloadInfo> &payloadInfo);
 
+			bool addPartition(PartitionInfo &info);
+
 			bool initPartitions();
 
 			bool initPartitionsByTarget();
@@ -63,12 +194,38 @@ namespace skkk {
 
 			std::shared_ptr<VerifyWriter> getVerifyWriter();
 
+			std::shared_ptr<ImageVerifier> getImageVerifier();
+
+			/**
+			 * Url mode, nullptr otherwise. Settings changed on it apply to the
+			 * running extraction.
+			 */
+			std::shared_ptr<DownloadScheduler> getDownloadScheduler() const;
+
 			bool extractByInfo(const PartitionInfo &info) const;
 
 			bool extractByInfoMT(const PartitionInfo &info) const;
 
+			/**
+			 * The partition goes to sink instead of its out file, nothing is written to
+			 * disk. Operations are decoded into memory on the workers, then their dst
+			 * extents are passed to the sink.
+			 */
+			bool extractByInfoToSink(const PartitionInfo &info, PartitionSink &sink) const;
+
+			/**
+			 * extractByInfoToSink with the sink of config.sinkFactory.
+			 */
+			bool extractToSink(const PartitionInfo &info) const;
+
 			bool extractPartitionByName(const std::string &name);
 
+			/**
+			 * Stream mode, all partitions are extracted in one pass over the payload,
+			 * operations run in the order their data appears in the stream.
+			 */
+			void extractPartitionsByStream() const;
+
 			void extractPartitions() const;
 	};
 }
@@ -5,6 +5,8 @@ enum PayloadType {
 	PAYLOAD_TYPE_BIN = 0,
 	PAYLOAD_TYPE_ZIP,
 	PAYLOAD_TYPE_URL,
+	// payload.bin or zip read once from stdin
+	PAYLOAD_TYPE_STREAM,
 };
 
 #endif //PAYLOAD_EXTRACT_PAYLOADDEFS_H
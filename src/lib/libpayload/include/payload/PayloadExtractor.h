@@ -0,0 +1,92 @@
+#ifndef PAYLOAD_EXTRACT_PAYLOADEXTRACTOR_H
+#define PAYLOAD_EXTRACT_PAYLOADEXTRACTOR_H
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ExtractConfig.h"
+#include "PartitionReader.h"
+#include "PartitionSink.h"
+#include "PayloadParser.h"
+
+namespace skkk {
+	using StreamSinkFactory = std::function<std::unique_ptr<PartitionStreamSink>(const PartitionInfo &info)>;
+
+	/**
+	 * Entry point for programs embedding the library. Partitions are written to sinks
+	 * of the caller, nothing is written to disk:
+	 *
+	 *   PayloadExtractor extractor{"https://.../ota.zip"};
+	 *   if (extractor.open() == RET_EXTRACT_DONE) {
+	 *       extractor.extract({"boot"}, [](const PartitionInfo &info) { return makeSink(info); });
+	 *   }
+	 *
+	 * Options of getConfig(), e.g. cache dir, index dir or old dir of an incremental
+	 * payload, must be set before open(). cancel() may be called from any thread.
+	 */
+	class PayloadExtractor {
+		static constexpr uint64_t DEFAULT_READER_CACHE_SIZE = 64 * 1024 * 1024;
+
+		ExtractConfig config;
+		PayloadParser payloadParser;
+		std::shared_ptr<PayloadInfo> payloadInfo;
+		std::shared_ptr<PartitionWriter> partitionWriter;
+
+		public:
+			/**
+			 * path is a payload.bin, an OTA zip or a http(s) url of either, threadNum 0
+			 * uses all cores.
+			 */
+			explicit PayloadExtractor(const std::string &path, uint32_t threadNum = 0);
+
+			PayloadExtractor(const PayloadExtractor &other) = delete;
+
+			PayloadExtractor &operator=(const PayloadExtractor &other) = delete;
+
+			ExtractConfig &getConfig();
+
+			/**
+			 * Parses the payload.
+			 * @return RET_EXTRACT_DONE or the error of ExtractResult
+			 */
+			int open();
+
+			std::vector<std::string> getPartitionNames() const;
+
+			/**
+			 * nullptr if the payload has no such partition.
+			 */
+			const PartitionInfo *getPartition(const std::string &name) const;
+
+			/**
+			 * Called on every percent of each partition, from a thread of the library.
+			 */
+			void setProgressCallback(const ProgressCallback &callback);
+
+			/**
+			 * Partitions are extracted one after another, names empty extracts all.
+			 * @return RET_EXTRACT_FAIL_SKIP if a partition failed, its excInfos tell why,
+			 * RET_EXTRACT_FAIL_EXIT if cancelled
+			 */
+			int extract(const std::vector<std::string> &names, const SinkFactory &sinkFactory);
+
+			/**
+			 * Same as extract, but each partition is passed in order from offset 0.
+			 */
+			int extractStream(const std::vector<std::string> &names, const StreamSinkFactory &streamSinkFactory);
+
+			/**
+			 * Stops the running extract(), a later extract() starts again.
+			 */
+			void cancel();
+
+			/**
+			 * Random access to the images of the opened payload, nullptr before open().
+			 */
+			std::unique_ptr<PartitionReader> createReader(uint64_t maxCacheSize = DEFAULT_READER_CACHE_SIZE) const;
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_PAYLOADEXTRACTOR_H
@@ -0,0 +1,68 @@
+#ifndef PAYLOAD_EXTRACT_PAYLOADEXTRACTORC_H
+#define PAYLOAD_EXTRACT_PAYLOADEXTRACTORC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * C interface of PayloadExtractor. Functions returning int return 0 on success or
+ * the ExtractResult error, no C++ exception crosses it.
+ */
+typedef struct payload_extractor payload_extractor;
+
+/* Called on every percent of each partition. */
+typedef void (*payload_progress_cb)(void *userdata, const char *partition, uint64_t done, uint64_t total);
+
+/*
+ * Bytes of a partition at offset, in order from 0 for payload_extractor_extract_stream.
+ * Return nonzero to stop the partition.
+ */
+typedef int (*payload_write_cb)(void *userdata, const char *partition, uint64_t offset,
+                                const uint8_t *data, size_t length);
+
+/* Called once per partition after its last write, success is 0 on failure. */
+typedef void (*payload_finish_cb)(void *userdata, const char *partition, int success);
+
+/* path is a payload.bin, an OTA zip or a http(s) url of either, threads 0 uses all cores. */
+payload_extractor *payload_extractor_new(const char *path, uint32_t threads);
+
+int payload_extractor_open(payload_extractor *extractor);
+
+size_t payload_extractor_partition_count(const payload_extractor *extractor);
+
+/* Valid until payload_extractor_free, NULL if index is out of range. */
+const char *payload_extractor_partition_name(const payload_extractor *extractor, size_t index);
+
+/* 0 if the payload has no such partition. */
+uint64_t payload_extractor_partition_size(const payload_extractor *extractor, const char *name);
+
+void payload_extractor_set_progress(payload_extractor *extractor, payload_progress_cb cb, void *userdata);
+
+/* count 0 extracts all partitions, finish_cb may be NULL. */
+int payload_extractor_extract(payload_extractor *extractor, const char *const *names, size_t count,
+                              payload_write_cb write_cb, payload_finish_cb finish_cb, void *userdata);
+
+int payload_extractor_extract_stream(payload_extractor *extractor, const char *const *names, size_t count,
+                                     payload_write_cb write_cb, payload_finish_cb finish_cb, void *userdata);
+
+/*
+ * Reads up to length bytes of the image at offset, only the operations overlapping
+ * the range are run. Returns the bytes read or a negative errno.
+ */
+int64_t payload_extractor_pread(payload_extractor *extractor, const char *name, uint64_t offset,
+                                uint8_t *buf, uint64_t length);
+
+/* May be called from any thread, stops the running extraction, a later one starts again. */
+void payload_extractor_cancel(payload_extractor *extractor);
+
+void payload_extractor_free(payload_extractor *extractor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //PAYLOAD_EXTRACT_PAYLOADEXTRACTORC_H
@@ -1,8 +1,11 @@
 #ifndef PAYLOAD_EXTRACT_PAYLOADINFO_H
 #define PAYLOAD_EXTRACT_PAYLOADINFO_H
 
+#include <memory>
+#include <span>
 #include <string>
 #include <string_view>
+#include <google/protobuf/arena.h>
 
 #include "DynamicPartitionMetadata.h"
 #include "ExtractConfig.h"
@@ -17,6 +20,8 @@ namespace skkk {
 
 	typedef std::map<std::string, PartitionInfo> PartitionInfoMap;
 
+	class ManifestIndex;
+
 	class PayloadInfo {
 		protected:
 			static constexpr std::string_view METADATA_FILENAME{"META-INF/com/android/metadata"};
@@ -30,11 +35,16 @@ namespace skkk {
 			uint64_t payloadOffset = 0;
 			uint64_t payloadMetadataSize = 0;
 			Buffer<uint8_t> payloadMetadata;
+			// Serialized PartitionUpdate messages in pHeader.manifest, by sourceIndex
+			std::vector<std::span<const uint8_t>> partitionUpdates;
+			std::shared_ptr<ManifestIndex> manifestIndex;
 
 		public:
 			std::vector<ZipFileItem> zipFiles;
 			PayloadHeader pHeader;
-			DeltaArchiveManifest manifest;
+			// Decoded into manifestArena, only set until the partition tables are built
+			std::unique_ptr<google::protobuf::Arena> manifestArena;
+			DeltaArchiveManifest *manifest = nullptr;
 			DynamicPartitionMetadata dynamicPartitionMetadata;
 			PartitionInfoMap partitionInfoMap;
 
@@ -71,10 +81,31 @@ namespace skkk {
 
 			bool parseManifestData();
 
+			void releaseManifest();
+
 			const uint8_t *getPayloadData() const;
 
+			PartitionInfo &addPartitionInfo(const std::string &partName, uint64_t size,
+			                                const std::string &oldHash, uint64_t oldHashSize,
+			                                const std::string &newHash, uint64_t newHashSize);
+
 			bool parsePartitionInfo();
 
+			void buildOperations(const PartitionUpdate &pu, PartitionInfo &info) const;
+
+			/**
+			 * Builds the operations of the partition from the manifest index or the manifest,
+			 * the manifest only holds the partition headers until then.
+			 */
+			bool initOperations(PartitionInfo &info);
+
+			/**
+			 * Size of the whole payload file, part of the manifest index key.
+			 */
+			virtual uint64_t getPayloadFileSize() const;
+
+			bool initPayloadInfoByIndex();
+
 			virtual bool initPayloadInfo();
 
 			void closePayloadFile();
@@ -98,6 +129,37 @@ namespace skkk {
 			bool downloadPayloadMetadata(FileBuffer &fb);
 
 			bool handleOffset() override;
+
+			uint64_t getPayloadFileSize() const override;
+	};
+
+	/**
+	 * Payload read once from front to back out of a pipe, e.g. stdin. Only the metadata is
+	 * kept in memory, the operation data is read by PartitionWriter while it extracts.
+	 * The input is payload.bin or a zip holding it uncompressed.
+	 */
+	class StreamPayloadInfo : public PayloadInfo {
+		static constexpr std::string_view PAYLOAD_FILENAME{"payload.bin"};
+		int streamFd = STDIN_FILENO;
+		uint64_t streamOffset = 0;
+
+		public:
+			explicit StreamPayloadInfo(const ExtractConfig &config);
+
+			bool initPayloadFile() override;
+
+			bool handleOffset() override;
+
+			bool readStream(void *data, uint64_t length);
+
+			bool skipStream(uint64_t length);
+
+			uint64_t getStreamOffset() const;
+
+		private:
+			bool skipZipEntries(uint8_t *magic);
+
+			bool readPayloadMetadata(const uint8_t *magic);
 	};
 }
 
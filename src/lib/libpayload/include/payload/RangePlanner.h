@@ -0,0 +1,30 @@
+#ifndef PAYLOAD_EXTRACT_RANGEPLANNER_H
+#define PAYLOAD_EXTRACT_RANGEPLANNER_H
+
+#include <cinttypes>
+#include <vector>
+
+#include "PartitionInfo.h"
+
+namespace skkk {
+	class RangeGroup {
+		public:
+			// Payload range fetched at once, 0 length for operations without payload data
+			uint64_t offset = 0;
+			uint64_t length = 0;
+			std::vector<const FileOperation *> operations;
+	};
+
+	class RangePlanner {
+		public:
+			/**
+			 * Operations whose payload data is adjacent, or separated by at most gapTolerance
+			 * bytes, are merged into one range of up to targetSize bytes. An operation larger
+			 * than targetSize gets a range of its own, targetSize 0 disables merging.
+			 */
+			static std::vector<RangeGroup> plan(const std::vector<FileOperation> &operations,
+			                                    uint64_t targetSize, uint64_t gapTolerance);
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_RANGEPLANNER_H
@@ -0,0 +1,26 @@
+#ifndef PAYLOAD_EXTRACT_RETRYPOLICY_H
+#define PAYLOAD_EXTRACT_RETRYPOLICY_H
+
+#include <chrono>
+#include <cinttypes>
+
+namespace skkk {
+	/**
+	 * Retries of a failed range request: up to maxAttempts attempts, waiting a random
+	 * time in [0, min(maxDelay, baseDelay * 2^retry)] between them (full jitter).
+	 * maxAttempts 0 retries forever, e.g. to wait for a new url from the remote updater.
+	 */
+	class RetryPolicy {
+		public:
+			uint32_t maxAttempts = 8;
+			std::chrono::milliseconds baseDelay{500};
+			std::chrono::milliseconds maxDelay{30000};
+			// A range slower than this percentile of recent ranges gets a hedged request, 0 disables
+			uint32_t hedgePercentile = 95;
+
+		public:
+			std::chrono::milliseconds getDelay(uint32_t retry) const;
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_RETRYPOLICY_H
@@ -0,0 +1,53 @@
+#ifndef PAYLOAD_EXTRACT_WORKER_POOL_H
+#define PAYLOAD_EXTRACT_WORKER_POOL_H
+
+#include <cinttypes>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace skkk {
+	/**
+	 * Threads kept across partitions and payloads, e.g. by batch mode. Thread local
+	 * state of the workers, like decoder contexts and http sessions, stays warm.
+	 *
+	 * Tasks are queued per group, e.g. per job of the daemon, and the workers take
+	 * from the groups in turn, so a job with many queued tasks does not hold back
+	 * the others.
+	 */
+	class WorkerPool {
+		using Task = std::function<void()>;
+
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::map<uint64_t, std::deque<Task>> queues;
+		// Group served last, the next task comes from the group after it
+		uint64_t lastGroup = 0;
+		bool isStopping = false;
+		std::vector<std::thread> threads;
+
+		public:
+			explicit WorkerPool(uint32_t size);
+
+			WorkerPool(const WorkerPool &other) = delete;
+
+			WorkerPool &operator=(const WorkerPool &other) = delete;
+
+			~WorkerPool();
+
+			uint32_t getSize() const;
+
+			void commit(Task task, uint64_t group = 0);
+
+		private:
+			bool takeTask(Task &task);
+
+			void run();
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_WORKER_POOL_H
@@ -19,6 +19,11 @@ namespace skkk {
 
 	int blobRead(int fd, void *data, uint64_t offset, uint64_t length);
 
+	/**
+	 * Sequential read for pipes, fails unless all length bytes were read.
+	 */
+	int streamRead(int fd, void *data, uint64_t length);
+
 	int blobWrite(int fd, const void *data, uint64_t offset, uint64_t length);
 
 	int blobFallocate(int fd, off64_t offset, off64_t length);
@@ -26,6 +31,16 @@ namespace skkk {
 	bool readToString(const std::string &filePath, std::string &result);
 
 	bool readAllLines(const std::string &filePath, std::vector<std::string> &result);
+
+	/**
+	 * Temp file next to path, unique per process and thread.
+	 */
+	std::string getTempPath(const std::string &path);
+
+	/**
+	 * Renames from to to, an existing to is replaced, also on Windows.
+	 */
+	bool renameReplace(const std::string &from, const std::string &to);
 }
 
 #endif //PAYLOAD_EXTRACT_IO_H
@@ -1,7 +1,9 @@
 #ifndef PAYLOAD_EXTRACT_CPRHTTPDOWNLOAD_H
 #define PAYLOAD_EXTRACT_CPRHTTPDOWNLOAD_H
 
+#include <atomic>
 #include <chrono>
+#include <mutex>
 #include <cpr/cpr.h>
 
 #include "payload/HttpDownload.h"
@@ -10,10 +12,28 @@ using namespace std::chrono_literals;
 
 namespace skkk {
 	class CprHttpDownload : public HttpDownload {
+		// Sessions a worker thread keeps, one per instance it downloads for
+		static constexpr uint32_t MAX_THREAD_SESSIONS = 8;
+		static inline std::atomic_uint64_t nextId = 1;
+		// Sessions of worker threads are bound to one instance and url version
+		const uint64_t id = nextId++;
+		mutable std::mutex urlMutex;
+		std::atomic_uint64_t urlVersion = 0;
+
+		// Connection counters, see getStats()
+		mutable std::atomic_uint64_t requestCount = 0;
+		mutable std::atomic_uint64_t sessionCount = 0;
+		mutable std::atomic_uint64_t connectCount = 0;
+		mutable std::atomic_uint64_t reuseCount = 0;
+		mutable std::atomic_uint64_t tlsHandshakeCount = 0;
+
 		public:
 			static inline std::string CA_BUNDLE;
 			static inline std::string CA_PATH;
-			cpr::ConnectionPool connectionPool{};
+			// Copies share the connection cache, a later payload from the same host, e.g. in
+			// batch mode, starts on the connections of the previous one
+			static inline cpr::ConnectionPool sharedConnectionPool{};
+			cpr::ConnectionPool connectionPool{sharedConnectionPool};
 			cpr::ConnectTimeout connectTimeout{5s};
 			cpr::LowSpeed lowSpeed{1024 * 10, 5s};
 			cpr::Url cprUrl;
@@ -26,16 +46,32 @@ namespace skkk {
 
 			void initSession(cpr::Session &session) const;
 
+			/**
+			 * Session of the calling thread for this instance, created once and reused for every request,
+			 * so connections and TLS sessions are kept alive across requests.
+			 */
+			cpr::Session &getSession() const;
+
+			void updateStats(cpr::Session &session) const;
+
+			std::string getStats() const override;
+
 			void setUrl(const std::string &url) override;
 
 			uint64_t getFileSize() const override;
 
+			std::string getValidator() const override;
+
 			std::tuple<bool, long> download(std::string &data, uint64_t offset, uint64_t length) const override;
 
 			std::tuple<bool, long> download(FileBuffer &fb, uint64_t offset, uint64_t length) const override;
 
 			std::tuple<bool, long> download(FileBuffer &fb, uint64_t fbDataOffset, uint64_t offset,
 			                                uint64_t length) const override;
+
+			std::tuple<bool, long> downloadScatter(const std::vector<ScatterSegment> &segments,
+			                                       uint64_t offset, uint64_t length,
+			                                       const std::atomic_bool *cancel = nullptr) const override;
 	};
 }
 
@@ -0,0 +1,69 @@
+#ifndef PAYLOAD_EXTRACT_CURLMULTIHTTPDOWNLOAD_H
+#define PAYLOAD_EXTRACT_CURLMULTIHTTPDOWNLOAD_H
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <curl/curl.h>
+
+#include "CprHttpDownload.h"
+
+namespace skkk {
+	class CurlMultiRequest;
+
+	/**
+	 * HTTP/2 backend, range requests of all threads are multiplexed as streams over
+	 * a few connections by one curl multi event loop.
+	 *
+	 * The number of streams in flight is limited by maxStreams, independent of the
+	 * number of threads waiting on them. getFileSize() still uses the cpr session.
+	 */
+	class CurlMultiHttpDownload : public CprHttpDownload {
+		CURLM *multi = nullptr;
+		CURLSH *share = nullptr;
+		uint32_t maxStreams = 0;
+		uint32_t maxConnections = 0;
+
+		mutable std::mutex queueMutex;
+		mutable std::deque<CurlMultiRequest *> pendingRequests;
+		std::vector<CURL *> idleHandles;
+		bool isStopping = false;
+		std::thread eventThread;
+
+		mutable std::mutex multiUrlMutex;
+		std::string multiUrl;
+		std::string userAgent;
+
+		std::atomic_uint64_t streamCount = 0;
+		std::atomic_uint64_t multiConnectCount = 0;
+		std::atomic_uint64_t http2Count = 0;
+
+		public:
+			CurlMultiHttpDownload(const std::string &url, bool sslVerification, uint32_t maxStreams,
+			                      uint32_t maxConnections);
+
+			~CurlMultiHttpDownload() override;
+
+			void setUrl(const std::string &url) override;
+
+			std::tuple<bool, long> download(std::string &data, uint64_t offset, uint64_t length) const override;
+
+			std::tuple<bool, long> download(FileBuffer &fb, uint64_t offset, uint64_t length) const override;
+
+			std::tuple<bool, long> download(FileBuffer &fb, uint64_t fbDataOffset, uint64_t offset,
+			                                uint64_t length) const override;
+
+			std::string getStats() const override;
+
+		private:
+			std::tuple<bool, long> submit(CurlMultiRequest &request) const;
+
+			void initHandle(CURL *curl, CurlMultiRequest &request);
+
+			void eventLoop();
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_CURLMULTIHTTPDOWNLOAD_H
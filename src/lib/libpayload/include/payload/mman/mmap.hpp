@@ -29,6 +29,22 @@ namespace skkk {
 		return -1;
 	}
 
+	/**
+	 * Hint that the range will be read soon, no-op where madvise is unavailable.
+	 */
+	template<typename T>
+	int mapAdviseWillNeed(T *data, uint64_t length) {
+#if !defined(_WIN32)
+		if (data && length > 0) {
+			static const uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+			const auto end = reinterpret_cast<uintptr_t>(data) + length;
+			const auto start = reinterpret_cast<uintptr_t>(data) & ~(pageSize - 1);
+			return madvise(reinterpret_cast<void *>(start), end - start, MADV_WILLNEED);
+		}
+#endif
+		return -1;
+	}
+
 	template<typename T>
 	int unmap(T *&data, uint64_t size) {
 		int ret = -1;
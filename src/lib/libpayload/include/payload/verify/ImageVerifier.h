@@ -0,0 +1,58 @@
+#ifndef PAYLOAD_EXTRACT_IMAGEVERIFIER_H
+#define PAYLOAD_EXTRACT_IMAGEVERIFIER_H
+
+#include <cinttypes>
+#include <memory>
+#include <vector>
+
+#include "payload/ExtractConfig.h"
+#include "payload/PartitionInfo.h"
+#include "payload/PayloadInfo.h"
+
+namespace skkk {
+	enum BadRangeType {
+		// dst blocks of an operation differ from the payload
+		BAD_RANGE_DATA = 0,
+		// data blocks do not match the hash tree stored in the image
+		BAD_RANGE_HASH_TREE_DATA,
+		// hash tree blocks do not match the level below
+		BAD_RANGE_HASH_TREE,
+		BAD_RANGE_FEC
+	};
+
+	class BadBlockRange {
+		public:
+			int type = BAD_RANGE_DATA;
+			uint64_t startBlock = 0;
+			uint64_t numBlocks = 0;
+
+		public:
+			BadBlockRange(int type, uint64_t startBlock, uint64_t numBlocks)
+				: type(type),
+				  startBlock(startBlock),
+				  numBlocks(numBlocks) {
+			}
+	};
+
+	/**
+	 * Read-only check of existing images in the out dir against the manifest:
+	 * new_partition_info hash, per operation dst data, hash tree and FEC.
+	 * Nothing is written, partitions and their blocks are checked in parallel.
+	 */
+	class ImageVerifier {
+		const std::shared_ptr<PayloadInfo> &payloadInfo;
+		const std::vector<PartitionInfo> &partitions;
+		const ExtractConfig &config;
+
+		public:
+			ImageVerifier(const std::shared_ptr<PayloadInfo> &payloadInfo,
+			              const std::vector<PartitionInfo> &partitions, const ExtractConfig &config);
+
+			/**
+			 * @return true if every image matches
+			 */
+			bool verifyPartitions() const;
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_IMAGEVERIFIER_H
@@ -1,6 +1,7 @@
 #ifndef PAYLOAD_EXTRACT_VERIFYINFO_H
 #define PAYLOAD_EXTRACT_VERIFYINFO_H
 
+#include <array>
 #include <atomic>
 #include <cinttypes>
 #include <memory>
@@ -18,8 +19,8 @@ namespace skkk {
 			uint32_t realHashSize = 0;
 			uint32_t paddingSize = 0;
 			uint32_t totalHashSize = 0;
-			std::vector<uint8_t> data;
-			uint8_t *hashData = nullptr;
+			// offset of this level in the image, hashes are written in place
+			uint64_t hashOffset = 0;
 
 		public:
 			Level() = default;
@@ -43,9 +44,12 @@ namespace skkk {
 			// hash tree size
 			uint64_t hashTreeDataSize = 0;
 			std::string hashTreeSalt;
+			// level hashing the data blocks, stored last in the hash tree extent
 			Level topHashLevel;
-			mutable Level rootHashLevel;
-			mutable std::vector<Level> hashLevels;
+			// upper levels in calculation order, the root level is not stored in the image
+			std::vector<Level> hashLevels;
+			Level rootHashLevel;
+			mutable std::array<uint8_t, SHA256_DIGEST_SIZE> rootHash{};
 			uint64_t hashTreeTotalProgress = 0;
 			std::shared_ptr<std::atomic_int> hashTreeProgress = std::make_shared<std::atomic_int>(0);
 			std::shared_ptr<std::atomic_int> hashTreeExcSize = std::make_shared<std::atomic_int>(0);
@@ -63,7 +67,6 @@ namespace skkk {
 			uint32_t fecRoots = 2;
 			uint32_t fecRsn = 0;
 			uint64_t fecRounds = 0;
-			std::vector<uint8_t> fecData;
 			std::shared_ptr<std::atomic_int> fecProgress = std::make_shared<std::atomic_int>(0);
 			std::shared_ptr<std::atomic_int> fecExcSize = std::make_shared<std::atomic_int>(0);
 			mutable bool isCalcFecSuccessful = false;
@@ -71,6 +74,8 @@ namespace skkk {
 		public:
 			explicit VerifyInfo(const PartitionInfo &partInfo);
 
+			bool initHashTreeLevel();
+
 			bool checkCalcHashTreeSuccessful() const;
 
 			bool checkCalcFecSuccessful() const;
@@ -10,6 +10,8 @@
 #include "VerifyInfo.h"
 
 namespace skkk {
+	class RsEncoder;
+
 	class VerifyWriterHashTreeContext {
 		public:
 			const VerifyInfo &verifyInfo;
@@ -17,51 +19,55 @@ namespace skkk {
 			uint64_t readFilePos;
 			uint64_t writeHashPos;
 			uint8_t *hashData = nullptr;
+			// Consecutive data blocks hashed by one task
+			uint64_t blockCount;
 
 			VerifyWriterHashTreeContext(const VerifyInfo &verifyInfo, const uint8_t *inData, uint64_t readFilePos,
-			                            uint64_t writeHashPos, uint8_t *hashData)
+			                            uint64_t writeHashPos, uint8_t *hashData, uint64_t blockCount)
 				: verifyInfo(verifyInfo),
 				  inData(inData),
 				  readFilePos(readFilePos),
 				  writeHashPos(writeHashPos),
-				  hashData(hashData) {
+				  hashData(hashData),
+				  blockCount(blockCount) {
 			}
 	};
 
 	class VerifyWriterFecContext {
 		public:
 			const VerifyInfo &verifyInfo;
+			const RsEncoder &encoder;
 			uint8_t *fecData = nullptr;
 			const uint8_t *inData = nullptr;
-			uint64_t roundsIdx;
-
-			VerifyWriterFecContext(const VerifyInfo &verifyInfo, uint8_t *fecData, const uint8_t *inData,
-			                       uint64_t roundsIdx)
+			// Rounds [roundsStart, roundsEnd) are encoded in order by one worker
+			uint64_t roundsStart;
+			uint64_t roundsEnd;
+			// Worker owned scratch
+			std::vector<const uint8_t *> rsBlocks;
+			std::vector<uint8_t> tailBlock;
+
+			VerifyWriterFecContext(const VerifyInfo &verifyInfo, const RsEncoder &encoder, uint8_t *fecData,
+			                       const uint8_t *inData, uint64_t roundsStart, uint64_t roundsEnd)
 				: verifyInfo(verifyInfo),
+				  encoder(encoder),
 				  fecData(fecData),
 				  inData(inData),
-				  roundsIdx(roundsIdx) {
+				  roundsStart(roundsStart),
+				  roundsEnd(roundsEnd) {
 			}
 	};
 
 	class VerifyWriter {
 		const std::vector<PartitionInfo> &partitions;
 		const ExtractConfig &config;
-		std::vector<VerifyInfo> verifyInfos;
 
 		public:
 			VerifyWriter(const std::vector<PartitionInfo> &partitions, const ExtractConfig &config);
 
-			void initHashTreeLevel();
-
-			bool handleHashTreeDataByInfo(const VerifyInfo &info) const;
-
-			static bool updateHashTreeByInfo(const VerifyInfo &info);
-
-			bool handleFecDataByInfo(const VerifyInfo &info) const;
-
-			static bool updateFecByInfo(const VerifyInfo &info);
-
+			/**
+			 * Hash tree and FEC of all partitions are scheduled on one shared threadpool,
+			 * per partition: data block hashes -> upper levels -> FEC -> write back.
+			 */
 			void updateVerifyData() const;
 	};
 }
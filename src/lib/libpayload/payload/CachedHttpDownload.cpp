@@ -0,0 +1,260 @@
+#include <algorithm>
+#include <cstdio>
+#include <dirent.h>
+#include <format>
+#include <utime.h>
+
+#include "payload/CachedHttpDownload.h"
+#include "payload/LogBase.h"
+#include "payload/Utils.h"
+#include "payload/common/Buffer.hpp"
+#include "payload/common/io.h"
+
+namespace skkk {
+	static std::string hashKey(const std::string &str) {
+		// FNV-1a, only has to be stable between runs
+		uint64_t hash = 0xcbf29ce484222325ULL;
+		for (const unsigned char c: str) {
+			hash ^= c;
+			hash *= 0x100000001b3ULL;
+		}
+		return std::format("{:016x}", hash);
+	}
+
+	CachedHttpDownload::CachedHttpDownload(const std::shared_ptr<HttpDownload> &upstream, const std::string &url,
+	                                       const std::string &cacheDir, uint64_t maxSize)
+		: upstream(upstream),
+		  cacheDir(cacheDir),
+		  maxSize(maxSize) {
+		HttpDownload::setUrl(url);
+		this->sslVerification = upstream->sslVerification;
+		loadEntries();
+	}
+
+	void CachedHttpDownload::loadEntries() {
+		class ScanEntry {
+			public:
+				int64_t mtime = 0;
+				std::string name;
+				uint64_t size = 0;
+		};
+		std::vector<ScanEntry> scanEntries;
+
+		if (!dirExists(cacheDir) && mkdirs(cacheDir.c_str(), 0755)) {
+			LOGCE("Cache: failed to create dir: '{}'", cacheDir);
+			return;
+		}
+		if (DIR *dir = opendir(cacheDir.c_str())) {
+			while (const dirent *de = readdir(dir)) {
+				std::string name = de->d_name;
+				struct stat st = {};
+				if (name.starts_with(".") || name.ends_with(".tmp")) continue;
+				if (stat(getChunkPath(name).c_str(), &st) || !S_ISREG(st.st_mode)) continue;
+				scanEntries.emplace_back(st.st_mtime, std::move(name), st.st_size);
+			}
+			closedir(dir);
+		}
+		std::ranges::sort(scanEntries, [](const ScanEntry &a, const ScanEntry &b) {
+			return a.mtime < b.mtime;
+		});
+		for (auto &se: scanEntries) {
+			lru.push_front(se.name);
+			entries[se.name] = {lru.begin(), se.size};
+			totalSize += se.size;
+		}
+		LOGCD("Cache: dir='{}' entries={} size={} maxSize={}", cacheDir, entries.size(), totalSize, maxSize);
+	}
+
+	void CachedHttpDownload::setUrl(const std::string &url) {
+		upstream->setUrl(url);
+		HttpDownload::setUrl(url);
+		std::lock_guard lock{resourceMutex};
+		isResourceInit = false;
+		resourceKey.clear();
+	}
+
+	uint64_t CachedHttpDownload::getFileSize() const {
+		std::lock_guard lock{resourceMutex};
+		if (isResourceInit && remoteFileSize > 0) {
+			return remoteFileSize;
+		}
+		return upstream->getFileSize();
+	}
+
+	std::string CachedHttpDownload::getValidator() const {
+		return upstream->getValidator();
+	}
+
+	bool CachedHttpDownload::initResource(CacheResource &resource) const {
+		std::lock_guard lock{resourceMutex};
+		if (!isResourceInit) {
+			isResourceInit = true;
+			const std::string validator = upstream->getValidator();
+			remoteFileSize = upstream->getFileSize();
+			if (validator.empty() || remoteFileSize == 0) {
+				LOGCD("Cache: no ETag or Last-Modified, cache disabled");
+			} else {
+				// Signed urls differ per request, the query is not part of the key
+				const std::string path = url.substr(0, url.find('?'));
+				resourceKey = hashKey(std::format("{}\n{}\n{}", path, validator, remoteFileSize));
+				LOGCD("Cache: key={} validator={}", resourceKey, validator);
+			}
+		}
+		resource = {resourceKey, remoteFileSize};
+		return !resource.key.empty();
+	}
+
+	std::string CachedHttpDownload::getChunkPath(const std::string &name) const {
+		return cacheDir + "/" + name;
+	}
+
+	void CachedHttpDownload::touchEntry(const std::string &name, uint64_t size) const {
+		std::lock_guard lock{lruMutex};
+		if (auto it = entries.find(name); it != entries.end()) {
+			lru.splice(lru.begin(), lru, it->second.lruIt);
+		} else {
+			lru.push_front(name);
+			entries[name] = {lru.begin(), size};
+			totalSize += size;
+		}
+		utime(getChunkPath(name).c_str(), nullptr);
+
+		while (totalSize > maxSize && lru.size() > 1) {
+			const std::string &oldest = lru.back();
+			auto it = entries.find(oldest);
+			totalSize -= it->second.size;
+			remove(getChunkPath(oldest).c_str());
+			entries.erase(it);
+			lru.pop_back();
+		}
+	}
+
+	bool CachedHttpDownload::readChunk(const CacheResource &resource, uint64_t chunk, uint8_t *buf, uint64_t offset,
+	                                   uint64_t length) const {
+		const std::string name = std::format("{}_{}", resource.key, chunk);
+		const uint64_t chunkLength = std::min(CHUNK_SIZE, resource.fileSize - chunk * CHUNK_SIZE);
+		int fd = openFileRD(getChunkPath(name));
+		if (fd < 0) return false;
+
+		struct stat st = {};
+		bool ret = fstat(fd, &st) == 0 && static_cast<uint64_t>(st.st_size) == chunkLength &&
+		           blobRead(fd, buf, offset, length) == 0;
+		closeFd(fd);
+		if (ret) {
+			touchEntry(name, chunkLength);
+		}
+		return ret;
+	}
+
+	void CachedHttpDownload::writeChunk(const CacheResource &resource, uint64_t chunk, const uint8_t *data,
+	                                    uint64_t length) const {
+		const std::string name = std::format("{}_{}", resource.key, chunk);
+		const std::string path = getChunkPath(name);
+		// Written to a temp file first, other threads or processes only see complete chunks
+		const std::string tmpPath = getTempPath(path);
+		int fd = open(tmpPath.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_BINARY, 0644);
+		if (fd < 0) {
+			LOGCD("Cache: failed to create '{}' err={}", tmpPath, errno);
+			return;
+		}
+		int ret = blobWrite(fd, data, 0, length);
+		closeFd(fd);
+		if (ret || !renameReplace(tmpPath, path)) {
+			remove(tmpPath.c_str());
+			return;
+		}
+		touchEntry(name, length);
+	}
+
+	std::tuple<bool, long> CachedHttpDownload::fetchChunks(const CacheResource &resource, uint64_t firstChunk,
+	                                                       uint64_t lastChunk, uint8_t *buf, uint64_t offset,
+	                                                       uint64_t length) const {
+		const uint64_t rangeOffset = firstChunk * CHUNK_SIZE;
+		const uint64_t rangeEnd = std::min((lastChunk + 1) * CHUNK_SIZE, resource.fileSize);
+		const uint64_t rangeLength = rangeEnd - rangeOffset;
+		Buffer<uint8_t> rangeBuffer{rangeLength};
+		FileBuffer fb{rangeBuffer.get(), 0};
+		if (!fb.data) return {false, -1};
+		const auto ret = upstream->download(fb, rangeOffset, rangeLength);
+		if (!std::get<0>(ret)) return ret;
+		missBytes += rangeLength;
+
+		for (uint64_t chunk = firstChunk; chunk <= lastChunk; chunk++) {
+			const uint64_t chunkOffset = chunk * CHUNK_SIZE - rangeOffset;
+			writeChunk(resource, chunk, fb.data + chunkOffset, std::min(CHUNK_SIZE, rangeLength - chunkOffset));
+		}
+		const uint64_t start = std::max(offset, rangeOffset);
+		const uint64_t end = std::min(offset + length, rangeEnd);
+		memcpy(buf + (start - offset), fb.data + (start - rangeOffset), end - start);
+		return ret;
+	}
+
+	std::tuple<bool, long> CachedHttpDownload::read(const CacheResource &resource, uint8_t *buf, uint64_t offset,
+	                                                uint64_t length) const {
+		const uint64_t end = offset + length;
+		const uint64_t firstChunk = offset / CHUNK_SIZE;
+		const uint64_t lastChunk = (end - 1) / CHUNK_SIZE;
+		// Consecutive missing chunks are fetched in one request
+		uint64_t missStart = UINT64_MAX;
+		for (uint64_t chunk = firstChunk; chunk <= lastChunk; chunk++) {
+			const uint64_t chunkOffset = chunk * CHUNK_SIZE;
+			const uint64_t start = std::max(offset, chunkOffset);
+			const uint64_t stop = std::min(end, chunkOffset + CHUNK_SIZE);
+			if (readChunk(resource, chunk, buf + (start - offset), start - chunkOffset, stop - start)) {
+				hitBytes += stop - start;
+				if (missStart != UINT64_MAX) {
+					const auto ret = fetchChunks(resource, missStart, chunk - 1, buf, offset, length);
+					if (!std::get<0>(ret)) return ret;
+					missStart = UINT64_MAX;
+				}
+			} else if (missStart == UINT64_MAX) {
+				missStart = chunk;
+			}
+		}
+		if (missStart != UINT64_MAX) {
+			return fetchChunks(resource, missStart, lastChunk, buf, offset, length);
+		}
+		return {true, 206};
+	}
+
+	std::tuple<bool, long> CachedHttpDownload::download(std::string &data, uint64_t offset, uint64_t length) const {
+		CacheResource resource;
+		if (!initResource(resource) || length == 0 || offset + length > resource.fileSize) {
+			return upstream->download(data, offset, length);
+		}
+		const uint64_t oldSize = data.size();
+		data.resize(oldSize + length);
+		const auto ret = read(resource, reinterpret_cast<uint8_t *>(data.data()) + oldSize, offset, length);
+		if (!std::get<0>(ret)) {
+			data.resize(oldSize);
+		}
+		return ret;
+	}
+
+	std::tuple<bool, long> CachedHttpDownload::download(FileBuffer &fb, uint64_t offset, uint64_t length) const {
+		return download(fb, 0, offset, length);
+	}
+
+	std::tuple<bool, long> CachedHttpDownload::download(FileBuffer &fb, uint64_t fbDataOffset, uint64_t offset,
+	                                                    uint64_t length) const {
+		CacheResource resource;
+		if (!initResource(resource) || length == 0 || offset + length > resource.fileSize) {
+			return upstream->download(fb, fbDataOffset, offset, length);
+		}
+		const auto ret = read(resource, fb.data + fbDataOffset + fb.offset, offset, length);
+		if (std::get<0>(ret)) {
+			fb.offset += length;
+		}
+		return ret;
+	}
+
+	std::string CachedHttpDownload::getStats() const {
+		constexpr uint64_t mib = 1024 * 1024;
+		std::string stats = std::format("cache hit: {}MiB miss: {}MiB",
+		                                hitBytes.load() / mib, missBytes.load() / mib);
+		if (const std::string upstreamStats = upstream->getStats(); !upstreamStats.empty()) {
+			stats += " | " + upstreamStats;
+		}
+		return stats;
+	}
+}
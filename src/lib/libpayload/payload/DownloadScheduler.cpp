@@ -0,0 +1,266 @@
+#include <algorithm>
+#include <format>
+
+#include "payload/DownloadScheduler.h"
+#include "payload/LogBase.h"
+
+namespace skkk {
+	DownloadScheduler::DownloadScheduler(uint32_t initialLimit, uint32_t maxLimit, uint32_t decodeLimit)
+		: poolLimit(std::max<uint32_t>(maxLimit, 1)),
+		  maxLimit(std::max<uint32_t>(maxLimit, 1)),
+		  decodeLimit(std::max<uint32_t>(decodeLimit, 1)) {
+		limit = std::clamp<uint32_t>(initialLimit, 1, this->maxLimit);
+		peakLimit = limit;
+		resetWindow();
+	}
+
+	void DownloadScheduler::resetWindow() {
+		windowBytes = 0;
+		windowCount = 0;
+		windowStart = std::chrono::steady_clock::now();
+	}
+
+	void DownloadScheduler::chargeRate(uint64_t bytes, std::chrono::steady_clock::time_point now) {
+		if (rateLimit > 0) {
+			const auto cost = std::chrono::duration<double>(static_cast<double>(bytes) / rateLimit);
+			rateNext = std::max(rateNext, now) +
+			           std::chrono::duration_cast<std::chrono::steady_clock::duration>(cost);
+		}
+	}
+
+	void DownloadScheduler::acquire(uint64_t bytes) {
+		std::unique_lock lock{mutex};
+		while (true) {
+			cv.wait(lock, [this] { return !isPaused && inFlight < limit; });
+			const auto now = std::chrono::steady_clock::now();
+			if (rateLimit == 0 || rateNext <= now) break;
+			// Woken early by a change of the settings, the loop checks them again
+			cv.wait_until(lock, rateNext);
+		}
+		chargeRate(bytes, std::chrono::steady_clock::now());
+		++inFlight;
+	}
+
+	void DownloadScheduler::acquireTask(uint64_t bytes) {
+		std::unique_lock lock{mutex};
+		while (true) {
+			cv.wait(lock, [this, bytes] { return !isPaused && tasks < limit && (bytes == 0 || inFlight < limit); });
+			const auto now = std::chrono::steady_clock::now();
+			if (bytes == 0 || rateLimit == 0 || rateNext <= now) break;
+			cv.wait_until(lock, rateNext);
+		}
+		++tasks;
+		if (bytes > 0) {
+			chargeRate(bytes, std::chrono::steady_clock::now());
+			++inFlight;
+		}
+	}
+
+	void DownloadScheduler::releaseTask() {
+		{
+			std::lock_guard lock{mutex};
+			--tasks;
+		}
+		cv.notify_all();
+	}
+
+	bool DownloadScheduler::tryAcquire(uint64_t bytes) {
+		std::lock_guard lock{mutex};
+		const auto now = std::chrono::steady_clock::now();
+		if (isPaused || inFlight >= limit || (rateLimit > 0 && rateNext > now)) return false;
+		chargeRate(bytes, now);
+		++inFlight;
+		return true;
+	}
+
+	void DownloadScheduler::release(uint64_t bytes, bool isSuccess, std::chrono::steady_clock::duration elapsed) {
+		{
+			std::lock_guard lock{mutex};
+			--inFlight;
+			if (!isSuccess) {
+				++failCount;
+				limit = std::max<uint32_t>(limit / 2, 1);
+				lastThroughput = 0;
+				resetWindow();
+				LOGCD("download limit={} (failure)", limit);
+			} else {
+				if (bytes > 0) {
+					const double sample = std::chrono::duration<double>(elapsed).count() / bytes;
+					if (latencySamples.size() < LATENCY_SAMPLES) {
+						latencySamples.emplace_back(sample);
+					} else {
+						latencySamples[latencyIndex] = sample;
+						latencyIndex = (latencyIndex + 1) % LATENCY_SAMPLES;
+					}
+				}
+				windowBytes += bytes;
+				totalBytes += bytes;
+				if (++windowCount >= limit) {
+					const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - windowStart;
+					const double throughput = windowBytes / std::max(elapsed.count(), 1e-3);
+					if (throughput > lastThroughput * 1.05) {
+						limit = std::min(limit + 1, maxLimit);
+					} else if (throughput < lastThroughput * 0.8) {
+						limit = std::max<uint32_t>(limit * 3 / 4, 1);
+					}
+					peakLimit = std::max(peakLimit, limit);
+					lastThroughput = throughput;
+					resetWindow();
+					LOGCD("download limit={} throughput={:.0f}KiB/s", limit, throughput / 1024);
+				}
+			}
+		}
+		cv.notify_all();
+	}
+
+	void DownloadScheduler::releaseUnused() {
+		{
+			std::lock_guard lock{mutex};
+			--inFlight;
+		}
+		cv.notify_all();
+	}
+
+	std::chrono::milliseconds DownloadScheduler::getHedgeDelay(uint64_t bytes, uint32_t percentile) const {
+		std::vector<double> samples;
+		{
+			std::lock_guard lock{mutex};
+			if (percentile == 0 || latencySamples.size() < LATENCY_SAMPLES / 4) return {};
+			samples = latencySamples;
+		}
+		const size_t index = std::min<size_t>(samples.size() * std::min(percentile, 100u) / 100, samples.size() - 1);
+		std::ranges::nth_element(samples, samples.begin() + index);
+		const auto delay = std::chrono::duration<double>(samples[index] * bytes);
+		// Never hedge requests that are fast anyway
+		return std::max(std::chrono::duration_cast<std::chrono::milliseconds>(delay),
+		                std::chrono::milliseconds(1000));
+	}
+
+	void DownloadScheduler::addHedge() {
+		std::lock_guard lock{mutex};
+		++hedgeCount;
+	}
+
+	HedgeRunner &DownloadScheduler::getHedgeRunner() {
+		return hedgeRunner;
+	}
+
+	void DownloadScheduler::setFailed() {
+		isFailed = true;
+	}
+
+	bool DownloadScheduler::hasFailed() const {
+		return isFailed;
+	}
+
+	bool DownloadScheduler::resetFailed() {
+		bool wasFailed = false;
+		{
+			std::lock_guard lock{mutex};
+			wasFailed = isFailed.exchange(false);
+			++urlVersion;
+		}
+		cv.notify_all();
+		return wasFailed;
+	}
+
+	void DownloadScheduler::setUrlReplaceable(bool replaceable) {
+		isUrlReplaceable = replaceable;
+	}
+
+	bool DownloadScheduler::getUrlReplaceable() const {
+		return isUrlReplaceable;
+	}
+
+	uint64_t DownloadScheduler::getUrlVersion() const {
+		std::lock_guard lock{mutex};
+		return urlVersion;
+	}
+
+	void DownloadScheduler::waitUrlChange(uint64_t version, std::chrono::milliseconds timeout) {
+		std::unique_lock lock{mutex};
+		cv.wait_for(lock, timeout, [this, version] { return urlVersion != version; });
+	}
+
+	void DownloadScheduler::acquireDecode() {
+		std::unique_lock lock{mutex};
+		cv.wait(lock, [this] { return decoding < decodeLimit; });
+		++decoding;
+	}
+
+	void DownloadScheduler::releaseDecode() {
+		{
+			std::lock_guard lock{mutex};
+			--decoding;
+		}
+		cv.notify_all();
+	}
+
+	uint32_t DownloadScheduler::getMaxLimit() const {
+		std::lock_guard lock{mutex};
+		return maxLimit;
+	}
+
+	uint32_t DownloadScheduler::getPoolLimit() const {
+		return poolLimit;
+	}
+
+	void DownloadScheduler::setMaxLimit(uint32_t maxLimit) {
+		{
+			std::lock_guard lock{mutex};
+			this->maxLimit = std::clamp<uint32_t>(maxLimit, 1, poolLimit);
+			limit = std::min(limit, this->maxLimit);
+			resetWindow();
+			LOGCD("download maxLimit={}", this->maxLimit);
+		}
+		cv.notify_all();
+	}
+
+	void DownloadScheduler::setDecodeLimit(uint32_t decodeLimit) {
+		{
+			std::lock_guard lock{mutex};
+			this->decodeLimit = std::max<uint32_t>(decodeLimit, 1);
+			LOGCD("decodeLimit={}", this->decodeLimit);
+		}
+		cv.notify_all();
+	}
+
+	void DownloadScheduler::setRateLimit(uint64_t rateLimit) {
+		{
+			std::lock_guard lock{mutex};
+			this->rateLimit = rateLimit;
+			// Debt of the old limit is not carried over
+			rateNext = std::chrono::steady_clock::now();
+			lastThroughput = 0;
+			resetWindow();
+			LOGCD("download rateLimit={}", rateLimit);
+		}
+		cv.notify_all();
+	}
+
+	void DownloadScheduler::setPaused(bool paused) {
+		{
+			std::lock_guard lock{mutex};
+			isPaused = paused;
+			if (!paused) {
+				lastThroughput = 0;
+				resetWindow();
+			}
+		}
+		cv.notify_all();
+	}
+
+	DownloadMetrics DownloadScheduler::getMetrics() const {
+		std::lock_guard lock{mutex};
+		return {
+			limit, peakLimit, maxLimit, inFlight, decodeLimit, decoding, isPaused,
+			rateLimit, totalBytes, failCount, hedgeCount, lastThroughput
+		};
+	}
+
+	std::string DownloadScheduler::getStats() const {
+		std::lock_guard lock{mutex};
+		return std::format("limit: {} peak: {} max: {} failed: {} hedged: {}",
+		                   limit, peakLimit, maxLimit, failCount, hedgeCount);
+	}
+}
@@ -1,7 +1,13 @@
 #include <string>
 
+#include "payload/CachedHttpDownload.h"
 #include "payload/ExtractConfig.h"
+#include "payload/LogBase.h"
+#include "payload/MirrorHttpDownload.h"
 #include "payload/Utils.h"
+#if defined(ENABLE_HTTP2)
+#include "payload/httpDownloadImpl/CurlMultiHttpDownload.h"
+#endif
 
 namespace skkk {
 	ExtractConfig::ExtractConfig(int payloadType, const std::string &payloadPath,
@@ -54,6 +60,34 @@ namespace skkk {
 		return outConfig;
 	}
 
+	const std::vector<std::string> &ExtractConfig::getMirrorUrls() const {
+		return mirrorUrls;
+	}
+
+	void ExtractConfig::addMirrorUrl(const std::string &url) {
+		std::string tmp{url};
+		strTrim(tmp);
+		mirrorUrls.emplace_back(tmp);
+	}
+
+	const std::string &ExtractConfig::getCacheDir() const {
+		return cacheDir;
+	}
+
+	void ExtractConfig::setCacheDir(const std::string &path) {
+		strTrim(cacheDir = path);
+		handleWinPath(cacheDir);
+	}
+
+	const std::string &ExtractConfig::getIndexDir() const {
+		return indexDir;
+	}
+
+	void ExtractConfig::setIndexDir(const std::string &path) {
+		strTrim(indexDir = path);
+		handleWinPath(indexDir);
+	}
+
 	const std::string &ExtractConfig::getTargetName() const {
 		return targetName;
 	}
@@ -70,14 +104,47 @@ namespace skkk {
 		targets = target;
 	}
 
+	std::shared_ptr<HttpDownload> ExtractConfig::createHttpDownload(const std::string &url) const {
+#if defined(ENABLE_HTTP2)
+		if (http2Streams > 0) {
+			return std::make_shared<CurlMultiHttpDownload>(url, sslVerification, http2Streams, http2Connections);
+		}
+#endif
+#if defined(ENABLE_HTTP_CPR)
+		return std::make_shared<CprHttpDownload>(url, sslVerification);
+#else
+		return std::make_shared<HttpDownload>(url, sslVerification);
+#endif
+	}
+
 	const std::shared_ptr<HttpDownload> &ExtractConfig::getHttpDownloadImpl() {
 		std::unique_lock lock(_mutex);
 		if (isUrl && !httpDownload) {
-#if defined(ENABLE_HTTP_CPR)
-			httpDownload = std::make_shared<CprHttpDownload>(payloadPath, sslVerification);
-#else
-			httpDownload = std::make_shared<HttpDownload>(payloadPath, sslVerification);
+#if !defined(ENABLE_HTTP2)
+			if (http2Streams > 0) {
+				LOGCW("HTTP/2: not supported by this build, downloading over HTTP/1.1");
+			}
 #endif
+			if (mirrorUrls.empty()) {
+				httpDownload = createHttpDownload(payloadPath);
+			} else {
+				std::vector<std::string> urls{payloadPath};
+				std::vector<std::shared_ptr<HttpDownload>> httpDownloads;
+				urls.insert(urls.end(), mirrorUrls.begin(), mirrorUrls.end());
+				for (const auto &url: urls) {
+					httpDownloads.emplace_back(createHttpDownload(url));
+				}
+				auto mirrorHttpDownload = std::make_shared<MirrorHttpDownload>(httpDownloads, urls);
+				if (mirrorHttpDownload->verifyMirrors() == 0) {
+					LOGCE("Mirror: none of the {} urls is reachable", urls.size());
+					return httpDownload;
+				}
+				httpDownload = mirrorHttpDownload;
+			}
+			if (!cacheDir.empty()) {
+				httpDownload = std::make_shared<CachedHttpDownload>(httpDownload, payloadPath,
+				                                                    cacheDir, cacheMaxSize);
+			}
 		}
 		return httpDownload;
 	}
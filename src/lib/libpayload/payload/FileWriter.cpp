@@ -1,10 +1,12 @@
-#include <random>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 #include <bsdiff/bspatch.h>
 
 #include "decompress/Decompress.h"
 #include "payload/FileWriter.h"
 #include "payload/HttpDownload.h"
+#include "payload/LogBase.h"
 #include "payload/update_metadata.pb.h"
 #include "payload/Utils.h"
 #include "payload/common/Buffer.hpp"
@@ -13,28 +15,158 @@
 using namespace chromeos_update_engine;
 
 namespace skkk {
-	static std::random_device rd;
-	static std::mt19937 mt{rd()};
-	static std::uniform_int_distribution<uint32_t> randomWaitTime(1200, 3000);
+	FileWriter::FileWriter(const std::shared_ptr<HttpDownload> &httpDownload,
+	                       DownloadScheduler *downloadScheduler, const RetryPolicy &retryPolicy)
+		: httpDownload(httpDownload),
+		  downloadScheduler(downloadScheduler),
+		  retryPolicy(retryPolicy) {
+	}
 
-	static uint32_t getRdWaitTime() {
-		return randomWaitTime(mt);
+	int FileWriter::urlRead(uint8_t *buf, const FileOperation &operation) const {
+		return urlRead(buf, operation.dataOffset, operation.dataLength);
 	}
 
-	FileWriter::FileWriter(const std::shared_ptr<HttpDownload> &httpDownload)
-		: httpDownload(httpDownload) {
+	int FileWriter::urlRead(uint8_t *buf, uint64_t offset, uint64_t length, bool hasSlot) const {
+		const std::vector<ScatterSegment> segments{{buf, length}};
+		return urlReadScatter(segments, offset, length, hasSlot);
 	}
 
-	int FileWriter::urlRead(uint8_t *buf, const FileOperation &operation) const {
-		FileBuffer fb{buf, 0};
+	std::tuple<bool, long> FileWriter::downloadHedged(const std::vector<ScatterSegment> &segments,
+	                                                  uint64_t offset, uint64_t length) const {
+		std::chrono::milliseconds hedgeDelay{0};
+		if (downloadScheduler) {
+			hedgeDelay = downloadScheduler->getHedgeDelay(length, retryPolicy.hedgePercentile);
+		}
+		if (hedgeDelay.count() == 0) {
+			return httpDownload->downloadScatter(segments, offset, length);
+		}
 
-	retry:
-		if (std::get<0>(httpDownload->download(fb, operation.dataOffset, operation.dataLength))) {
-			return 0;
+		// Whichever request completes first cancels the other one
+		std::atomic_bool primaryCancel = false, hedgeCancel = false;
+		std::mutex hedgeMutex;
+		std::condition_variable hedgeCv;
+		bool isHedgeDone = false, isHedgeSuccess = false;
+		Buffer<uint8_t> hedgeBuffer;
+		auto &hedgeRunner = downloadScheduler->getHedgeRunner();
+		const auto hedgeKey = hedgeRunner.schedule(hedgeDelay, [&] {
+			bool isSuccess = false;
+			if (!hedgeCancel) {
+				// The hedge needs a free slot of its own, it is skipped at the limit or bandwidth cap
+				DownloadSlot slot{downloadScheduler, length, std::try_to_lock};
+				if (slot.ownsSlot()) {
+					downloadScheduler->addHedge();
+					hedgeBuffer.reserve(length);
+					const std::vector<ScatterSegment> hedgeSegments{{hedgeBuffer.get(), length}};
+					isSuccess = std::get<0>(httpDownload->downloadScatter(hedgeSegments, offset, length,
+					                                                      &hedgeCancel));
+					if (isSuccess) primaryCancel = true;
+					slot.setSuccess(isSuccess);
+					if (hedgeCancel) slot.setCancelled();
+				}
+			}
+			{
+				std::lock_guard lock{hedgeMutex};
+				isHedgeDone = true;
+				isHedgeSuccess = isSuccess;
+			}
+			hedgeCv.notify_all();
+		});
+		const auto ret = httpDownload->downloadScatter(segments, offset, length, &primaryCancel);
+		if (std::get<0>(ret)) hedgeCancel = true;
+		// Not started yet, nothing refers to this frame any more
+		if (hedgeRunner.cancel(hedgeKey)) {
+			return ret;
+		}
+		{
+			std::unique_lock lock{hedgeMutex};
+			hedgeCv.wait(lock, [&] { return isHedgeDone; });
 		}
-		fb.offset = 0;
-		std::this_thread::sleep_for(std::chrono::milliseconds(getRdWaitTime()));
-		goto retry;
+		if (!isHedgeSuccess || std::get<0>(ret)) {
+			return ret;
+		}
+
+		// The hedged request won, the primary may have filled part of the segments
+		const uint8_t *src = hedgeBuffer.get();
+		for (const auto &segment: segments) {
+			if (segment.data) {
+				memcpy(segment.data, src, segment.length);
+			} else if (segment.sink) {
+				segment.sink->reset();
+				segment.sink->write(src, segment.length);
+			}
+			src += segment.length;
+		}
+		return {true, 206};
+	}
+
+	static bool isPermanentHttpError(long statusCode) {
+		return statusCode >= 400 && statusCode < 500 && statusCode != 408 && statusCode != 429;
+	}
+
+	static bool isExpiredUrlError(long statusCode) {
+		return statusCode == 401 || statusCode == 403 || statusCode == 410;
+	}
+
+	static int httpErrorToErrno(long statusCode) {
+		switch (statusCode) {
+			case 401:
+			case 403:
+				return -EACCES;
+			case 404:
+			case 410:
+				return -ENOENT;
+			case 416:
+				return -ERANGE;
+			default:
+				return statusCode > 0 ? -EIO : -ETIMEDOUT;
+		}
+	}
+
+	int FileWriter::urlReadScatter(const std::vector<ScatterSegment> &segments, uint64_t offset,
+	                               uint64_t length, bool hasSlot) const {
+		long statusCode = 0;
+		const uint32_t maxAttempts = retryPolicy.maxAttempts;
+		uint32_t failures = 0;
+
+		for (uint32_t attempt = 0; maxAttempts == 0 || failures < maxAttempts; attempt++) {
+			const bool isAdopted = hasSlot && attempt == 0 && downloadScheduler;
+			if (downloadScheduler && downloadScheduler->hasFailed()) {
+				if (isAdopted) downloadScheduler->releaseUnused();
+				return -ECANCELED;
+			}
+			if (attempt > 0) {
+				for (const auto &segment: segments) {
+					if (segment.sink) segment.sink->reset();
+				}
+			}
+			const uint64_t urlVersion = downloadScheduler ? downloadScheduler->getUrlVersion() : 0;
+			{
+				DownloadSlot slot = isAdopted
+					                    ? DownloadSlot{downloadScheduler, length, std::adopt_lock}
+					                    : DownloadSlot{downloadScheduler, length};
+				const auto ret = downloadHedged(segments, offset, length);
+				if (std::get<0>(ret)) {
+					slot.setSuccess(true);
+					return 0;
+				}
+				statusCode = std::get<1>(ret);
+			}
+			LOGCD("download failed offset={} length={} attempt={}/{} hc={}",
+			      offset, length, attempt + 1, maxAttempts, statusCode);
+			// An expired signed url is replaced with -R, the attempts are not used up meanwhile
+			if (downloadScheduler && downloadScheduler->getUrlReplaceable() && isExpiredUrlError(statusCode)) {
+				downloadScheduler->waitUrlChange(urlVersion, retryPolicy.maxDelay);
+				continue;
+			}
+			failures++;
+			// A wrong url does not get better by retrying
+			if (maxAttempts > 0 && (failures >= maxAttempts || isPermanentHttpError(statusCode))) break;
+			std::this_thread::sleep_for(retryPolicy.getDelay(failures - 1));
+		}
+		if (downloadScheduler) {
+			downloadScheduler->setFailed();
+		}
+		return httpErrorToErrno(statusCode);
 	}
 
 	int FileWriter::commonWrite(const decompressPtr &decompress, const uint8_t *payloadData, uint8_t *outData,
@@ -45,20 +177,15 @@ namespace skkk {
 		if (httpDownload) {
 			srcBuffer.reserve(operation.dataLength);
 			srcData = srcBuffer.get();
-			urlRead(srcData, operation);
+			ret = urlRead(srcData, operation);
+			if (ret) return ret;
 		} else {
 			srcData = const_cast<uint8_t *>(payloadData + operation.dataOffset);
 		}
 		if (srcData) {
+			// Decoded straight into the output, the dst extent is owned by this operation
 			auto &dst = operation.dstExtents[0];
-			Buffer<uint8_t> destBuffer{dst.dataLength};
-			if (auto *destBuf = destBuffer.get()) {
-				uint64_t outDestLength = dst.dataLength;
-				ret = decompress(srcData, operation.dataLength, destBuf, outDestLength);
-				if (!ret) {
-					ret = memcpy(outData + dst.dataOffset, destBuf, dst.dataLength) ? 0 : -EIO;
-				}
-			}
+			ret = decompress(srcData, operation.dataLength, outData + dst.dataOffset, dst.dataLength);
 		}
 		return ret;
 	}
@@ -70,7 +197,8 @@ namespace skkk {
 		if (httpDownload) {
 			srcBuffer.reserve(operation.dataLength);
 			srcData = srcBuffer.get();
-			urlRead(srcData, operation);
+			ret = urlRead(srcData, operation);
+			if (ret) return ret;
 		} else {
 			srcData = const_cast<uint8_t *>(payloadData + operation.dataOffset);
 		}
@@ -109,7 +237,7 @@ namespace skkk {
 		return ret;
 	}
 
-	int FileWriter::extentsRead(const uint8_t *inData, uint8_t *data, const std::vector<Extent> &extents) {
+	int FileWriter::extentsRead(const uint8_t *inData, uint8_t *data, std::span<const Extent> extents) {
 		int ret = -1;
 		for (const auto &e: extents) {
 			ret = memcpy(data, inData + e.dataOffset, e.dataLength) == data ? 0 : -EIO;
@@ -119,7 +247,7 @@ namespace skkk {
 		return ret;
 	}
 
-	int FileWriter::extentsWrite(uint8_t *outData, const uint8_t *srcData, const std::vector<Extent> &extents) {
+	int FileWriter::extentsWrite(uint8_t *outData, const uint8_t *srcData, std::span<const Extent> extents) {
 		int ret = -1;
 		for (const auto &e: extents) {
 			ret = memcpy(outData + e.dataOffset, srcData, e.dataLength) ? 0 : -EIO;
@@ -153,7 +281,8 @@ namespace skkk {
 		if (httpDownload) {
 			patchBuffer.reserve(patchDataLength);
 			patchData = patchBuffer.get();
-			urlRead(patchData, operation);
+			ret = urlRead(patchData, operation);
+			if (ret) return ret;
 		} else {
 			patchData = const_cast<uint8_t *>(payloadData + operation.dataOffset);
 		}
@@ -211,4 +340,33 @@ namespace skkk {
 		}
 		return ret;
 	}
+
+	FileOperation FileWriter::getBufferOperation(const FileOperation &operation, std::vector<Extent> &bufExtents) {
+		FileOperation bufOperation = operation;
+		bufExtents.assign(operation.dstExtents.begin(), operation.dstExtents.end());
+		uint64_t offset = 0;
+		for (auto &dst: bufExtents) {
+			dst.dataOffset = offset;
+			offset += dst.dataLength;
+		}
+		bufOperation.dstExtents = bufExtents;
+		return bufOperation;
+	}
+
+	int FileWriter::writeDataToBuffer(const uint8_t *payloadData, const uint8_t *inData, uint8_t *buf,
+	                                  const FileOperation &operation) const {
+		std::vector<Extent> bufExtents;
+		const FileOperation bufOperation = getBufferOperation(operation, bufExtents);
+		return writeDataByType(payloadData, inData, buf, bufOperation);
+	}
+
+	int FileWriter::writeDataFromRange(const uint8_t *rangeData, uint64_t rangeOffset, const uint8_t *inData,
+	                                   uint8_t *outData, const FileOperation &operation) {
+		static const std::shared_ptr<HttpDownload> noHttpDownload;
+		static const RetryPolicy noRetryPolicy;
+		const FileWriter fw{noHttpDownload, nullptr, noRetryPolicy};
+		FileOperation rangeOperation = operation;
+		rangeOperation.dataOffset -= rangeOffset;
+		return fw.writeDataByType(rangeData, inData, outData, rangeOperation);
+	}
 }
@@ -0,0 +1,63 @@
+#include <algorithm>
+
+#include "payload/HedgeRunner.h"
+
+namespace skkk {
+	HedgeRunner::HedgeRunner(uint32_t threadNum)
+		: threadNum(std::max<uint32_t>(threadNum, 1)) {
+	}
+
+	HedgeRunner::~HedgeRunner() {
+		{
+			std::lock_guard lock{mutex};
+			isStopping = true;
+		}
+		cv.notify_all();
+		for (auto &thread: threads) {
+			thread.join();
+		}
+	}
+
+	HedgeRunner::Key HedgeRunner::schedule(std::chrono::steady_clock::duration delay, Task task) {
+		Key key;
+		{
+			std::lock_guard lock{mutex};
+			if (threads.empty()) {
+				threads.reserve(threadNum);
+				for (uint32_t i = 0; i < threadNum; i++) {
+					threads.emplace_back(&HedgeRunner::run, this);
+				}
+			}
+			key = {std::chrono::steady_clock::now() + delay, nextId++};
+			queue.emplace(key, std::move(task));
+		}
+		// The new task may be due before the one the threads wait for
+		cv.notify_all();
+		return key;
+	}
+
+	bool HedgeRunner::cancel(const Key &key) {
+		std::lock_guard lock{mutex};
+		return queue.erase(key) > 0;
+	}
+
+	void HedgeRunner::run() {
+		std::unique_lock lock{mutex};
+		while (!isStopping) {
+			if (queue.empty()) {
+				cv.wait(lock);
+				continue;
+			}
+			const auto it = queue.begin();
+			if (it->first.first > std::chrono::steady_clock::now()) {
+				cv.wait_until(lock, it->first.first);
+				continue;
+			}
+			Task task = std::move(it->second);
+			queue.erase(it);
+			lock.unlock();
+			task();
+			lock.lock();
+		}
+	}
+}
@@ -1,6 +1,7 @@
 #include "payload/HttpDownload.h"
 #include "payload/LogBase.h"
 #include "payload/Utils.h"
+#include "payload/common/Buffer.hpp"
 
 namespace skkk {
 	FileBuffer::FileBuffer(uint8_t *data, uint64_t offset)
@@ -22,6 +23,10 @@ namespace skkk {
 		return 0;
 	}
 
+	std::string HttpDownload::getValidator() const {
+		return {};
+	}
+
 	std::tuple<bool, long> HttpDownload::download(std::string &data, uint64_t offset, uint64_t length) const {
 		LOGE("The download(std::string, uint64_t offset, uint64_t length) is not implemented.");
 		return {false, -1};
@@ -38,4 +43,35 @@ namespace skkk {
 			"The download(FileBuffer &fb, uint64_t fbDataOffset, uint64_t offset, uint64_t length) is not implemented.");
 		return {false, -1};
 	}
+
+	std::tuple<bool, long> HttpDownload::downloadScatter(const std::vector<ScatterSegment> &segments,
+	                                                     uint64_t offset, uint64_t length,
+	                                                     const std::atomic_bool *cancel) const {
+		if (segments.size() == 1 && segments[0].data) {
+			FileBuffer fb{segments[0].data, 0};
+			return download(fb, offset, length);
+		}
+		Buffer<uint8_t> buffer{length};
+		FileBuffer fb{buffer.get(), 0};
+		const auto ret = download(fb, offset, length);
+		if (cancel && *cancel) {
+			return {false, -1};
+		}
+		if (std::get<0>(ret)) {
+			const uint8_t *src = buffer.get();
+			for (const auto &segment: segments) {
+				if (segment.data) {
+					memcpy(segment.data, src, segment.length);
+				} else if (segment.sink && !segment.sink->write(src, segment.length)) {
+					return {false, -1};
+				}
+				src += segment.length;
+			}
+		}
+		return ret;
+	}
+
+	std::string HttpDownload::getStats() const {
+		return {};
+	}
 }
@@ -0,0 +1,322 @@
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <ranges>
+
+#include "payload/LogBase.h"
+#include "payload/ManifestIndex.h"
+#include "payload/PayloadInfo.h"
+#include "payload/Utils.h"
+#include "payload/common/io.h"
+#include "payload/mman/mmap.hpp"
+
+namespace skkk {
+	/**
+	 * Keeps the index mapped while partitions use its extents.
+	 */
+	class IndexMapping {
+		public:
+			int fd = -1;
+			const uint8_t *data = nullptr;
+			uint64_t size = 0;
+
+		public:
+			IndexMapping() = default;
+
+			IndexMapping(const IndexMapping &other) = delete;
+
+			IndexMapping &operator=(const IndexMapping &other) = delete;
+
+			~IndexMapping() {
+				unmap(data, size);
+				closeFd(fd);
+			}
+	};
+
+	static uint64_t hashManifest(const uint8_t *data, uint64_t size) {
+		// FNV-1a over 8 byte words, only has to tell manifests apart
+		uint64_t hash = 0xcbf29ce484222325ULL ^ size;
+		uint64_t i = 0;
+		for (; i + 8 <= size; i += 8) {
+			uint64_t word = 0;
+			memcpy(&word, data + i, sizeof(word));
+			hash = (hash ^ word) * 0x100000001b3ULL;
+			hash ^= hash >> 29;
+		}
+		for (; i < size; i++) {
+			hash = (hash ^ data[i]) * 0x100000001b3ULL;
+		}
+		return hash;
+	}
+
+	static uint64_t alignSection(uint64_t offset) {
+		return (offset + 7) & ~7ULL;
+	}
+
+	ManifestIndex::ManifestIndex(PayloadInfo &payloadInfo, const std::string &indexDir, uint64_t payloadSize)
+		: payloadInfo(payloadInfo),
+		  payloadSize(payloadSize) {
+		auto &pHeader = payloadInfo.pHeader;
+		manifestHash = hashManifest(pHeader.manifest.get(), pHeader.manifestSize);
+		path = std::format("{}/{}_{:016x}.idx", indexDir, payloadSize, manifestHash);
+	}
+
+	const std::string &ManifestIndex::getPath() const {
+		return path;
+	}
+
+	bool ManifestIndex::isHeaderValid(const IndexHeader &header, uint64_t fileSize) const {
+		const auto &pHeader = payloadInfo.pHeader;
+		auto isSectionValid = [&](uint64_t offset, uint64_t count, uint64_t recordSize) {
+			return offset <= fileSize && count <= (fileSize - offset) / recordSize;
+		};
+		return memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 &&
+		       header.version == INDEX_VERSION &&
+		       header.headerSize == sizeof(IndexHeader) &&
+		       header.partitionRecordSize == sizeof(IndexPartition) &&
+		       header.operationRecordSize == sizeof(IndexOperation) &&
+		       header.extentRecordSize == sizeof(Extent) &&
+		       header.payloadSize == payloadSize &&
+		       header.payloadOffset == payloadInfo.getPayloadOffset() &&
+		       header.inPayloadOffset == pHeader.inPayloadOffset &&
+		       header.manifestSize == pHeader.manifestSize &&
+		       header.manifestHash == manifestHash &&
+		       isSectionValid(header.partitionsOffset, header.partitionCount, sizeof(IndexPartition)) &&
+		       isSectionValid(header.operationsOffset, header.operationCount, sizeof(IndexOperation)) &&
+		       isSectionValid(header.extentsOffset, header.extentCount, sizeof(Extent)) &&
+		       isSectionValid(header.stringsOffset, header.stringsSize, 1);
+	}
+
+	bool ManifestIndex::load() {
+		auto indexMapping = std::make_shared<IndexMapping>();
+		if (!fileExists(path) ||
+		    mapRdByPath(indexMapping->fd, path, indexMapping->data, indexMapping->size)) {
+			return false;
+		}
+		const uint8_t *data = indexMapping->data;
+		if (indexMapping->size < sizeof(IndexHeader)) return false;
+		const auto &header = *reinterpret_cast<const IndexHeader *>(data);
+		if (!isHeaderValid(header, indexMapping->size)) {
+			LOGCD("Index: '{}' does not match the payload", path);
+			return false;
+		}
+		const auto *partitions = reinterpret_cast<const IndexPartition *>(data + header.partitionsOffset);
+		const auto *strings = reinterpret_cast<const char *>(data + header.stringsOffset);
+
+		// All references are checked before anything is taken over, operations in loadOperations
+		auto isStringValid = [&](const IndexString &str) {
+			return str.offset <= header.stringsSize && str.length <= header.stringsSize - str.offset;
+		};
+		if (!isStringValid(header.securityPatchLevel) || !isStringValid(header.dynamicPartitionMetadata)) {
+			return false;
+		}
+		for (uint64_t i = 0; i < header.partitionCount; i++) {
+			const auto &ip = partitions[i];
+			if (!isStringValid(ip.name) || !isStringValid(ip.oldHash) || !isStringValid(ip.newHash) ||
+			    !isStringValid(ip.hashTreeAlgorithm) || !isStringValid(ip.hashTreeSalt) ||
+			    ip.firstOperation > header.operationCount ||
+			    ip.operationCount > header.operationCount - ip.firstOperation) {
+				return false;
+			}
+		}
+
+		auto getString = [&](const IndexString &str) {
+			return std::string{strings + str.offset, str.length};
+		};
+		auto &pHeader = payloadInfo.pHeader;
+		pHeader.blockSize = header.blockSize;
+		pHeader.partitionSize = header.partitionSize;
+		pHeader.minorVersion = header.minorVersion;
+		pHeader.securityPatchLevel = getString(header.securityPatchLevel);
+
+		DeltaArchiveManifest manifest;
+		if (header.dynamicPartitionMetadata.length > 0 &&
+		    !manifest.mutable_dynamic_partition_metadata()->ParseFromArray(
+			    strings + header.dynamicPartitionMetadata.offset,
+			    static_cast<int>(header.dynamicPartitionMetadata.length))) {
+			return false;
+		}
+		payloadInfo.dynamicPartitionMetadata.parseDynamicPartitionMetadata(manifest);
+
+		for (uint64_t i = 0; i < header.partitionCount; i++) {
+			const auto &ip = partitions[i];
+			auto &partInfo = payloadInfo.addPartitionInfo(getString(ip.name), ip.size,
+			                                              getString(ip.oldHash), ip.oldHashSize,
+			                                              getString(ip.newHash), ip.newHashSize);
+			partInfo.blockSize = ip.blockSize;
+			partInfo.hasHashTreeDataExtent = ip.hasHashTreeDataExtent;
+			partInfo.hashTreeDataExtent = ip.hashTreeDataExtent;
+			partInfo.hashTreeExtent = ip.hashTreeExtent;
+			partInfo.hashTreeAlgorithm = getString(ip.hashTreeAlgorithm);
+			partInfo.hashTreeSalt = getString(ip.hashTreeSalt);
+			partInfo.hasFecDataExtent = ip.hasFecDataExtent;
+			partInfo.fecDataExtent = ip.fecDataExtent;
+			partInfo.fecExtent = ip.fecExtent;
+			partInfo.fecRoots = ip.fecRoots;
+			partInfo.sourceIndex = i;
+		}
+		this->mapping = std::move(indexMapping);
+		this->header = &header;
+		LOGCD("Index: loaded '{}' partitions={} operations={}", path, header.partitionCount,
+		      header.operationCount);
+		return true;
+	}
+
+	bool ManifestIndex::loadOperations(PartitionInfo &info) const {
+		if (!header || info.sourceIndex >= header->partitionCount) return false;
+		const uint8_t *data = mapping->data;
+		const auto &ip = reinterpret_cast<const IndexPartition *>(data + header->partitionsOffset)[info.sourceIndex];
+		const auto *operations = reinterpret_cast<const IndexOperation *>(data + header->operationsOffset) +
+		                         ip.firstOperation;
+		const auto *extents = reinterpret_cast<const Extent *>(data + header->extentsOffset);
+
+		auto isExtentsValid = [&](uint64_t index, uint64_t count) {
+			return index <= header->extentCount && count <= header->extentCount - index;
+		};
+		for (uint64_t j = 0; j < ip.operationCount; j++) {
+			const auto &io = operations[j];
+			if (!isExtentsValid(io.srcExtentIndex, io.srcExtentCount) ||
+			    !isExtentsValid(io.dstExtentIndex, io.dstExtentCount)) {
+				LOGCE("Index: '{}' has invalid operations for {}", path, info.name);
+				return false;
+			}
+		}
+
+		auto &fops = info.operations;
+		fops.resize(ip.operationCount);
+		for (uint64_t j = 0; j < ip.operationCount; j++) {
+			const auto &io = operations[j];
+			auto &fop = fops[j];
+			fop.index = j;
+			fop.type = io.type;
+			fop.dataOffset = io.dataOffset;
+			fop.dataLength = io.dataLength;
+			fop.srcExtents = {extents + io.srcExtentIndex, io.srcExtentCount};
+			fop.srcTotalLength = io.srcTotalLength;
+			fop.dstExtents = {extents + io.dstExtentIndex, io.dstExtentCount};
+			fop.dstTotalLength = io.dstTotalLength;
+			memcpy(fop.srcDataSha256Hash.data(), io.srcDataSha256Hash, OPERATION_HASH_SIZE);
+			memcpy(fop.dataSha256Hash.data(), io.dataSha256Hash, OPERATION_HASH_SIZE);
+		}
+		info.extentStorage = mapping;
+		info.isOperationsInit = true;
+		return true;
+	}
+
+	bool ManifestIndex::save() const {
+		const auto &pHeader = payloadInfo.pHeader;
+		std::vector<IndexPartition> partitions;
+		std::vector<IndexOperation> operations;
+		std::vector<Extent> extents;
+		std::string strings;
+		auto addString = [&](const std::string &str) {
+			IndexString is{strings.size(), str.size()};
+			strings += str;
+			return is;
+		};
+		auto addExtents = [&](std::span<const Extent> span) {
+			const uint64_t index = extents.size();
+			extents.insert(extents.end(), span.begin(), span.end());
+			return index;
+		};
+
+		partitions.reserve(payloadInfo.partitionInfoMap.size());
+		for (const auto &partInfo: payloadInfo.partitionInfoMap | std::views::values) {
+			// Operations of partitions nobody asked for yet are built on a copy only
+			PartitionInfo info = partInfo;
+			if (!payloadInfo.initOperations(info)) return false;
+			IndexPartition ip = {};
+			ip.name = addString(info.name);
+			ip.size = info.size;
+			ip.blockSize = info.blockSize;
+			ip.fecRoots = info.fecRoots;
+			ip.oldHash = addString(info.oldHash);
+			ip.oldHashSize = info.oldHashSize;
+			ip.newHash = addString(info.newHash);
+			ip.newHashSize = info.newHashSize;
+			ip.hasHashTreeDataExtent = info.hasHashTreeDataExtent;
+			ip.hasFecDataExtent = info.hasFecDataExtent;
+			ip.hashTreeDataExtent = info.hashTreeDataExtent;
+			ip.hashTreeExtent = info.hashTreeExtent;
+			ip.hashTreeAlgorithm = addString(info.hashTreeAlgorithm);
+			ip.hashTreeSalt = addString(info.hashTreeSalt);
+			ip.fecDataExtent = info.fecDataExtent;
+			ip.fecExtent = info.fecExtent;
+			ip.firstOperation = operations.size();
+			ip.operationCount = info.operations.size();
+			for (const auto &fop: info.operations) {
+				IndexOperation io = {};
+				io.type = fop.type;
+				io.dataOffset = fop.dataOffset;
+				io.dataLength = fop.dataLength;
+				io.srcExtentIndex = addExtents(fop.srcExtents);
+				io.srcExtentCount = fop.srcExtents.size();
+				io.srcTotalLength = fop.srcTotalLength;
+				io.dstExtentIndex = addExtents(fop.dstExtents);
+				io.dstExtentCount = fop.dstExtents.size();
+				io.dstTotalLength = fop.dstTotalLength;
+				memcpy(io.srcDataSha256Hash, fop.srcDataSha256Hash.data(), OPERATION_HASH_SIZE);
+				memcpy(io.dataSha256Hash, fop.dataSha256Hash.data(), OPERATION_HASH_SIZE);
+				operations.emplace_back(io);
+			}
+			partitions.emplace_back(ip);
+		}
+
+		IndexHeader header = {};
+		memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+		header.version = INDEX_VERSION;
+		header.headerSize = sizeof(IndexHeader);
+		header.partitionRecordSize = sizeof(IndexPartition);
+		header.operationRecordSize = sizeof(IndexOperation);
+		header.extentRecordSize = sizeof(Extent);
+		header.blockSize = pHeader.blockSize;
+		header.payloadSize = payloadSize;
+		header.payloadOffset = payloadInfo.getPayloadOffset();
+		header.inPayloadOffset = pHeader.inPayloadOffset;
+		header.manifestSize = pHeader.manifestSize;
+		header.manifestHash = manifestHash;
+		header.partitionSize = pHeader.partitionSize;
+		header.minorVersion = pHeader.minorVersion;
+		header.securityPatchLevel = addString(pHeader.securityPatchLevel);
+		if (payloadInfo.manifest && payloadInfo.manifest->has_dynamic_partition_metadata()) {
+			header.dynamicPartitionMetadata = addString(
+				payloadInfo.manifest->dynamic_partition_metadata().SerializeAsString());
+		}
+		header.partitionsOffset = alignSection(sizeof(IndexHeader));
+		header.partitionCount = partitions.size();
+		header.operationsOffset = alignSection(header.partitionsOffset + partitions.size() * sizeof(IndexPartition));
+		header.operationCount = operations.size();
+		header.extentsOffset = alignSection(header.operationsOffset + operations.size() * sizeof(IndexOperation));
+		header.extentCount = extents.size();
+		header.stringsOffset = alignSection(header.extentsOffset + extents.size() * sizeof(Extent));
+		header.stringsSize = strings.size();
+
+		// Each writer has its own temp file, once renamed into place readers see a complete index
+		const std::string tmpPath = getTempPath(path);
+		int fd = open(tmpPath.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_BINARY, 0644);
+		if (fd < 0) {
+			LOGCD("Index: failed to create '{}' err={}", tmpPath, errno);
+			return false;
+		}
+		int ret = blobWrite(fd, &header, 0, sizeof(header));
+		if (!ret && !partitions.empty()) {
+			ret = blobWrite(fd, partitions.data(), header.partitionsOffset, partitions.size() * sizeof(IndexPartition));
+		}
+		if (!ret && !operations.empty()) {
+			ret = blobWrite(fd, operations.data(), header.operationsOffset, operations.size() * sizeof(IndexOperation));
+		}
+		if (!ret && !extents.empty()) {
+			ret = blobWrite(fd, extents.data(), header.extentsOffset, extents.size() * sizeof(Extent));
+		}
+		if (!ret && !strings.empty()) {
+			ret = blobWrite(fd, strings.data(), header.stringsOffset, strings.size());
+		}
+		closeFd(fd);
+		if (ret || !renameReplace(tmpPath, path)) {
+			remove(tmpPath.c_str());
+			return false;
+		}
+		LOGCD("Index: saved '{}'", path);
+		return true;
+	}
+}
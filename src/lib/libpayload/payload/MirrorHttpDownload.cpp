@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <format>
+
+#include "payload/LogBase.h"
+#include "payload/MirrorHttpDownload.h"
+
+namespace skkk {
+	MirrorHttpDownload::MirrorHttpDownload(const std::vector<std::shared_ptr<HttpDownload>> &httpDownloads,
+	                                       const std::vector<std::string> &urls) {
+		for (size_t i = 0; i < httpDownloads.size() && i < urls.size(); i++) {
+			mirrors.emplace_back(httpDownloads[i], urls[i]);
+		}
+		if (!urls.empty()) {
+			HttpDownload::setUrl(urls[0]);
+		}
+		if (!httpDownloads.empty()) {
+			sslVerification = httpDownloads[0]->sslVerification;
+		}
+	}
+
+	uint32_t MirrorHttpDownload::verifyMirrors() {
+		fileSize = 0;
+		validator.clear();
+		for (auto it = mirrors.begin(); it != mirrors.end();) {
+			const uint64_t size = it->httpDownload->getFileSize();
+			const std::string mirrorValidator = it->httpDownload->getValidator();
+			// The first mirror that answers is the reference, a primary that is down is skipped like any other
+			if (size > 0 && fileSize == 0) {
+				fileSize = size;
+				validator = mirrorValidator;
+			}
+			if (size == 0 || size != fileSize ||
+			    (!validator.empty() && !mirrorValidator.empty() && mirrorValidator != validator)) {
+				LOGCI(BLUE_BOLD("Mirror : ") RED2("skip") " {} size={} validator={}",
+				      it->url, size, mirrorValidator);
+				it = mirrors.erase(it);
+				continue;
+			}
+			++it;
+		}
+		if (!mirrors.empty()) {
+			HttpDownload::setUrl(mirrors[0].url);
+		}
+		LOGCD("Mirror: {} usable, size={} validator={}", mirrors.size(), fileSize, validator);
+		return mirrors.size();
+	}
+
+	void MirrorHttpDownload::setUrl(const std::string &url) {
+		HttpDownload::setUrl(url);
+		std::lock_guard lock{mutex};
+		if (!mirrors.empty()) {
+			// The remote updater swaps the first usable url, the other mirrors are kept
+			mirrors[0].httpDownload->setUrl(url);
+			mirrors[0].url = this->url;
+			mirrors[0].failStreak = 0;
+			mirrors[0].retryAfter = {};
+		}
+	}
+
+	uint64_t MirrorHttpDownload::getFileSize() const {
+		if (fileSize > 0) return fileSize;
+		return mirrors.empty() ? 0 : mirrors[0].httpDownload->getFileSize();
+	}
+
+	std::string MirrorHttpDownload::getValidator() const {
+		if (!validator.empty()) return validator;
+		return mirrors.empty() ? std::string{} : mirrors[0].httpDownload->getValidator();
+	}
+
+	int MirrorHttpDownload::pickMirror(const std::vector<bool> &tried) const {
+		std::lock_guard lock{mutex};
+		const auto now = std::chrono::steady_clock::now();
+		double maxThroughput = 1;
+		for (const auto &mirror: mirrors) {
+			maxThroughput = std::max(maxThroughput, mirror.throughput);
+		}
+
+		int best = -1, waiting = -1;
+		double bestScore = -1;
+		for (int i = 0; i < static_cast<int>(mirrors.size()); i++) {
+			const auto &mirror = mirrors[i];
+			if (tried[i]) continue;
+			if (now < mirror.retryAfter) {
+				if (waiting < 0 || mirror.retryAfter < mirrors[waiting].retryAfter) waiting = i;
+				continue;
+			}
+			// Mirrors without a measurement yet are assumed to be as fast as the best one
+			const double throughput = mirror.throughput > 0 ? mirror.throughput : maxThroughput;
+			const double score = throughput / (mirror.inFlight + 1);
+			if (score > bestScore) {
+				bestScore = score;
+				best = i;
+			}
+		}
+		// Every untried mirror failed recently, use the one that is due first
+		if (best < 0) best = waiting;
+		if (best >= 0) {
+			++mirrors[best].inFlight;
+			++mirrors[best].requestCount;
+		}
+		return best;
+	}
+
+	void MirrorHttpDownload::finishRequest(int index, uint64_t bytes, std::chrono::steady_clock::duration elapsed,
+	                                       bool isSuccess) const {
+		std::lock_guard lock{mutex};
+		auto &mirror = mirrors[index];
+		--mirror.inFlight;
+		if (isSuccess) {
+			mirror.failStreak = 0;
+			if (bytes > 0) {
+				const double seconds = std::max(std::chrono::duration<double>(elapsed).count(), 1e-3);
+				const double sample = bytes / seconds;
+				mirror.throughput = mirror.throughput > 0 ? mirror.throughput * 0.7 + sample * 0.3 : sample;
+				mirror.bytes += bytes;
+			}
+		} else {
+			++mirror.failCount;
+			const uint32_t shift = std::min(mirror.failStreak++, 6u);
+			mirror.retryAfter = std::chrono::steady_clock::now() + std::chrono::seconds(1u << shift);
+			LOGCD("Mirror: {} failed, streak={}", mirror.url, mirror.failStreak);
+		}
+	}
+
+	template<typename F>
+	std::tuple<bool, long> MirrorHttpDownload::downloadFromMirrors(uint64_t length, F &&fetch) const {
+		std::tuple<bool, long> ret{false, -1};
+		std::vector<bool> tried(mirrors.size(), false);
+		for (uint32_t attempt = 0;; attempt++) {
+			const int index = pickMirror(tried);
+			if (index < 0) break;
+			tried[index] = true;
+			const auto start = std::chrono::steady_clock::now();
+			ret = fetch(*mirrors[index].httpDownload, attempt);
+			const auto elapsed = std::chrono::steady_clock::now() - start;
+			if (std::get<0>(ret)) {
+				finishRequest(index, length, elapsed, true);
+				break;
+			}
+			if (std::get<1>(ret) == -ECANCELED) {
+				// Cancelled by the caller, not the mirror's fault
+				finishRequest(index, 0, elapsed, true);
+				break;
+			}
+			finishRequest(index, length, elapsed, false);
+		}
+		return ret;
+	}
+
+	std::tuple<bool, long> MirrorHttpDownload::download(std::string &data, uint64_t offset, uint64_t length) const {
+		const size_t dataSize = data.size();
+		return downloadFromMirrors(length, [&](const HttpDownload &httpDownload, uint32_t) {
+			data.resize(dataSize);
+			return httpDownload.download(data, offset, length);
+		});
+	}
+
+	std::tuple<bool, long> MirrorHttpDownload::download(FileBuffer &fb, uint64_t offset, uint64_t length) const {
+		return download(fb, 0, offset, length);
+	}
+
+	std::tuple<bool, long> MirrorHttpDownload::download(FileBuffer &fb, uint64_t fbDataOffset, uint64_t offset,
+	                                                    uint64_t length) const {
+		const uint64_t fbOffset = fb.offset;
+		return downloadFromMirrors(length, [&](const HttpDownload &httpDownload, uint32_t) {
+			fb.offset = fbOffset;
+			return httpDownload.download(fb, fbDataOffset, offset, length);
+		});
+	}
+
+	std::tuple<bool, long> MirrorHttpDownload::downloadScatter(const std::vector<ScatterSegment> &segments,
+	                                                           uint64_t offset, uint64_t length,
+	                                                           const std::atomic_bool *cancel) const {
+		return downloadFromMirrors(length, [&](const HttpDownload &httpDownload, uint32_t attempt)
+			-> std::tuple<bool, long> {
+				if (cancel && *cancel) return {false, -ECANCELED};
+				if (attempt > 0) {
+					for (const auto &segment: segments) {
+						if (segment.sink) segment.sink->reset();
+					}
+				}
+				const auto ret = httpDownload.downloadScatter(segments, offset, length, cancel);
+				if (!std::get<0>(ret) && cancel && *cancel) return {false, -ECANCELED};
+				return ret;
+			});
+	}
+
+	std::string MirrorHttpDownload::getStats() const {
+		std::lock_guard lock{mutex};
+		std::string stats;
+		for (const auto &mirror: mirrors) {
+			if (!stats.empty()) stats += "\n      ";
+			stats += std::format("{} requests: {} failed: {} {}MiB {:.0f}KiB/s",
+			                     mirror.url.substr(0, mirror.url.find('?')), mirror.requestCount,
+			                     mirror.failCount, mirror.bytes / (1024 * 1024), mirror.throughput / 1024);
+			if (const auto mirrorStats = mirror.httpDownload->getStats(); !mirrorStats.empty()) {
+				stats += " | " + mirrorStats;
+			}
+		}
+		return stats;
+	}
+}
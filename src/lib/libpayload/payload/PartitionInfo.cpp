@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstring>
 #include <format>
 #include <print>
@@ -7,11 +8,6 @@
 #include "payload/Utils.h"
 
 namespace skkk {
-	void FileOperation::initExcInfo(int errCode) const {
-		excInfo = std::format("name: {:18s}, type: {}, code({}): {:s}",
-		                      partName, errCode, type, strerror(abs(errCode)));
-	}
-
 	std::string formatSize(uint64_t size) {
 		if (size >= 1073741824) {
 			double sizeInGB = static_cast<double>(size) / 1073741824.0;
@@ -56,6 +52,11 @@ namespace skkk {
 		return isExtractionSuccessful;
 	}
 
+	void PartitionInfo::initExcInfo(const FileOperation &operation, int errCode) const {
+		std::unique_lock lock{*mutex_};
+		operationErrors.emplace_back(operation.index, errCode);
+	}
+
 	void PartitionInfo::initExcInfoByInitFd(const std::string &path, int errCode) const {
 		std::unique_lock lock{*mutex_};
 		std::string msg = std::format("Create/Open file err: '{}', code({}): {:s}",
@@ -64,10 +65,15 @@ namespace skkk {
 	}
 
 	void PartitionInfo::initExcInfos() const {
-		for (const auto &operation: operations) {
-			auto &info = operation.excInfo;
-			if (!info.empty())
-				excInfos.emplace_back(info);
+		std::unique_lock lock{*mutex_};
+		// One message per operation, the last error wins
+		std::ranges::stable_sort(operationErrors, {}, &OperationError::index);
+		for (uint64_t i = 0; i < operationErrors.size(); i++) {
+			const auto &error = operationErrors[i];
+			if (i + 1 < operationErrors.size() && operationErrors[i + 1].index == error.index) continue;
+			excInfos.emplace_back(std::format("name: {:18s}, type: {}, code({}): {:s}",
+			                                  name, operations[error.index].type, error.errCode,
+			                                  strerror(abs(error.errCode))));
 		}
 	}
 
@@ -86,8 +92,6 @@ namespace skkk {
 		*extractProgress = 0;
 		isExtractionSuccessful = false;
 		excInfos.clear();
-		for (const auto &operation: operations) {
-			operation.excInfo.clear();
-		}
+		operationErrors.clear();
 	}
 }
@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ranges>
+
+#include "payload/FileWriter.h"
+#include "payload/LogBase.h"
+#include "payload/PartitionReader.h"
+#include "payload/RangePlanner.h"
+#include "payload/common/Buffer.hpp"
+#include "payload/common/io.h"
+#include "payload/mman/mmap.hpp"
+
+namespace skkk {
+	PartitionReader::PartitionReader(const ExtractConfig &config, const std::shared_ptr<PayloadInfo> &payloadInfo,
+	                                 uint64_t maxCacheSize)
+		: config(config),
+		  payloadInfo(payloadInfo),
+		  maxCacheSize(maxCacheSize) {
+	}
+
+	PartitionReader::~PartitionReader() {
+		for (const auto &index: indexes | std::views::values) {
+			unmap(index->inData, index->inDataSize);
+			closeFd(index->inFd);
+		}
+	}
+
+	int PartitionReader::getIndex(const std::string &partition, PartitionIndex *&index) {
+		std::lock_guard lock{indexMutex};
+		if (const auto it = indexes.find(partition); it != indexes.end()) {
+			index = it->second.get();
+			return 0;
+		}
+		const auto it = payloadInfo->partitionInfoMap.find(partition);
+		if (it == payloadInfo->partitionInfoMap.end()) return -ENOENT;
+		auto &info = it->second;
+		if (!payloadInfo->initOperations(info)) return -EINVAL;
+
+		auto newIndex = std::make_unique<PartitionIndex>();
+		newIndex->info = &info;
+		if (config.isIncremental) {
+			if (int err = mapRdByPath(newIndex->inFd, info.oldFilePath, newIndex->inData, newIndex->inDataSize)) {
+				LOGCE("Reader: failed to map '{}': {}", info.oldFilePath, err);
+				return err;
+			}
+		}
+		for (const auto &operation: info.operations) {
+			uint64_t bufferOffset = 0;
+			for (const auto &dst: operation.dstExtents) {
+				newIndex->extents.emplace_back(dst.dataOffset, dst.dataLength, bufferOffset, operation.index);
+				bufferOffset += dst.dataLength;
+			}
+		}
+		std::ranges::sort(newIndex->extents, {}, &OperationExtent::offset);
+		index = indexes.emplace(partition, std::move(newIndex)).first->second.get();
+		return 0;
+	}
+
+	std::shared_ptr<const std::vector<uint8_t>> PartitionReader::getCached(uint64_t key) {
+		std::lock_guard lock{lruMutex};
+		const auto it = entries.find(key);
+		if (it == entries.end()) return nullptr;
+		lru.splice(lru.begin(), lru, it->second.lruIt);
+		return it->second.data;
+	}
+
+	void PartitionReader::putCached(uint64_t key, const std::shared_ptr<const std::vector<uint8_t>> &data) {
+		// An operation larger than the cache is decoded again on the next read
+		if (data->size() > maxCacheSize) return;
+		std::lock_guard lock{lruMutex};
+		if (entries.contains(key)) return;
+		lru.push_front(key);
+		entries[key] = {lru.begin(), data};
+		totalSize += data->size();
+		while (totalSize > maxCacheSize) {
+			const auto oldest = entries.find(lru.back());
+			totalSize -= oldest->second.data->size();
+			entries.erase(oldest);
+			lru.pop_back();
+		}
+	}
+
+	/**
+	 * Payload data of the operations is read from the payload, or downloaded in ranges
+	 * planned like for an extraction, each operation is decoded into a buffer of its own.
+	 */
+	int PartitionReader::decodeOperations(const PartitionIndex &index, const std::vector<FileOperation> &operations,
+	                                      std::unordered_map<uint32_t, std::shared_ptr<const std::vector<uint8_t>>> &
+	                                      decoded) {
+		const uint8_t *payloadData = config.httpDownload ? nullptr : payloadInfo->getPayloadData();
+		const FileWriter fw{config.httpDownload, nullptr, config.retryPolicy};
+		const uint64_t keyPrefix = static_cast<uint64_t>(index.info->sourceIndex) << 32;
+		const auto groups = RangePlanner::plan(operations, config.httpDownload ? config.rangeTargetSize : 0,
+		                                       config.rangeGapTolerance);
+
+		for (const auto &group: groups) {
+			const uint8_t *rangeData = nullptr;
+			Buffer<uint8_t> rangeBuffer;
+			if (group.length > 0 && payloadData) {
+				rangeData = payloadData + group.offset;
+			} else if (group.length > 0) {
+				rangeBuffer.reserve(group.length);
+				if (!rangeBuffer.get()) return -ENOMEM;
+				if (int ret = fw.urlRead(rangeBuffer.get(), group.offset, group.length)) return ret;
+				rangeData = rangeBuffer.get();
+			}
+			for (const auto *operation: group.operations) {
+				std::vector<Extent> bufExtents;
+				const FileOperation bufOperation = FileWriter::getBufferOperation(*operation, bufExtents);
+				auto data = std::make_shared<std::vector<uint8_t>>(operation->dstTotalLength);
+				if (int ret = FileWriter::writeDataFromRange(rangeData, group.offset, index.inData, data->data(),
+				                                             bufOperation)) {
+					LOGCE("Reader: operation {} of '{}' failed: {}", operation->index, index.info->name, ret);
+					return ret < 0 ? ret : -EIO;
+				}
+				putCached(keyPrefix | operation->index, data);
+				decoded[operation->index] = std::move(data);
+			}
+		}
+		return 0;
+	}
+
+	int64_t PartitionReader::pread(const std::string &partition, uint64_t offset, uint8_t *buf, uint64_t length) {
+		PartitionIndex *index = nullptr;
+		std::vector<FileOperation> missing;
+		std::unordered_map<uint32_t, std::shared_ptr<const std::vector<uint8_t>>> decoded;
+
+		if (config.payloadType == PAYLOAD_TYPE_STREAM) return -ENOTSUP;
+		if (int ret = getIndex(partition, index)) return ret;
+		const auto &info = *index->info;
+		if (offset >= info.size) return 0;
+		length = std::min(length, info.size - offset);
+		const uint64_t end = offset + length;
+		// Holes of the image
+		memset(buf, 0, length);
+
+		// dst extents do not overlap, only the one before the first extent past offset can
+		auto first = std::ranges::upper_bound(index->extents, offset, {}, &OperationExtent::offset);
+		if (first != index->extents.begin()) --first;
+		auto last = first;
+		for (; last != index->extents.end() && last->offset < end; ++last) {
+			const auto &operation = info.operations[last->index];
+			if (last->offset + last->length <= offset || operation.type == InstallOperation_Type_ZERO ||
+			    decoded.contains(last->index)) {
+				continue;
+			}
+			const uint64_t key = static_cast<uint64_t>(info.sourceIndex) << 32 | last->index;
+			if (auto data = getCached(key)) {
+				decoded[last->index] = std::move(data);
+			} else if (std::ranges::find(missing, last->index, &FileOperation::index) == missing.end()) {
+				missing.emplace_back(operation);
+			}
+		}
+		if (!missing.empty()) {
+			LOGCD("Reader: '{}' [{}, {}) runs {} operations", partition, offset, end, missing.size());
+			if (int ret = decodeOperations(*index, missing, decoded)) return ret;
+		}
+
+		for (auto it = first; it != last; ++it) {
+			const auto dataIt = decoded.find(it->index);
+			if (dataIt == decoded.end()) continue;
+			const uint64_t start = std::max(offset, it->offset);
+			const uint64_t stop = std::min(end, it->offset + it->length);
+			if (start >= stop) continue;
+			memcpy(buf + (start - offset), dataIt->second->data() + it->bufferOffset + (start - it->offset),
+			       stop - start);
+		}
+		return static_cast<int64_t>(length);
+	}
+}
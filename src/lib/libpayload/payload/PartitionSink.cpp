@@ -0,0 +1,57 @@
+#include <algorithm>
+
+#include "payload/LogBase.h"
+#include "payload/PartitionSink.h"
+
+namespace skkk {
+	OrderedPartitionSink::OrderedPartitionSink(PartitionStreamSink &stream, uint64_t size)
+		: stream(stream),
+		  size(size) {
+	}
+
+	bool OrderedPartitionSink::writeZero(uint64_t length) {
+		static constexpr uint64_t ZERO_SIZE = 64 * 1024;
+		static const std::vector<uint8_t> zeros(ZERO_SIZE, 0);
+		while (length > 0) {
+			const uint64_t n = std::min(length, ZERO_SIZE);
+			if (!stream.write({zeros.data(), n})) return false;
+			position += n;
+			length -= n;
+		}
+		return true;
+	}
+
+	bool OrderedPartitionSink::flushPending() {
+		for (auto it = pending.begin(); it != pending.end() && it->first == position; it = pending.erase(it)) {
+			if (!stream.write(it->second)) return false;
+			position += it->second.size();
+		}
+		return true;
+	}
+
+	bool OrderedPartitionSink::write(uint64_t offset, std::span<const uint8_t> data) {
+		if (offset < position || offset + data.size() > size) {
+			LOGCE("Sink: write outside of the stream offset={} length={} position={}",
+			      offset, data.size(), position);
+			return false;
+		}
+		if (offset > position) {
+			pending.emplace(offset, std::vector<uint8_t>(data.begin(), data.end()));
+			return true;
+		}
+		if (!stream.write(data)) return false;
+		position += data.size();
+		return flushPending();
+	}
+
+	bool OrderedPartitionSink::finish(bool success) {
+		// Gaps left by the operations are holes of the image
+		while (success && position < size) {
+			const uint64_t next = pending.empty() ? size : pending.begin()->first;
+			// Overlapping dst extents
+			success = next >= position && writeZero(next - position) && flushPending();
+		}
+		pending.clear();
+		return stream.finish(success);
+	}
+}
@@ -1,29 +1,106 @@
 #include <algorithm>
 #include <cerrno>
+#include <chrono>
 #include <future>
 #include <memory>
 #include <print>
 #include <ranges>
 #include <format>
+#include <thread>
 
 #include "common/LogProgress.h"
-#include "common/threadpool.h"
+#include "common/Prefetcher.h"
+#include "common/TaskGroup.h"
+#include "decompress/StreamDecompress.h"
 #include "payload/FileWriter.h"
 #include "payload/PartitionWriter.h"
 #include "payload/Utils.h"
+#include "payload/common/Buffer.hpp"
 #include "payload/common/io.h"
 #include "payload/mman/mmap.hpp"
 
 namespace skkk {
+	/**
+	 * Tasks of one partition on the shared pool of the config, or on an own pool,
+	 * the destructor waits for the committed tasks only.
+	 */
+	class PartitionTaskRunner {
+		std::shared_ptr<WorkerPool> pool;
+		uint64_t group = 0;
+		// Optional, tasks are only queued once the scheduler lets them run
+		DownloadScheduler *scheduler = nullptr;
+		TaskGroup tasks;
+
+		public:
+			PartitionTaskRunner(const std::shared_ptr<WorkerPool> &sharedPool, uint32_t size, uint64_t group,
+			                    DownloadScheduler *scheduler = nullptr)
+				: pool(sharedPool ? sharedPool : std::make_shared<WorkerPool>(size)),
+				  group(group),
+				  scheduler(scheduler) {
+			}
+
+			~PartitionTaskRunner() {
+				tasks.wait();
+			}
+
+			/**
+			 * With a scheduler this blocks the calling thread, not a pool thread, until the
+			 * task may run, slotBytes > 0 also takes the request slot the task downloads with.
+			 */
+			template<typename F, typename T>
+			void commit(F task, T &ctx, uint64_t slotBytes = 0) {
+				if (scheduler) scheduler->acquireTask(slotBytes);
+				tasks.add();
+				pool->commit([this, task, &ctx] {
+					task(ctx);
+					if (scheduler) scheduler->releaseTask();
+					tasks.done();
+				}, group);
+			}
+	};
+
 	PartitionWriter::PartitionWriter(const std::shared_ptr<PayloadInfo> &payloadInfo)
 		: payloadInfo(payloadInfo),
 		  config(payloadInfo->getConfig()) {
+		if (config.httpDownload) {
+			uint32_t maxInFlight = config.downloadMaxInFlight;
+			if (maxInFlight == 0) {
+				maxInFlight = std::max<uint32_t>(config.threadNum * 4, 16);
+			}
+			downloadScheduler = std::make_shared<DownloadScheduler>(config.threadNum, maxInFlight,
+			                                                        config.threadNum);
+		}
+	}
+
+	StreamBufferLimit::StreamBufferLimit(uint64_t limit)
+		: limit(limit) {
+	}
+
+	void StreamBufferLimit::acquire(uint64_t size) {
+		std::unique_lock lock{mutex};
+		cv.wait(lock, [&] { return used == 0 || used + size <= limit; });
+		used += size;
+	}
+
+	void StreamBufferLimit::release(uint64_t size) {
+		{
+			std::lock_guard lock{mutex};
+			used -= size;
+		}
+		cv.notify_all();
+	}
+
+	bool PartitionWriter::addPartition(PartitionInfo &info) {
+		// Operations are only built for partitions that are extracted
+		if (!payloadInfo->initOperations(info)) return false;
+		partitions.emplace_back(info);
+		return true;
 	}
 
 	bool PartitionWriter::initPartitions() {
 		for (auto &partitionInfoMap = payloadInfo->partitionInfoMap;
-		     const auto &info: partitionInfoMap | std::views::values) {
-			partitions.emplace_back(info);
+		     auto &info: partitionInfoMap | std::views::values) {
+			if (!addPartition(info)) return false;
 		}
 		return !partitions.empty();
 	}
@@ -32,15 +109,15 @@ namespace skkk {
 		auto &targetNames = config.getTargets();
 		auto &partitionInfoMap = payloadInfo->partitionInfoMap;
 		if (config.isExcludeMode) {
-			for (const auto &[name, info]: partitionInfoMap) {
+			for (auto &[name, info]: partitionInfoMap) {
 				if (std::ranges::find(targetNames, name) == targetNames.end()) {
-					partitions.emplace_back(info);
+					if (!addPartition(info)) return false;
 				}
 			}
 		} else {
 			for (const auto &name: targetNames)
 				if (partitionInfoMap.contains(name)) {
-					partitions.emplace_back(partitionInfoMap[name]);
+					if (!addPartition(partitionInfoMap[name])) return false;
 				}
 		}
 		return !partitions.empty();
@@ -99,6 +176,18 @@ namespace skkk {
 		return verifyWriter;
 	}
 
+	std::shared_ptr<ImageVerifier> PartitionWriter::getImageVerifier() {
+		std::unique_lock lock{_mutex};
+		if (!imageVerifier) {
+			imageVerifier = std::make_shared<ImageVerifier>(payloadInfo, partitions, config);
+		}
+		return imageVerifier;
+	}
+
+	std::shared_ptr<DownloadScheduler> PartitionWriter::getDownloadScheduler() const {
+		return downloadScheduler;
+	}
+
 	static std::string formatSize(uint64_t bytes) {
 		const double gb = 1024.0 * 1024.0 * 1024.0;
 		const double mb = 1024.0 * 1024.0;
@@ -126,10 +215,29 @@ namespace skkk {
 		return msg;
 	}
 
-	static void printProgressMT(bool isSilent, const std::string &partName, uint64_t partSize,
+	static void reportProgressMT(const ProgressCallback &callback, const std::string &partName,
+	                             uint64_t totalSize, const std::atomic_int &progress) {
+		uint64_t previousPercentage = UINT64_MAX;
+		uint64_t curr = 0;
+		do {
+			curr = progress;
+			if (const uint64_t percentage = totalSize ? curr * 100 / totalSize : 100;
+				percentage != previousPercentage) {
+				callback(partName, curr, totalSize);
+				previousPercentage = percentage;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		} while (curr < totalSize);
+	}
+
+	static void printProgressMT(const ExtractConfig &config, const std::string &partName, uint64_t partSize,
 	                            uint64_t totalSize, const std::atomic_int &progress,
 	                            bool hasEnter) {
-		if (isSilent) {
+		if (config.progressCallback) {
+			reportProgressMT(config.progressCallback, partName, totalSize, progress);
+			return;
+		}
+		if (config.isSilent) {
 			std::string tag = getPrintMsg(partName, partSize);
 			LOGCI("{}", tag);
 			return;
@@ -163,10 +271,107 @@ namespace skkk {
 		return ret == 0;
 	}
 
+	static bool isScatterReplace(const FileOperation &operation) {
+		return operation.type == InstallOperation_Type_REPLACE &&
+		       operation.dstTotalLength == operation.dataLength;
+	}
+
+	static std::unique_ptr<StreamDecompress> createStreamDecompress(const FileOperation &operation,
+	                                                                uint8_t *outData) {
+		if (operation.dstExtents.size() != 1) return nullptr;
+		auto &dst = operation.dstExtents[0];
+		switch (operation.type) {
+			case InstallOperation_Type_REPLACE_BZ:
+				return StreamDecompress::createBzip(outData + dst.dataOffset, dst.dataLength);
+			case InstallOperation_Type_REPLACE_XZ:
+				return StreamDecompress::createXz(outData + dst.dataOffset, dst.dataLength);
+			case InstallOperation_Type_REPLACE_ZSTD:
+				return StreamDecompress::createZstd(outData + dst.dataOffset, dst.dataLength);
+			default:
+				return nullptr;
+		}
+	}
+
+	/**
+	 * URL mode, the range of a group is fetched once and its operations run from it,
+	 * so each worker holds at most one range. REPLACE data is downloaded straight into
+	 * its dst extents and compressed REPLACE data is decoded while it arrives, only the
+	 * data of other operations is buffered.
+	 */
+	static void extractRangeTask(const PartitionRangeWriteContext &ctx) {
+		int ret = -1;
+		const auto &group = ctx.group;
+		const auto &operations = group.operations;
+		const auto &extractProgress = ctx.partitionInfo.extractProgress;
+		std::vector<ScatterSegment> segments;
+		std::vector<std::unique_ptr<StreamDecompress>> decoders(operations.size());
+		std::vector<uint64_t> bufferOffsets(operations.size(), 0);
+		uint64_t bufferLength = 0;
+		uint64_t cursor = group.offset;
+		Buffer<uint8_t> rangeBuffer;
+
+		if (group.length > 0) {
+			for (size_t i = 0; i < operations.size(); i++) {
+				if (isScatterReplace(*operations[i])) continue;
+				decoders[i] = createStreamDecompress(*operations[i], ctx.outData);
+				if (!decoders[i]) {
+					bufferOffsets[i] = bufferLength;
+					bufferLength += operations[i]->dataLength;
+				}
+			}
+			if (bufferLength > 0) {
+				rangeBuffer.reserve(bufferLength);
+			}
+			// Operations of a group are sorted by data offset and do not overlap
+			for (size_t i = 0; i < operations.size(); i++) {
+				const auto &operation = *operations[i];
+				if (operation.dataOffset > cursor) {
+					segments.emplace_back(operation.dataOffset - cursor);
+				}
+				if (isScatterReplace(operation)) {
+					for (const auto &dst: operation.dstExtents) {
+						segments.emplace_back(ctx.outData + dst.dataOffset, dst.dataLength);
+					}
+				} else if (decoders[i]) {
+					segments.emplace_back(decoders[i].get(), operation.dataLength);
+				} else {
+					segments.emplace_back(rangeBuffer.get() + bufferOffsets[i], operation.dataLength);
+				}
+				cursor = operation.dataOffset + operation.dataLength;
+			}
+			ret = ctx.fileWriter.urlReadScatter(segments, group.offset, group.length, true);
+			if (ret) {
+				for (const auto *operation: operations) {
+					ctx.partitionInfo.initExcInfo(*operation, ret);
+					++*extractProgress;
+				}
+				return;
+			}
+		}
+		ctx.scheduler.acquireDecode();
+		for (size_t i = 0; i < operations.size(); i++) {
+			const auto &operation = *operations[i];
+			if (decoders[i]) {
+				ret = decoders[i]->finish();
+				decoders[i].reset();
+			} else if (group.length > 0 && isScatterReplace(operation)) {
+				ret = 0;
+			} else {
+				ret = FileWriter::writeDataFromRange(rangeBuffer.get() + bufferOffsets[i], operation.dataOffset,
+				                                     ctx.inData, ctx.outData, operation);
+			}
+			if (ret) {
+				ctx.partitionInfo.initExcInfo(operation, ret);
+			}
+			++*extractProgress;
+		}
+		ctx.scheduler.releaseDecode();
+	}
+
 	bool PartitionWriter::extractByInfo(const PartitionInfo &info) const {
 		int ret = -1, inFd = -1, outFd = -1;
 		const auto *payloadBinData = payloadInfo->getPayloadData();
-		FileWriter fw{config.httpDownload};
+		FileWriter fw{config.httpDownload, downloadScheduler.get(), config.retryPolicy};
 		std::future<void> progressThread;
 		std::shared_ptr<std::atomic_int> extractProgress = info.extractProgress;
 		uint64_t inDataSize = 0;
@@ -179,14 +384,18 @@ namespace skkk {
 			goto exit;
 		}
 
-		progressThread = std::async(std::launch::async, printProgressMT, config.isSilent, info.name,
+		progressThread = std::async(std::launch::async, printProgressMT, std::cref(config), info.name,
 		                            info.size, info.operations.size(), std::ref(*extractProgress), true);
-		for (const auto &operation: info.operations) {
-			ret = fw.writeDataByType(payloadBinData, inData, outData, operation);
-			if (ret) {
-				operation.initExcInfo(ret);
+		{
+			Prefetcher prefetcher{info.operations, payloadBinData, inData, *extractProgress, config.prefetchBudget};
+			for (const auto &operation: info.operations) {
+				ret = fw.writeDataByType(payloadBinData, inData, outData, operation);
+				if (ret) {
+					info.initExcInfo(operation, ret);
+				}
+				++*extractProgress;
+				prefetcher.notifyProgress();
 			}
-			++*extractProgress;
 		}
 		if (progressThread.valid()) progressThread.wait();
 		info.initExcInfos();
@@ -210,9 +419,10 @@ namespace skkk {
 
 		ret = fileWriter.writeDataByType(payloadData, inData, outData, operation);
 		if (ret) {
-			operation.initExcInfo(ret);
+			ctx.partitionInfo.initExcInfo(operation, ret);
 		}
 		++*extractProgress;
+		ctx.prefetcher.notifyProgress();
 	}
 
 	bool PartitionWriter::extractByInfoMT(const PartitionInfo &info) const {
@@ -220,7 +430,7 @@ namespace skkk {
 		const auto payloadData = payloadInfo->getPayloadData();
 		const auto &extractProgress = info.extractProgress;
 		const auto isIncremental = config.isIncremental;
-		FileWriter fw{config.httpDownload};
+		FileWriter fw{config.httpDownload, downloadScheduler.get(), config.retryPolicy};
 		uint64_t inDataSize = 0;
 		const uint8_t *inData = nullptr;
 		uint64_t outDataSize = 0;
@@ -232,17 +442,39 @@ namespace skkk {
 		}
 
 		// wait
-		{
+		if (config.httpDownload) {
+			uint64_t opSize = info.operations.size();
+			const auto groups = RangePlanner::plan(info.operations, config.rangeTargetSize,
+			                                       config.rangeGapTolerance);
+			std::vector<PartitionRangeWriteContext> ctxs;
+			ctxs.reserve(groups.size());
+			// Committing waits for the scheduler, progress is printed meanwhile
+			auto progressThread = std::async(std::launch::async, printProgressMT, std::cref(config), info.name,
+			                                 info.size, opSize, std::ref(*extractProgress), true);
+			{
+				// Workers mostly wait on the network, the scheduler decides how many download
+				PartitionTaskRunner tasks{
+					config.downloadPool, downloadScheduler->getPoolLimit(), config.jobId, downloadScheduler.get()
+				};
+				for (const auto &group: groups) {
+					auto &ctx = ctxs.emplace_back(info, fw, group, inData, outData, *downloadScheduler);
+					tasks.commit(extractRangeTask, ctx, group.length);
+				}
+			}
+			progressThread.wait();
+		} else {
 			uint64_t opSize = info.operations.size();
 			std::vector<PartitionWriteContext> ctxs;
 			ctxs.reserve(opSize);
-			std::threadpool tp(config.threadNum);
+			// Declared before the pool, it stops only after all tasks are done
+			Prefetcher prefetcher{info.operations, payloadData, inData, *extractProgress, config.prefetchBudget};
+			PartitionTaskRunner tasks{config.workerPool, config.threadNum, config.jobId};
 			for (const auto &operation: info.operations) {
 				auto &ctx = ctxs.emplace_back(info, fw, operation, payloadData,
-				                              inData, outData, isIncremental);
-				tp.commit(extractTask, std::ref(ctx));
+				                              inData, outData, isIncremental, prefetcher);
+				tasks.commit(extractTask, ctx);
 			}
-			printProgressMT(config.isSilent, info.name, info.size, opSize,
+			printProgressMT(config, info.name, info.size, opSize,
 			                *extractProgress, true);
 		}
 		info.initExcInfos();
@@ -255,11 +487,164 @@ namespace skkk {
 		return info.checkExtractionSuccessful();
 	}
 
+	static int writeZeroToSink(PartitionSinkData &sinkData, const FileOperation &operation) {
+		static constexpr uint64_t ZERO_SIZE = 1024 * 1024;
+		static const std::vector<uint8_t> zeros(ZERO_SIZE, 0);
+		std::lock_guard lock{sinkData.mutex};
+		for (const auto &dst: operation.dstExtents) {
+			for (uint64_t done = 0; done < dst.dataLength; done += ZERO_SIZE) {
+				const uint64_t length = std::min(dst.dataLength - done, ZERO_SIZE);
+				if (!sinkData.sink.write(dst.dataOffset + done, {zeros.data(), length})) return -ECANCELED;
+			}
+		}
+		return 0;
+	}
+
+	static int writeOperationToSink(PartitionSinkData &sinkData, const uint8_t *rangeData, uint64_t rangeOffset,
+	                                const FileOperation &operation) {
+		// Zero extents can span most of the image, they are not held in memory
+		if (operation.type == InstallOperation_Type_ZERO) {
+			return writeZeroToSink(sinkData, operation);
+		}
+		std::vector<Extent> bufExtents;
+		const FileOperation bufOperation = FileWriter::getBufferOperation(operation, bufExtents);
+		Buffer<uint8_t> buffer{operation.dstTotalLength};
+		if (!buffer.get()) return -ENOMEM;
+		int ret = FileWriter::writeDataFromRange(rangeData, rangeOffset, sinkData.inData, buffer.get(), bufOperation);
+		if (ret) return ret;
+
+		std::lock_guard lock{sinkData.mutex};
+		const uint8_t *data = buffer.get();
+		for (const auto &dst: operation.dstExtents) {
+			if (!sinkData.sink.write(dst.dataOffset, {data, dst.dataLength})) return -ECANCELED;
+			data += dst.dataLength;
+		}
+		return 0;
+	}
+
+	/**
+	 * The range of a group is read from the payload or downloaded once, its operations
+	 * are decoded one by one into a buffer of their own and passed to the sink.
+	 */
+	static void extractSinkTask(const PartitionSinkWriteContext &ctx) {
+		int ret = 0;
+		const auto &group = ctx.group;
+		auto &sinkData = ctx.sinkData;
+		const auto &extractProgress = ctx.partitionInfo.extractProgress;
+		const uint8_t *rangeData = nullptr;
+		Buffer<uint8_t> rangeBuffer;
+		// The request slot was taken when the task was committed, urlRead releases it
+		bool hasSlot = sinkData.scheduler && group.length > 0;
+
+		if (ctx.isCancelled || sinkData.isStopped) {
+			ret = -ECANCELED;
+		} else if (group.length > 0 && sinkData.payloadData) {
+			rangeData = sinkData.payloadData + group.offset;
+		} else if (group.length > 0) {
+			rangeBuffer.reserve(group.length);
+			rangeData = rangeBuffer.get();
+			if (rangeData) {
+				ret = ctx.fileWriter.urlRead(rangeBuffer.get(), group.offset, group.length, hasSlot);
+				hasSlot = false;
+			} else {
+				ret = -ENOMEM;
+			}
+		}
+		if (hasSlot) sinkData.scheduler->releaseUnused();
+
+		if (sinkData.scheduler) sinkData.scheduler->acquireDecode();
+		for (const auto *operation: group.operations) {
+			int opRet = ret;
+			if (!opRet && (ctx.isCancelled || sinkData.isStopped)) {
+				opRet = -ECANCELED;
+			}
+			if (!opRet) {
+				opRet = writeOperationToSink(sinkData, rangeData, group.offset, *operation);
+				if (opRet == -ECANCELED) sinkData.isStopped = true;
+			}
+			if (opRet) {
+				ctx.partitionInfo.initExcInfo(*operation, opRet);
+			}
+			++*extractProgress;
+		}
+		if (sinkData.scheduler) sinkData.scheduler->releaseDecode();
+	}
+
+	bool PartitionWriter::extractByInfoToSink(const PartitionInfo &info, PartitionSink &sink) const {
+		bool ret = false;
+		int inFd = -1;
+		uint64_t inDataSize = 0;
+		const uint8_t *inData = nullptr;
+		const auto &extractProgress = info.extractProgress;
+		FileWriter fw{config.httpDownload, downloadScheduler.get(), config.retryPolicy};
+		PartitionSinkData sinkData{sink};
+
+		if (config.isIncremental) {
+			if (int err = mapRdByPath(inFd, info.oldFilePath, inData, inDataSize)) {
+				info.initExcInfoByInitFd(info.oldFilePath, err);
+				goto exit;
+			}
+		}
+		sinkData.inData = inData;
+		if (config.httpDownload) {
+			sinkData.scheduler = downloadScheduler.get();
+		} else {
+			sinkData.payloadData = payloadInfo->getPayloadData();
+		}
+
+		{
+			// Without downloads each operation is a group of its own
+			const auto groups = RangePlanner::plan(info.operations, config.httpDownload ? config.rangeTargetSize : 0,
+			                                       config.rangeGapTolerance);
+			std::vector<PartitionSinkWriteContext> ctxs;
+			ctxs.reserve(groups.size());
+			const auto &pool = config.httpDownload ? config.downloadPool : config.workerPool;
+			const uint32_t poolSize = config.httpDownload ? downloadScheduler->getPoolLimit() : config.threadNum;
+			// Committing waits for the scheduler in url mode, progress is printed meanwhile
+			auto progressThread = std::async(std::launch::async, printProgressMT, std::cref(config), info.name,
+			                                 info.size, info.operations.size(), std::ref(*extractProgress), true);
+			{
+				PartitionTaskRunner tasks{pool, poolSize, config.jobId, sinkData.scheduler};
+				for (const auto &group: groups) {
+					auto &ctx = ctxs.emplace_back(info, fw, group, sinkData, config.isCancelled);
+					tasks.commit(extractSinkTask, ctx, group.length);
+				}
+			}
+			progressThread.wait();
+		}
+		info.initExcInfos();
+		ret = info.checkExtractionSuccessful();
+
+	exit:
+		unmap(inData, inDataSize);
+		closeFd(inFd);
+		if (!sink.finish(ret)) {
+			info.isExtractionSuccessful = ret = false;
+		}
+		return ret;
+	}
+
+	bool PartitionWriter::extractToSink(const PartitionInfo &info) const {
+		const auto sink = config.sinkFactory(info);
+		if (!sink) {
+			LOGCE("Sink: no sink for partition '{}'", info.name);
+			return false;
+		}
+		return extractByInfoToSink(info, *sink);
+	}
+
 	bool PartitionWriter::extractPartitionByName(const std::string &name) {
 		auto it = std::ranges::find(partitions, name, &PartitionInfo::name);
 		if (it != partitions.end()) {
+			if (config.payloadType == PAYLOAD_TYPE_STREAM) {
+				LOGCE("Stream: partitions can only be extracted all at once");
+				return false;
+			}
+			if (config.sinkFactory) {
+				return extractToSink(*it);
+			}
 			const auto threadNum = config.threadNum;
-			if (threadNum > 1) {
+			if (threadNum > 1 || config.httpDownload) {
 				return extractByInfoMT(*it);
 			}
 			return extractByInfo(*it);
@@ -278,13 +663,134 @@ namespace skkk {
 		      name, ret ? GREEN2_BOLD("success") : RED2("fail"));
 	}
 
+	static void extractStreamTask(PartitionStreamWriteContext &ctx) {
+		const auto &operation = ctx.operation;
+		const auto &partitionData = ctx.partitionData;
+		int ret = FileWriter::writeDataFromRange(ctx.data.get(), operation.dataOffset, partitionData.inData,
+		                                         partitionData.outData, operation);
+		if (ret) {
+			ctx.partitionInfo.initExcInfo(operation, ret);
+		}
+		ctx.data = Buffer<uint8_t>();
+		ctx.bufferLimit.release(operation.dataLength);
+		++*ctx.partitionInfo.extractProgress;
+		++ctx.progress;
+	}
+
+	static void failStreamOperation(PartitionStreamWriteContext &ctx, int errCode) {
+		ctx.partitionInfo.initExcInfo(ctx.operation, errCode);
+		++*ctx.partitionInfo.extractProgress;
+		++ctx.progress;
+	}
+
+	void PartitionWriter::extractPartitionsByStream() const {
+		auto *streamInfo = static_cast<StreamPayloadInfo *>(payloadInfo.get());
+		std::vector<PartitionStreamData> partitionDatas(partitions.size());
+		std::vector<PartitionStreamWriteContext> ctxs;
+		std::vector<PartitionStreamWriteContext *> dataCtxs;
+		std::atomic_int progress = 0;
+		uint64_t totalSize = 0;
+		uint64_t partSize = 0;
+		bool isStreamOk = true;
+		StreamBufferLimit bufferLimit{config.streamBufferSize};
+
+		for (uint64_t i = 0; i < partitions.size(); i++) {
+			const auto &info = partitions[i];
+			auto &pd = partitionDatas[i];
+			pd.isReady = handleData(info, config.isIncremental, pd.inFd, pd.outFd,
+			                        pd.inData, pd.inDataSize, pd.outData, pd.outDataSize);
+			if (pd.isReady) {
+				totalSize += info.operations.size();
+				partSize += info.size;
+			}
+		}
+		ctxs.reserve(totalSize);
+		for (uint64_t i = 0; i < partitions.size(); i++) {
+			if (!partitionDatas[i].isReady) continue;
+			for (const auto &operation: partitions[i].operations) {
+				ctxs.emplace_back(partitions[i], operation, partitionDatas[i], bufferLimit, progress);
+			}
+		}
+		// Partitions and operations are written in data order, sorting only matters for odd payloads
+		for (auto &ctx: ctxs) {
+			if (ctx.operation.dataLength > 0) dataCtxs.emplace_back(&ctx);
+		}
+		std::ranges::stable_sort(dataCtxs, {}, [](const PartitionStreamWriteContext *ctx) {
+			return ctx->operation.dataOffset;
+		});
+
+		{
+			auto progressThread = std::async(std::launch::async, printProgressMT, std::cref(config), "stream",
+			                                 partSize, totalSize, std::ref(progress), true);
+			PartitionTaskRunner tasks{config.workerPool, config.threadNum, config.jobId};
+			for (auto &ctx: ctxs) {
+				if (ctx.operation.dataLength == 0) {
+					tasks.commit(extractStreamTask, ctx);
+				}
+			}
+			for (auto *ctx: dataCtxs) {
+				const auto &operation = ctx->operation;
+				const uint64_t streamOffset = streamInfo->getStreamOffset();
+				// Data shared with an earlier operation has already gone by
+				if (!isStreamOk || operation.dataOffset < streamOffset) {
+					failStreamOperation(*ctx, isStreamOk ? -ESPIPE : -EIO);
+					continue;
+				}
+				bufferLimit.acquire(operation.dataLength);
+				ctx->data.reserve(operation.dataLength);
+				isStreamOk = streamInfo->skipStream(operation.dataOffset - streamOffset) &&
+				             streamInfo->readStream(ctx->data.get(), operation.dataLength);
+				if (!isStreamOk) {
+					bufferLimit.release(operation.dataLength);
+					ctx->data = Buffer<uint8_t>();
+					failStreamOperation(*ctx, -EIO);
+					continue;
+				}
+				tasks.commit(extractStreamTask, *ctx);
+			}
+			progressThread.wait();
+		}
+
+		for (uint64_t i = 0; i < partitions.size(); i++) {
+			const auto &info = partitions[i];
+			auto &pd = partitionDatas[i];
+			info.initExcInfos();
+			bool ret = info.checkExtractionSuccessful();
+			if (!ret) {
+				info.ifExcExistsWrite2File();
+			}
+			printExtractResult(info.name, ret);
+			unmap(pd.inData, pd.inDataSize);
+			unmap(pd.outData, pd.outDataSize);
+			closeFd(pd.inFd);
+			closeFd(pd.outFd);
+		}
+	}
+
 	void PartitionWriter::extractPartitions() const {
 		if (!partitions.empty()) {
 			bool ret = false;
 			const auto threadNum = config.threadNum;
 			const auto isIncremental = config.isIncremental;
 			printExtractConfig(threadNum, isIncremental);
-			if (threadNum > 1) {
+			if (config.payloadType == PAYLOAD_TYPE_STREAM) {
+				if (config.sinkFactory) {
+					LOGCE("Stream: partitions can not be written to sinks");
+					return;
+				}
+				extractPartitionsByStream();
+				return;
+			}
+			if (downloadScheduler) {
+				LOGCI(GREEN2_BOLD("Downloads: ") "up to " RED2("{}") " in flight",
+				      downloadScheduler->getMaxLimit());
+			}
+			if (config.sinkFactory) {
+				for (const auto &info: partitions) {
+					ret = extractToSink(info);
+					printExtractResult(info.name, ret);
+				}
+			} else if (threadNum > 1 || config.httpDownload) {
 				for (const auto &info: partitions) {
 					ret = extractByInfoMT(info);
 					if (!ret) {
@@ -301,6 +807,9 @@ namespace skkk {
 					printExtractResult(info.name, ret);
 				}
 			}
+			if (downloadScheduler) {
+				LOGCD("Downloads: {}", downloadScheduler->getStats());
+			}
 		}
 	}
 }
@@ -0,0 +1,135 @@
+#include <ranges>
+
+#include "payload/LogBase.h"
+#include "payload/PayloadExtractor.h"
+#include "payload/Utils.h"
+
+namespace skkk {
+	/**
+	 * OrderedPartitionSink owning its stream.
+	 */
+	class OwnedStreamSink : public OrderedPartitionSink {
+		std::unique_ptr<PartitionStreamSink> stream;
+
+		public:
+			OwnedStreamSink(std::unique_ptr<PartitionStreamSink> stream, uint64_t size)
+				: OrderedPartitionSink(*stream, size),
+				  stream(std::move(stream)) {
+			}
+	};
+
+	PayloadExtractor::PayloadExtractor(const std::string &path, uint32_t threadNum) {
+		config.setPayloadPath(path);
+		config.isUrl = startsWithIgnoreCase(path, "https://") || startsWithIgnoreCase(path, "http://");
+		config.payloadType = config.isUrl ? PAYLOAD_TYPE_URL : PAYLOAD_TYPE_BIN;
+		config.threadNum = threadNum > 0 ? threadNum : config.hardwareConcurrency;
+		// Progress only goes to the callback
+		config.isSilent = true;
+	}
+
+	ExtractConfig &PayloadExtractor::getConfig() {
+		return config;
+	}
+
+	int PayloadExtractor::open() {
+		if (partitionWriter) return RET_EXTRACT_DONE;
+		if (config.isUrl) {
+			config.httpDownload = config.getHttpDownloadImpl();
+			if (!config.httpDownload) return RET_EXTRACT_INIT_FAIL;
+		} else if (!fileExists(config.getPayloadPath())) {
+			LOGCE("payload file '{}' does not exist", config.getPayloadPath());
+			return RET_EXTRACT_OPEN_FILE;
+		}
+		try {
+			if (!payloadParser.parse(config)) {
+				return RET_EXTRACT_INIT_FAIL;
+			}
+			payloadInfo = payloadParser.getPayloadInfo();
+			partitionWriter = payloadParser.getPartitionWriter();
+		} catch (const std::exception &e) {
+			LOGCE("{}", e.what());
+			return RET_EXTRACT_INIT_FAIL;
+		}
+		return RET_EXTRACT_DONE;
+	}
+
+	std::vector<std::string> PayloadExtractor::getPartitionNames() const {
+		std::vector<std::string> names;
+		if (payloadInfo) {
+			for (const auto &name: payloadInfo->partitionInfoMap | std::views::keys) {
+				names.emplace_back(name);
+			}
+		}
+		return names;
+	}
+
+	const PartitionInfo *PayloadExtractor::getPartition(const std::string &name) const {
+		if (!payloadInfo) return nullptr;
+		const auto it = payloadInfo->partitionInfoMap.find(name);
+		return it != payloadInfo->partitionInfoMap.end() ? &it->second : nullptr;
+	}
+
+	void PayloadExtractor::setProgressCallback(const ProgressCallback &callback) {
+		config.progressCallback = callback;
+	}
+
+	int PayloadExtractor::extract(const std::vector<std::string> &names, const SinkFactory &sinkFactory) {
+		std::vector<PartitionInfo *> infos;
+		int ret = RET_EXTRACT_DONE;
+		if (!partitionWriter) return RET_EXTRACT_INIT_FAIL;
+		// A cancel only stops the extraction running at the time
+		config.isCancelled = false;
+
+		auto &partitionInfoMap = payloadInfo->partitionInfoMap;
+		if (names.empty()) {
+			for (auto &info: partitionInfoMap | std::views::values) {
+				infos.emplace_back(&info);
+			}
+		}
+		for (const auto &name: names) {
+			const auto it = partitionInfoMap.find(name);
+			if (it == partitionInfoMap.end()) {
+				LOGCE("Partition '{}' not found", name);
+				return RET_EXTRACT_INIT_PART_FAIL;
+			}
+			infos.emplace_back(&it->second);
+		}
+
+		for (auto *info: infos) {
+			if (config.isCancelled) break;
+			info->resetStatus();
+			if (!payloadInfo->initOperations(*info)) {
+				ret = RET_EXTRACT_FAIL_SKIP;
+				continue;
+			}
+			const auto sink = sinkFactory(*info);
+			if (!sink) {
+				LOGCE("Sink: no sink for partition '{}'", info->name);
+				ret = RET_EXTRACT_FAIL_SKIP;
+				continue;
+			}
+			if (!partitionWriter->extractByInfoToSink(*info, *sink)) {
+				ret = RET_EXTRACT_FAIL_SKIP;
+			}
+		}
+		return config.isCancelled ? RET_EXTRACT_FAIL_EXIT : ret;
+	}
+
+	int PayloadExtractor::extractStream(const std::vector<std::string> &names,
+	                                    const StreamSinkFactory &streamSinkFactory) {
+		return extract(names, [&](const PartitionInfo &info) -> std::unique_ptr<PartitionSink> {
+			auto stream = streamSinkFactory(info);
+			if (!stream) return nullptr;
+			return std::make_unique<OwnedStreamSink>(std::move(stream), info.size);
+		});
+	}
+
+	void PayloadExtractor::cancel() {
+		config.isCancelled = true;
+	}
+
+	std::unique_ptr<PartitionReader> PayloadExtractor::createReader(uint64_t maxCacheSize) const {
+		if (!payloadInfo) return nullptr;
+		return std::make_unique<PartitionReader>(config, payloadInfo, maxCacheSize);
+	}
+}
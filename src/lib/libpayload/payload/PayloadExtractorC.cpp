@@ -0,0 +1,185 @@
+#include <cerrno>
+#include <mutex>
+
+#include "payload/LogBase.h"
+#include "payload/PayloadExtractor.h"
+#include "payload/PayloadExtractorC.h"
+
+using namespace skkk;
+
+struct payload_extractor {
+	PayloadExtractor extractor;
+	std::vector<std::string> partitionNames;
+	std::mutex readerMutex;
+	std::unique_ptr<PartitionReader> reader;
+
+	payload_extractor(const char *path, uint32_t threads)
+		: extractor(path, threads) {
+	}
+};
+
+namespace {
+	class CallbackSink : public PartitionSink {
+		const std::string &name;
+		payload_write_cb writeCb;
+		payload_finish_cb finishCb;
+		void *userdata;
+
+		public:
+			CallbackSink(const std::string &name, payload_write_cb writeCb, payload_finish_cb finishCb, void *userdata)
+				: name(name),
+				  writeCb(writeCb),
+				  finishCb(finishCb),
+				  userdata(userdata) {
+			}
+
+			bool write(uint64_t offset, std::span<const uint8_t> data) override {
+				return writeCb(userdata, name.c_str(), offset, data.data(), data.size()) == 0;
+			}
+
+			bool finish(bool success) override {
+				if (finishCb) finishCb(userdata, name.c_str(), success);
+				return success;
+			}
+	};
+
+	class CallbackStreamSink : public PartitionStreamSink {
+		const std::string &name;
+		payload_write_cb writeCb;
+		payload_finish_cb finishCb;
+		void *userdata;
+		uint64_t offset = 0;
+
+		public:
+			CallbackStreamSink(const std::string &name, payload_write_cb writeCb, payload_finish_cb finishCb,
+			                   void *userdata)
+				: name(name),
+				  writeCb(writeCb),
+				  finishCb(finishCb),
+				  userdata(userdata) {
+			}
+
+			bool write(std::span<const uint8_t> data) override {
+				const bool ret = writeCb(userdata, name.c_str(), offset, data.data(), data.size()) == 0;
+				offset += data.size();
+				return ret;
+			}
+
+			bool finish(bool success) override {
+				if (finishCb) finishCb(userdata, name.c_str(), success);
+				return success;
+			}
+	};
+
+	std::vector<std::string> getNames(const char *const *names, size_t count) {
+		std::vector<std::string> ret;
+		for (size_t i = 0; names && i < count; i++) {
+			if (names[i]) ret.emplace_back(names[i]);
+		}
+		return ret;
+	}
+}
+
+payload_extractor *payload_extractor_new(const char *path, uint32_t threads) {
+	if (!path) return nullptr;
+	try {
+		return new payload_extractor(path, threads);
+	} catch (const std::exception &e) {
+		LOGCE("{}", e.what());
+		return nullptr;
+	}
+}
+
+int payload_extractor_open(payload_extractor *extractor) {
+	if (!extractor) return RET_EXTRACT_INIT_FAIL;
+	try {
+		const int ret = extractor->extractor.open();
+		if (ret == RET_EXTRACT_DONE) {
+			extractor->partitionNames = extractor->extractor.getPartitionNames();
+		}
+		return ret;
+	} catch (const std::exception &e) {
+		LOGCE("{}", e.what());
+		return RET_EXTRACT_INIT_FAIL;
+	}
+}
+
+size_t payload_extractor_partition_count(const payload_extractor *extractor) {
+	return extractor ? extractor->partitionNames.size() : 0;
+}
+
+const char *payload_extractor_partition_name(const payload_extractor *extractor, size_t index) {
+	if (!extractor || index >= extractor->partitionNames.size()) return nullptr;
+	return extractor->partitionNames[index].c_str();
+}
+
+uint64_t payload_extractor_partition_size(const payload_extractor *extractor, const char *name) {
+	if (!extractor || !name) return 0;
+	const auto *info = extractor->extractor.getPartition(name);
+	return info ? info->size : 0;
+}
+
+void payload_extractor_set_progress(payload_extractor *extractor, payload_progress_cb cb, void *userdata) {
+	if (!extractor) return;
+	if (!cb) {
+		extractor->extractor.setProgressCallback(nullptr);
+		return;
+	}
+	extractor->extractor.setProgressCallback([cb, userdata](const std::string &partName, uint64_t done,
+	                                                        uint64_t total) {
+		cb(userdata, partName.c_str(), done, total);
+	});
+}
+
+int payload_extractor_extract(payload_extractor *extractor, const char *const *names, size_t count,
+                              payload_write_cb write_cb, payload_finish_cb finish_cb, void *userdata) {
+	if (!extractor || !write_cb) return RET_EXTRACT_CONFIG_FAIL;
+	try {
+		return extractor->extractor.extract(getNames(names, count), [&](const skkk::PartitionInfo &info) {
+			return std::make_unique<CallbackSink>(info.name, write_cb, finish_cb, userdata);
+		});
+	} catch (const std::exception &e) {
+		LOGCE("{}", e.what());
+		return RET_EXTRACT_FAIL_EXIT;
+	}
+}
+
+int payload_extractor_extract_stream(payload_extractor *extractor, const char *const *names, size_t count,
+                                     payload_write_cb write_cb, payload_finish_cb finish_cb, void *userdata) {
+	if (!extractor || !write_cb) return RET_EXTRACT_CONFIG_FAIL;
+	try {
+		return extractor->extractor.extractStream(getNames(names, count), [&](const skkk::PartitionInfo &info) {
+			return std::make_unique<CallbackStreamSink>(info.name, write_cb, finish_cb, userdata);
+		});
+	} catch (const std::exception &e) {
+		LOGCE("{}", e.what());
+		return RET_EXTRACT_FAIL_EXIT;
+	}
+}
+
+int64_t payload_extractor_pread(payload_extractor *extractor, const char *name, uint64_t offset,
+                                uint8_t *buf, uint64_t length) {
+	if (!extractor || !name || (!buf && length > 0)) return -EINVAL;
+	try {
+		{
+			// Created on the first read after open
+			std::lock_guard lock{extractor->readerMutex};
+			if (!extractor->reader) extractor->reader = extractor->extractor.createReader();
+			if (!extractor->reader) return -EINVAL;
+		}
+		return extractor->reader->pread(name, offset, buf, length);
+	} catch (const std::bad_alloc &) {
+		return -ENOMEM;
+	} catch (const std::exception &e) {
+		LOGCE("{}", e.what());
+		return -EIO;
+	}
+}
+
+void payload_extractor_cancel(payload_extractor *extractor) {
+	if (extractor) extractor->extractor.cancel();
+}
+
+void payload_extractor_free(payload_extractor *extractor) {
+	delete extractor;
+}
@@ -1,6 +1,10 @@
+#include <algorithm>
 #include <cinttypes>
 #include <string>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
 
+#include "payload/ManifestIndex.h"
 #include "payload/PayloadInfo.h"
 #include "payload/Utils.h"
 #include "payload/mman/mmap.hpp"
@@ -161,15 +165,92 @@ namespace skkk {
 		return false;
 	}
 
+	/**
+	 * Copies the serialized fields of a message to rest, except the length delimited
+	 * fields in skipFields, onSkip gets the payload of those.
+	 */
+	template<typename F>
+	static bool filterFields(const uint8_t *data, uint64_t size, std::initializer_list<int> skipFields,
+	                         std::string &rest, F &&onSkip) {
+		using google::protobuf::internal::WireFormatLite;
+		google::protobuf::io::CodedInputStream input(data, static_cast<int>(size));
+		int pos = 0;
+		while (const uint32_t tag = input.ReadTag()) {
+			const int field = WireFormatLite::GetTagFieldNumber(tag);
+			if (std::ranges::find(skipFields, field) != skipFields.end() &&
+			    WireFormatLite::GetTagWireType(tag) == WireFormatLite::WIRETYPE_LENGTH_DELIMITED) {
+				uint32_t length = 0;
+				if (!input.ReadVarint32(&length)) return false;
+				const int start = input.CurrentPosition();
+				if (!input.Skip(static_cast<int>(length))) return false;
+				onSkip(field, data + start, length);
+			} else {
+				if (!WireFormatLite::SkipField(&input, tag)) return false;
+				rest.append(reinterpret_cast<const char *>(data) + pos, input.CurrentPosition() - pos);
+			}
+			pos = input.CurrentPosition();
+		}
+		return input.ConsumedEntireMessage();
+	}
+
+	/**
+	 * One arena block for all messages decoded from wireSize bytes, decoded messages
+	 * take a few times their serialized size.
+	 */
+	static google::protobuf::ArenaOptions getArenaOptions(uint64_t wireSize) {
+		constexpr uint64_t minBlockSize = 64 * 1024;
+		constexpr uint64_t maxBlockSize = 256 * 1024 * 1024;
+		google::protobuf::ArenaOptions options;
+		options.start_block_size = std::clamp(wireSize * 6, minBlockSize, maxBlockSize);
+		options.max_block_size = options.start_block_size;
+		return options;
+	}
+
 	bool PayloadInfo::parseManifestData() {
-		if (manifest.ParseFromArray(pHeader.manifest.get(), pHeader.manifestSize)) {
-			pHeader.blockSize = manifest.block_size();
+		// Operations are most of the manifest, only the partition headers are decoded here,
+		// the operations of a partition when it is selected, see initOperations
+		std::string headerData;
+		std::vector<std::string> partitionData;
+		uint64_t decodeSize = 0;
+		partitionUpdates.clear();
+		bool ret = filterFields(pHeader.manifest.get(), pHeader.manifestSize,
+		                        {DeltaArchiveManifest::kPartitionsFieldNumber}, headerData,
+		                        [&](int, const uint8_t *data, uint64_t size) {
+			                        partitionUpdates.emplace_back(data, size);
+		                        });
+		decodeSize += headerData.size();
+		for (const auto &pud: partitionUpdates) {
+			if (!ret) break;
+			ret = filterFields(pud.data(), pud.size(),
+			                   {PartitionUpdate::kOperationsFieldNumber, PartitionUpdate::kMergeOperationsFieldNumber},
+			                   partitionData.emplace_back(), [](int, const uint8_t *, uint64_t) {
+			                   });
+			decodeSize += partitionData.back().size();
+		}
+
+		if (ret) {
+			manifestArena = std::make_unique<google::protobuf::Arena>(getArenaOptions(decodeSize));
+			manifest = google::protobuf::Arena::CreateMessage<DeltaArchiveManifest>(manifestArena.get());
+			ret = manifest->ParseFromString(headerData);
+			for (const auto &data: partitionData) {
+				if (!ret) break;
+				ret = manifest->add_partitions()->ParseFromString(data);
+			}
+		}
+		if (ret) {
+			pHeader.blockSize = manifest->block_size();
 			return true;
 		}
 		LOGCE("failed to parse manifest");
 		return false;
 	}
 
+	void PayloadInfo::releaseManifest() {
+		// All messages go with the arena at once
+		manifest = nullptr;
+		manifestArena.reset();
+	}
+
 	const uint8_t *PayloadInfo::getPayloadData() const {
 		if (fileData) {
 			return fileData;
@@ -177,36 +258,103 @@ namespace skkk {
 		return nullptr;
 	}
 
-	bool PayloadInfo::parsePartitionInfo() {
-		const auto partitionsSize = manifest.partitions_size();
-		const auto minorVersion = manifest.minor_version();
+	PartitionInfo &PayloadInfo::addPartitionInfo(const std::string &partName, uint64_t size,
+	                                             const std::string &oldHash, uint64_t oldHashSize,
+	                                             const std::string &newHash, uint64_t newHashSize) {
+		const auto &outConfig = config.getOutConfig();
+		const auto &name = outConfig.find(partName);
+		std::string outFilePath{
+			name != outConfig.end() ? name->second : config.getOutDir() + "/" + partName + ".img"
+		};
+
+		auto &partInfo = partitionInfoMap.emplace(std::piecewise_construct, std::forward_as_tuple(partName),
+		                                          std::forward_as_tuple(partName, size, outFilePath,
+		                                                                pHeader.blockSize, oldHash, oldHashSize,
+		                                                                newHash, newHashSize)).first->second;
+		if (config.isIncremental) {
+			partInfo.oldFilePath = config.getOldDir() + "/" + partName + ".img";
+		}
+		partInfo.outErrorPath = config.getOutDir() + "/" + partName + "_err.txt";
+		return partInfo;
+	}
+
+	static void copyHash(std::array<uint8_t, OPERATION_HASH_SIZE> &hash, const std::string &value) {
+		memcpy(hash.data(), value.data(), std::min<uint64_t>(value.size(), hash.size()));
+	}
+
+	void PayloadInfo::buildOperations(const PartitionUpdate &pu, PartitionInfo &info) const {
 		const uint64_t offset = payloadOffset + pHeader.inPayloadOffset;
 		const auto blockSize = pHeader.blockSize;
-		const auto &outConfig = config.getOutConfig();
+		// The extent table is sized first, the operations keep pointers into it
+		uint64_t extentCount = 0;
+		for (const auto &iop: pu.operations()) {
+			extentCount += iop.src_extents_size() + iop.dst_extents_size();
+		}
+		auto extents = std::make_shared<std::vector<Extent>>();
+		extents->reserve(extentCount);
+		auto &operations = info.operations;
+		operations.reserve(pu.operations_size());
+		for (const auto &iop: pu.operations()) {
+			auto &fop = operations.emplace_back();
+			fop.index = operations.size() - 1;
+			fop.type = iop.type();
+			fop.dataOffset = iop.data_offset() + offset;
+			fop.dataLength = iop.data_length();
+			copyHash(fop.srcDataSha256Hash, iop.src_sha256_hash());
+			copyHash(fop.dataSha256Hash, iop.data_sha256_hash());
+
+			const uint64_t srcStart = extents->size();
+			for (auto &src: iop.src_extents()) {
+				auto &s = extents->emplace_back(blockSize, src.start_block(), src.num_blocks());
+				fop.srcTotalLength += s.dataLength;
+			}
+			fop.srcExtents = {extents->data() + srcStart, extents->size() - srcStart};
+
+			const uint64_t dstStart = extents->size();
+			for (auto &dst: iop.dst_extents()) {
+				auto &d = extents->emplace_back(blockSize, dst.start_block(), dst.num_blocks());
+				fop.dstTotalLength += d.dataLength;
+			}
+			fop.dstExtents = {extents->data() + dstStart, extents->size() - dstStart};
+		}
+		info.extentStorage = std::move(extents);
+		info.isOperationsInit = true;
+	}
+
+	bool PayloadInfo::initOperations(PartitionInfo &info) {
+		if (info.isOperationsInit) return true;
+		if (manifestIndex) {
+			return manifestIndex->loadOperations(info);
+		}
+		if (info.sourceIndex < partitionUpdates.size()) {
+			const auto &pud = partitionUpdates[info.sourceIndex];
+			google::protobuf::Arena arena{getArenaOptions(pud.size())};
+			auto *pu = google::protobuf::Arena::CreateMessage<PartitionUpdate>(&arena);
+			if (pu->ParseFromArray(pud.data(), static_cast<int>(pud.size()))) {
+				buildOperations(*pu, info);
+				return true;
+			}
+		}
+		LOGCE("failed to parse operations of {}", info.name);
+		return false;
+	}
+
+	bool PayloadInfo::parsePartitionInfo() {
+		const auto partitionsSize = manifest->partitions_size();
+		const auto minorVersion = manifest->minor_version();
+		const auto blockSize = pHeader.blockSize;
 
 		pHeader.partitionSize = partitionsSize;
 		pHeader.minorVersion = minorVersion;
-		pHeader.securityPatchLevel = manifest.security_patch_level();
+		pHeader.securityPatchLevel = manifest->security_patch_level();
 
-		for (const PartitionUpdate &pu: manifest.partitions()) {
+		for (uint32_t i = 0; i < partitionsSize; i++) {
+			const auto &pu = manifest->partitions(i);
 			const auto &opi = pu.old_partition_info();
 			const auto &npi = pu.new_partition_info();
-			const auto &partName = pu.partition_name();
-
-			const auto &name = outConfig.find(partName);
-			std::string outFilePath{
-				name != outConfig.end() ? name->second : config.getOutDir() + "/" + partName + ".img"
-			};
-
-			auto &partInfo = partitionInfoMap.emplace(std::piecewise_construct, std::forward_as_tuple(partName),
-			                                          std::forward_as_tuple(partName, npi.size(),
-			                                                                outFilePath, blockSize,
-			                                                                opi.hash(), opi.size(),
-			                                                                npi.hash(), npi.size())).first->second;
-			if (config.isIncremental) {
-				partInfo.oldFilePath = config.getOldDir() + "/" + partName + ".img";
-			}
-			partInfo.outErrorPath = config.getOutDir() + "/" + partName + "_err.txt";
+			auto &partInfo = addPartitionInfo(pu.partition_name(), npi.size(), opi.hash(), opi.size(),
+			                                  npi.hash(), npi.size());
+			partInfo.sourceIndex = i;
 
 			if (pu.has_hash_tree_data_extent()) {
 				partInfo.hasHashTreeDataExtent = true;
@@ -227,29 +375,11 @@ namespace skkk {
 				partInfo.fecRoots = pu.fec_roots();
 			}
 
-			auto &operations = partInfo.operations;
-			operations.reserve(static_cast<uint32_t>(pu.operations_size() * 1.5));
-			for (const auto &iop: pu.operations()) {
-				const auto dataOffset = iop.data_offset() + offset;
-				auto &fop = operations.emplace_back(partName, iop.type(), blockSize,
-				                                    dataOffset, iop.data_length(), iop.src_length(),
-				                                    iop.dst_length(), iop.src_sha256_hash(), iop.data_sha256_hash());
-				auto &srcs = fop.srcExtents;
-				auto &dsts = fop.dstExtents;
-				for (auto &src: iop.src_extents()) {
-					auto &s = srcs.emplace_back(blockSize, src.start_block(), src.num_blocks());
-					fop.srcTotalLength += s.dataLength;
-				}
-				for (auto &dst: iop.dst_extents()) {
-					auto &d = dsts.emplace_back(blockSize, dst.start_block(), dst.num_blocks());
-					fop.dstTotalLength += d.dataLength;
-				}
-			}
 		}
 
 		LOGCD("Partition size: {}", partitionsSize);
-		LOGCD("Minor version: {}", manifest.minor_version());
-		LOGCD("Security patch level: {}", manifest.security_patch_level());
+		LOGCD("Minor version: {}", manifest->minor_version());
+		LOGCD("Security patch level: {}", manifest->security_patch_level());
 		return partitionsSize == partitionInfoMap.size();
 	}
 
@@ -258,9 +388,43 @@ namespace skkk {
 		if (!handleOffset()) goto out;
 		if (!parseHeader()) goto out;
 		if (!readHeaderData()) goto out;
+		if (!config.getIndexDir().empty()) {
+			return initPayloadInfoByIndex();
+		}
 		if (!parseManifestData()) goto out;
-		if (!dynamicPartitionMetadata.parseDynamicPartitionMetadata(manifest)) goto out;
+		if (!dynamicPartitionMetadata.parseDynamicPartitionMetadata(*manifest)) goto out;
 		if (!parsePartitionInfo()) goto out;
+		releaseManifest();
+		return true;
+	out:
+		LOGCE("Failed to initialize payload info");
+		return false;
+	}
+
+	uint64_t PayloadInfo::getPayloadFileSize() const {
+		return fileDataSize;
+	}
+
+	bool PayloadInfo::initPayloadInfoByIndex() {
+		const auto &indexDir = config.getIndexDir();
+		if (!dirExists(indexDir) && mkdirs(indexDir.c_str(), 0755)) {
+			LOGCE("Index: failed to create dir: '{}'", indexDir);
+		}
+		auto index = std::make_shared<ManifestIndex>(*this, indexDir, getPayloadFileSize());
+		if (index->load()) {
+			manifestIndex = std::move(index);
+			return true;
+		}
+
+		partitionInfoMap.clear();
+		dynamicPartitionMetadata = {};
+		if (!parseManifestData()) goto out;
+		if (!dynamicPartitionMetadata.parseDynamicPartitionMetadata(*manifest)) goto out;
+		if (!parsePartitionInfo()) goto out;
+		if (!index->save()) {
+			LOGCD("Index: failed to save '{}'", index->getPath());
+		}
+		releaseManifest();
 		return true;
 	out:
 		LOGCE("Failed to initialize payload info");
@@ -16,6 +16,9 @@ namespace skkk {
 					if (!config.httpDownload) throw std::runtime_error("httpDownload not found!");
 					info = std::make_shared<UrlPayloadInfo>(config);
 					break;
+				case PAYLOAD_TYPE_STREAM:
+					info = std::make_shared<StreamPayloadInfo>(config);
+					break;
 				default: {
 				}
 			}
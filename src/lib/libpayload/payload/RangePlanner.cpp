@@ -0,0 +1,41 @@
+#include <algorithm>
+
+#include "payload/RangePlanner.h"
+
+namespace skkk {
+	std::vector<RangeGroup> RangePlanner::plan(const std::vector<FileOperation> &operations,
+	                                           uint64_t targetSize, uint64_t gapTolerance) {
+		std::vector<RangeGroup> groups;
+		std::vector<const FileOperation *> dataOperations;
+		dataOperations.reserve(operations.size());
+
+		for (const auto &operation: operations) {
+			if (operation.dataLength > 0) {
+				dataOperations.emplace_back(&operation);
+			} else {
+				groups.emplace_back().operations.emplace_back(&operation);
+			}
+		}
+		std::ranges::sort(dataOperations, {}, &FileOperation::dataOffset);
+
+		RangeGroup *current = nullptr;
+		for (const auto *operation: dataOperations) {
+			const uint64_t end = operation->dataOffset + operation->dataLength;
+			if (current) {
+				const uint64_t currentEnd = current->offset + current->length;
+				if (operation->dataOffset >= currentEnd &&
+				    operation->dataOffset - currentEnd <= gapTolerance &&
+				    end - current->offset <= targetSize) {
+					current->length = end - current->offset;
+					current->operations.emplace_back(operation);
+					continue;
+				}
+			}
+			current = &groups.emplace_back();
+			current->offset = operation->dataOffset;
+			current->length = operation->dataLength;
+			current->operations.emplace_back(operation);
+		}
+		return groups;
+	}
+}
@@ -0,0 +1,14 @@
+#include <algorithm>
+#include <random>
+
+#include "payload/RetryPolicy.h"
+
+namespace skkk {
+	std::chrono::milliseconds RetryPolicy::getDelay(uint32_t retry) const {
+		thread_local std::mt19937 mt{std::random_device{}()};
+		const uint64_t cap = std::min<uint64_t>(maxDelay.count(),
+		                                        static_cast<uint64_t>(baseDelay.count()) << std::min(retry, 20u));
+		std::uniform_int_distribution<uint64_t> dist(0, cap);
+		return std::chrono::milliseconds(dist(mt));
+	}
+}
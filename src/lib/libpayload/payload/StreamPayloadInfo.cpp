@@ -0,0 +1,141 @@
+#include <cstring>
+
+#include "common/endian.h"
+#include "payload/LogBase.h"
+#include "payload/PayloadInfo.h"
+#include "payload/ZipParser.h"
+#include "payload/common/Buffer.hpp"
+#include "payload/common/io.h"
+
+#if defined(_WIN32)
+#include <io.h>
+#endif
+
+namespace skkk {
+	StreamPayloadInfo::StreamPayloadInfo(const ExtractConfig &config)
+		: PayloadInfo(config) {
+	}
+
+	bool StreamPayloadInfo::initPayloadFile() {
+#if defined(_WIN32)
+		_setmode(streamFd, _O_BINARY);
+#endif
+		return true;
+	}
+
+	bool StreamPayloadInfo::readStream(void *data, uint64_t length) {
+		if (int ret = streamRead(streamFd, data, length)) {
+			LOGCE("Stream: failed to read {} bytes at {}, code({})", length, streamOffset, ret);
+			return false;
+		}
+		streamOffset += length;
+		return true;
+	}
+
+	bool StreamPayloadInfo::skipStream(uint64_t length) {
+		static constexpr uint64_t SKIP_BUFFER_SIZE = 1024 * 1024;
+		if (length == 0) return true;
+		Buffer<uint8_t> buffer{std::min(length, SKIP_BUFFER_SIZE)};
+		while (length > 0) {
+			const uint64_t len = std::min(length, SKIP_BUFFER_SIZE);
+			if (!readStream(buffer.get(), len)) return false;
+			length -= len;
+		}
+		return true;
+	}
+
+	uint64_t StreamPayloadInfo::getStreamOffset() const {
+		return streamOffset;
+	}
+
+	bool StreamPayloadInfo::skipZipEntries(uint8_t *magic) {
+		// The central directory is at the end, entries are walked by their local headers
+		while (memcmp(magic, ZIP_LOCAL_FILE_HEADER_MAGIC, ZIP_LOCAL_FILE_HEADER_SIZE) == 0) {
+			ZipLocalHeader zlh = {};
+			auto *zlhData = reinterpret_cast<uint8_t *>(&zlh);
+			memcpy(zlhData, magic, ZIP_LOCAL_FILE_HEADER_SIZE);
+			if (!readStream(zlhData + ZIP_LOCAL_FILE_HEADER_SIZE, sizeof(zlh) - ZIP_LOCAL_FILE_HEADER_SIZE)) {
+				return false;
+			}
+			std::string filename(zlh.filenameLength, '\0');
+			Buffer<uint8_t> extra{zlh.extraFieldLength};
+			if (!readStream(filename.data(), filename.size()) ||
+			    !readStream(extra.get(), zlh.extraFieldLength)) {
+				return false;
+			}
+
+			if (filename == PAYLOAD_FILENAME) {
+				if (zlh.compressionMethod != 0) {
+					LOGCE("Stream: payload.bin is compressed, method: {}", zlh.compressionMethod);
+					return false;
+				}
+				payloadOffset = streamOffset;
+				return readStream(magic, PAYLOAD_MAGIC_SIZE);
+			}
+
+			uint64_t compressedSize = zlh.compressedSize;
+			for (uint32_t pos = 0; compressedSize == 0xFFFFFFFF &&
+			                       pos + sizeof(Zip64ExtendedInfo) <= zlh.extraFieldLength;) {
+				const auto *info = reinterpret_cast<const Zip64ExtendedInfo *>(extra.get() + pos);
+				pos += sizeof(Zip64ExtendedInfo);
+				// The local header has both sizes, uncompressed first
+				if (info->headerId == 0x0001 && info->dataSize >= 16 && pos + 16 <= zlh.extraFieldLength) {
+					memcpy(&compressedSize, extra.get() + pos + 8, sizeof(compressedSize));
+				}
+				pos += info->dataSize;
+			}
+			// Bit 3, the sizes follow the data and can not be known while streaming
+			if ((zlh.flags & 0x08) && compressedSize == 0) {
+				LOGCE("Stream: ZIP entry '{}' has no size in its local header", filename);
+				return false;
+			}
+			LOGCD("Stream: skip '{}' size={}", filename, compressedSize);
+			if (!skipStream(compressedSize) || !readStream(magic, ZIP_LOCAL_FILE_HEADER_SIZE)) {
+				return false;
+			}
+		}
+		LOGCE("Stream: payload.bin not found in ZIP before the central directory");
+		return false;
+	}
+
+	bool StreamPayloadInfo::readPayloadMetadata(const uint8_t *magic) {
+		uint8_t header[kMaxPayloadHeaderSize] = {};
+		uint64_t headerSize = kMaxPayloadHeaderSize;
+		memcpy(header, magic, PAYLOAD_MAGIC_SIZE);
+		// magic(4) file_format_version(8) manifest_size(8) [metadata_signature_size(4)]
+		if (!readStream(header + PAYLOAD_MAGIC_SIZE, 16)) return false;
+		uint64_t version = 0, manifestSize = 0;
+		uint32_t signatureSize = 0;
+		memcpy(&version, header + 4, sizeof(version));
+		memcpy(&manifestSize, header + 12, sizeof(manifestSize));
+		version = be64toh(version);
+		manifestSize = be64toh(manifestSize);
+		if (version >= VERSION_2) {
+			if (!readStream(header + 20, sizeof(signatureSize))) return false;
+			memcpy(&signatureSize, header + 20, sizeof(signatureSize));
+			signatureSize = be32toh(signatureSize);
+		} else {
+			headerSize -= sizeof(signatureSize);
+		}
+
+		payloadMetadataSize = headerSize + manifestSize + signatureSize;
+		payloadMetadata.reserve(payloadMetadataSize);
+		if (!payloadMetadata) return false;
+		memcpy(payloadMetadata.get(), header, headerSize);
+		LOGCD("Stream: payloadOffset={} metadataSize={}", payloadOffset, payloadMetadataSize);
+		return readStream(payloadMetadata.get() + headerSize, payloadMetadataSize - headerSize);
+	}
+
+	bool StreamPayloadInfo::handleOffset() {
+		uint8_t magic[PAYLOAD_MAGIC_SIZE] = {};
+		if (!readStream(magic, PAYLOAD_MAGIC_SIZE)) return false;
+		if (memcmp(magic, ZIP_LOCAL_FILE_HEADER_MAGIC, ZIP_LOCAL_FILE_HEADER_SIZE) == 0) {
+			if (!skipZipEntries(magic)) return false;
+		}
+		if (memcmp(magic, PAYLOAD_MAGIC, PAYLOAD_MAGIC_SIZE) == 0) {
+			return readPayloadMetadata(magic);
+		}
+		LOGCE("Stream: payload.bin not found!");
+		return false;
+	}
+}
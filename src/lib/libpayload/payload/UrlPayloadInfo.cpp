@@ -15,6 +15,10 @@ namespace skkk {
 		return true;
 	}
 
+	uint64_t UrlPayloadInfo::getPayloadFileSize() const {
+		return httpDownload->getFileSize();
+	}
+
 	bool UrlPayloadInfo::download(std::string &data, uint64_t offset, uint64_t length) const {
 		bool ret = false;
 		int retryCount = 0;
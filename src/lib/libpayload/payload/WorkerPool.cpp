@@ -0,0 +1,60 @@
+#include <algorithm>
+
+#include "payload/WorkerPool.h"
+
+namespace skkk {
+	WorkerPool::WorkerPool(uint32_t size) {
+		threads.reserve(size);
+		for (uint32_t i = 0; i < std::max<uint32_t>(size, 1); i++) {
+			threads.emplace_back(&WorkerPool::run, this);
+		}
+	}
+
+	WorkerPool::~WorkerPool() {
+		{
+			std::lock_guard lock{mutex};
+			isStopping = true;
+		}
+		cv.notify_all();
+		for (auto &thread: threads) {
+			thread.join();
+		}
+	}
+
+	uint32_t WorkerPool::getSize() const {
+		return threads.size();
+	}
+
+	void WorkerPool::commit(Task task, uint64_t group) {
+		{
+			std::lock_guard lock{mutex};
+			queues[group].emplace_back(std::move(task));
+		}
+		cv.notify_one();
+	}
+
+	bool WorkerPool::takeTask(Task &task) {
+		std::unique_lock lock{mutex};
+		cv.wait(lock, [this] { return isStopping || !queues.empty(); });
+		if (queues.empty()) return false;
+
+		auto it = queues.upper_bound(lastGroup);
+		if (it == queues.end()) it = queues.begin();
+		task = std::move(it->second.front());
+		it->second.pop_front();
+		lastGroup = it->first;
+		if (it->second.empty()) {
+			queues.erase(it);
+		}
+		return true;
+	}
+
+	void WorkerPool::run() {
+		Task task;
+		// Queued tasks are still run when the pool stops
+		while (takeTask(task)) {
+			task();
+			task = nullptr;
+		}
+	}
+}
@@ -0,0 +1,73 @@
+#include <chrono>
+
+#include "Prefetcher.h"
+#include "payload/mman/mmap.hpp"
+
+namespace skkk {
+	Prefetcher::Prefetcher(const std::vector<FileOperation> &operations, const uint8_t *payloadData,
+	                       const uint8_t *inData, const std::atomic_int &progress, uint64_t budget)
+		: operations(operations),
+		  payloadData(payloadData),
+		  inData(inData),
+		  progress(progress),
+		  budget(budget) {
+		if (budget > 0 && (payloadData || inData)) {
+			thread = std::thread(&Prefetcher::run, this);
+		}
+	}
+
+	Prefetcher::~Prefetcher() {
+		{
+			std::lock_guard lock{mutex};
+			isStopping = true;
+		}
+		cv.notify_one();
+		if (thread.joinable()) thread.join();
+	}
+
+	void Prefetcher::notifyProgress() {
+		if (isWaiting) {
+			std::lock_guard lock{mutex};
+			cv.notify_one();
+		}
+	}
+
+	static uint64_t getReadLength(const FileOperation &operation) {
+		return operation.dataLength + operation.srcTotalLength;
+	}
+
+	void Prefetcher::run() {
+		const uint64_t opSize = operations.size();
+		// Prefix sums of the bytes read by the operations
+		std::vector<uint64_t> readOffsets(opSize + 1, 0);
+		for (uint64_t i = 0; i < opSize; i++) {
+			readOffsets[i + 1] = readOffsets[i] + getReadLength(operations[i]);
+		}
+
+		uint64_t issued = 0;
+		while (!isStopping && issued < opSize) {
+			// Completed operations approximate the position of the workers
+			const uint64_t done = std::min<uint64_t>(std::max(progress.load(), 0), opSize);
+			issued = std::max(issued, done);
+			if (issued < opSize && readOffsets[issued + 1] - readOffsets[done] <= budget) {
+				const auto &operation = operations[issued++];
+				if (payloadData && operation.dataLength > 0) {
+					mapAdviseWillNeed(payloadData + operation.dataOffset, operation.dataLength);
+				}
+				if (inData) {
+					for (const auto &e: operation.srcExtents) {
+						mapAdviseWillNeed(inData + e.dataOffset, e.dataLength);
+					}
+				}
+				continue;
+			}
+			// The budget is used up or the workers stall, wait until an operation completes
+			std::unique_lock lock{mutex};
+			isWaiting = true;
+			cv.wait_for(lock, std::chrono::milliseconds(100), [&] {
+				return isStopping || static_cast<uint64_t>(std::max(progress.load(), 0)) != done;
+			});
+			isWaiting = false;
+		}
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef PAYLOAD_EXTRACT_PREFETCHER_H
+#define PAYLOAD_EXTRACT_PREFETCHER_H
+
+#include <atomic>
+#include <cinttypes>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "payload/PartitionInfo.h"
+
+namespace skkk {
+	/**
+	 * Walks the operations of a partition in the order they are scheduled and asks
+	 * the kernel to read their payload data and source extents ahead, keeping at most
+	 * budget bytes between the completed and the advised operations.
+	 */
+	class Prefetcher {
+		const std::vector<FileOperation> &operations;
+		const uint8_t *payloadData = nullptr;
+		const uint8_t *inData = nullptr;
+		const std::atomic_int &progress;
+		uint64_t budget = 0;
+		std::atomic_bool isStopping = false;
+		// Set while the thread waits for the workers, only then progress wakes it
+		std::atomic_bool isWaiting = false;
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::thread thread;
+
+		void run();
+
+		public:
+			Prefetcher(const std::vector<FileOperation> &operations, const uint8_t *payloadData,
+			           const uint8_t *inData, const std::atomic_int &progress, uint64_t budget);
+
+			Prefetcher(const Prefetcher &other) = delete;
+
+			Prefetcher &operator=(const Prefetcher &other) = delete;
+
+			~Prefetcher();
+
+			/**
+			 * Called after progress was increased.
+			 */
+			void notifyProgress();
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_PREFETCHER_H
@@ -0,0 +1,36 @@
+#ifndef PAYLOAD_EXTRACT_TASKGROUP_H
+#define PAYLOAD_EXTRACT_TASKGROUP_H
+
+#include <condition_variable>
+#include <cinttypes>
+#include <mutex>
+
+namespace skkk {
+	/**
+	 * Counts outstanding tasks committed to a shared threadpool, so the submitter
+	 * can wait for its own tasks without destroying the pool.
+	 */
+	class TaskGroup {
+		std::mutex lock;
+		std::condition_variable cv;
+		uint64_t pending = 0;
+
+		public:
+			void add(uint64_t count = 1) {
+				std::lock_guard guard{lock};
+				pending += count;
+			}
+
+			void done() {
+				std::lock_guard guard{lock};
+				if (pending > 0 && --pending == 0) cv.notify_all();
+			}
+
+			void wait() {
+				std::unique_lock guard{lock};
+				cv.wait(guard, [this] { return pending == 0; });
+			}
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_TASKGROUP_H
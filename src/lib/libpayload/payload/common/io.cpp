@@ -1,4 +1,15 @@
+#include <algorithm>
+#include <cstdio>
+#include <format>
 #include <fstream>
+#include <thread>
+
+#if defined(_WIN32)
+#include <process.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
 
 #include "payload/Utils.h"
 #include "payload/common/io.h"
@@ -46,6 +57,30 @@ namespace skkk {
 		return read != length ? -EIO : 0;
 	}
 
+	int streamRead(int fd, void *data, uint64_t length) {
+		int64_t ret = 0, read = 0;
+
+		if (!data) {
+			return -EINVAL;
+		}
+
+		do {
+			ret = ::read(fd, data, std::min<uint64_t>(length - read, INT32_MAX));
+			if (ret <= 0) {
+				if (!ret)
+					break;
+				if (errno != EINTR) {
+					return -errno;
+				}
+				ret = 0;
+			}
+			data = static_cast<char *>(data) + ret;
+			read += ret;
+		} while (read < length);
+
+		return read != length ? -EIO : 0;
+	}
+
 	int blobWrite(int fd, const void *data, uint64_t offset, uint64_t length) {
 		int64_t ret = 0, written = 0;
 
@@ -98,4 +133,17 @@ namespace skkk {
 		}
 		return !result.empty();
 	}
+
+	std::string getTempPath(const std::string &path) {
+		return std::format("{}.{}.{}.tmp", path, getpid(),
+		                   std::hash<std::thread::id>{}(std::this_thread::get_id()));
+	}
+
+	bool renameReplace(const std::string &from, const std::string &to) {
+#if defined(_WIN32)
+		return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		return rename(from.c_str(), to.c_str()) == 0;
+#endif
+	}
 }
@@ -7,6 +7,27 @@
 #include "Decompress.h"
 
 namespace skkk {
+	/**
+	 * Decoder state of a worker thread, allocated by its first operation and reused
+	 * by all later ones, also across partitions and payloads on a shared pool.
+	 */
+	class ThreadDecoders {
+		public:
+			lzma_stream xz = LZMA_STREAM_INIT;
+			ZSTD_DCtx *zstd = nullptr;
+
+		public:
+			~ThreadDecoders() {
+				lzma_end(&xz);
+				ZSTD_freeDCtx(zstd);
+			}
+	};
+
+	static ThreadDecoders &getThreadDecoders() {
+		thread_local ThreadDecoders decoders;
+		return decoders;
+	}
+
 	int Decompress::brotliDecompress(const void *src, uint64_t srcSize, void *destBuf, uint64_t destSize) {
 		size_t dstSize = destSize;
 		BrotliDecoderResult bret = BrotliDecoderDecompress(srcSize, static_cast<const uint8_t *>(src),
@@ -44,7 +65,8 @@ namespace skkk {
 
 	int Decompress::xzDecompress(const void *src, uint64_t srcSize, void *destBuf, uint64_t destSize) {
 		int ret = 0;
-		lzma_stream strm = LZMA_STREAM_INIT;
+		// Initializing a used stream again keeps its allocations
+		lzma_stream &strm = getThreadDecoders().xz;
 		lzma_ret err = lzma_stream_decoder(&strm, MaxDictSize, LZMA_CONCATENATED);
 		if (err != LZMA_OK) {
 			ret = -EFAULT;
@@ -57,24 +79,28 @@ namespace skkk {
 		err = lzma_code(&strm, LZMA_FINISH);
 		if (err != LZMA_STREAM_END) {
 			ret = -EBADMSG;
-			goto out_lzma_end;
+			goto out;
 		}
 		destSize = strm.total_out;
 
-	out_lzma_end:
-		lzma_end(&strm);
 	out:
 		return ret;
 	}
 
 	int Decompress::zstdDecompress(const void *src, uint64_t srcSize, void *destBuf, uint64_t destSize) {
 		int ret = 0;
-		ret = ZSTD_decompress(destBuf, destSize, src, srcSize);
-		if (ZSTD_isError(ret)) {
+		auto &decoders = getThreadDecoders();
+		if (!decoders.zstd) {
+			decoders.zstd = ZSTD_createDCtx();
+			if (!decoders.zstd) {
+				ret = -ENOMEM;
+				goto out;
+			}
+		}
+		if (ZSTD_isError(ZSTD_decompressDCtx(decoders.zstd, destBuf, destSize, src, srcSize))) {
 			ret = -EBADMSG;
 			goto out;
 		}
-		ret = 0;
 	out:
 		return ret;
 	}
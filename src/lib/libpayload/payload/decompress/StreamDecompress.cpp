@@ -0,0 +1,159 @@
+#include <cerrno>
+#include <bzlib.h>
+#include <lzma.h>
+#include <zstd.h>
+
+#include "StreamDecompress.h"
+
+namespace skkk {
+	class BzipStreamDecompress : public StreamDecompress {
+		bz_stream strm = {};
+		bool isInit = false;
+		bool isEnd = false;
+
+		public:
+			BzipStreamDecompress(uint8_t *dest, uint64_t destSize)
+				: StreamDecompress(dest, destSize) {
+				reset();
+			}
+
+			~BzipStreamDecompress() override {
+				if (isInit) BZ2_bzDecompressEnd(&strm);
+			}
+
+			void reset() override {
+				if (isInit) BZ2_bzDecompressEnd(&strm);
+				strm = {};
+				isInit = BZ2_bzDecompressInit(&strm, 0, 0) == BZ_OK;
+				isEnd = false;
+				err = isInit ? 0 : -EFAULT;
+				strm.next_out = reinterpret_cast<char *>(dest);
+				strm.avail_out = destSize;
+			}
+
+			bool write(const uint8_t *data, uint64_t length) override {
+				if (err) return true;
+				if (isEnd) {
+					err = -EBADMSG;
+					return true;
+				}
+				strm.next_in = const_cast<char *>(reinterpret_cast<const char *>(data));
+				strm.avail_in = length;
+				const int ret = BZ2_bzDecompress(&strm);
+				if (ret == BZ_STREAM_END) {
+					isEnd = true;
+				} else if (ret != BZ_OK || (strm.avail_in > 0 && strm.avail_out == 0)) {
+					err = -EBADMSG;
+				}
+				return true;
+			}
+
+			int finish() override {
+				if (err) return err;
+				return isEnd ? 0 : -EBADMSG;
+			}
+	};
+
+	class XzStreamDecompress : public StreamDecompress {
+		static constexpr uint32_t MaxDictSize = 64 * 1024 * 1024;
+		lzma_stream strm = LZMA_STREAM_INIT;
+		bool isEnd = false;
+
+		public:
+			XzStreamDecompress(uint8_t *dest, uint64_t destSize)
+				: StreamDecompress(dest, destSize) {
+				reset();
+			}
+
+			~XzStreamDecompress() override {
+				lzma_end(&strm);
+			}
+
+			void reset() override {
+				lzma_end(&strm);
+				strm = LZMA_STREAM_INIT;
+				err = lzma_stream_decoder(&strm, MaxDictSize, LZMA_CONCATENATED) == LZMA_OK ? 0 : -EFAULT;
+				isEnd = false;
+				strm.next_out = dest;
+				strm.avail_out = destSize;
+			}
+
+			bool write(const uint8_t *data, uint64_t length) override {
+				if (err) return true;
+				strm.next_in = data;
+				strm.avail_in = length;
+				const lzma_ret ret = lzma_code(&strm, LZMA_RUN);
+				if (ret != LZMA_OK || (strm.avail_in > 0 && strm.avail_out == 0)) {
+					err = -EBADMSG;
+				}
+				return true;
+			}
+
+			int finish() override {
+				if (err) return err;
+				strm.next_in = nullptr;
+				strm.avail_in = 0;
+				// LZMA_CONCATENATED only reports the end once told there is no more input
+				if (lzma_code(&strm, LZMA_FINISH) != LZMA_STREAM_END) {
+					err = -EBADMSG;
+				}
+				return err;
+			}
+	};
+
+	class ZstdStreamDecompress : public StreamDecompress {
+		ZSTD_DCtx *dctx = nullptr;
+		ZSTD_outBuffer output = {};
+		size_t lastRet = 1;
+
+		public:
+			ZstdStreamDecompress(uint8_t *dest, uint64_t destSize)
+				: StreamDecompress(dest, destSize) {
+				dctx = ZSTD_createDCtx();
+				reset();
+			}
+
+			~ZstdStreamDecompress() override {
+				ZSTD_freeDCtx(dctx);
+			}
+
+			void reset() override {
+				err = dctx ? 0 : -EFAULT;
+				if (dctx) ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+				output = {dest, destSize, 0};
+				lastRet = 1;
+			}
+
+			bool write(const uint8_t *data, uint64_t length) override {
+				if (err) return true;
+				ZSTD_inBuffer input = {data, length, 0};
+				while (input.pos < input.size) {
+					const size_t outPos = output.pos;
+					lastRet = ZSTD_decompressStream(dctx, &output, &input);
+					if (ZSTD_isError(lastRet) || (output.pos == outPos && output.pos == output.size)) {
+						err = -EBADMSG;
+						break;
+					}
+				}
+				return true;
+			}
+
+			int finish() override {
+				if (err) return err;
+				// 0 means the last frame is complete
+				return lastRet == 0 ? 0 : -EBADMSG;
+			}
+	};
+
+	std::unique_ptr<StreamDecompress> StreamDecompress::createBzip(uint8_t *dest, uint64_t destSize) {
+		return std::make_unique<BzipStreamDecompress>(dest, destSize);
+	}
+
+	std::unique_ptr<StreamDecompress> StreamDecompress::createXz(uint8_t *dest, uint64_t destSize) {
+		return std::make_unique<XzStreamDecompress>(dest, destSize);
+	}
+
+	std::unique_ptr<StreamDecompress> StreamDecompress::createZstd(uint8_t *dest, uint64_t destSize) {
+		return std::make_unique<ZstdStreamDecompress>(dest, destSize);
+	}
+}
@@ -0,0 +1,40 @@
+#ifndef PAYLOAD_EXTRACT_STREAM_DECOMPRESS_H
+#define PAYLOAD_EXTRACT_STREAM_DECOMPRESS_H
+
+#include <cinttypes>
+#include <memory>
+
+#include "payload/HttpDownload.h"
+
+namespace skkk {
+	/**
+	 * Incremental decoder fed with compressed data as it is downloaded, the output
+	 * goes straight to dest. Decode errors are latched and reported by finish(),
+	 * write() keeps accepting data so a bad stream does not abort the download.
+	 */
+	class StreamDecompress : public DataSink {
+		protected:
+			uint8_t *dest = nullptr;
+			uint64_t destSize = 0;
+			int err = 0;
+
+		public:
+			StreamDecompress(uint8_t *dest, uint64_t destSize)
+				: dest(dest),
+				  destSize(destSize) {
+			}
+
+			/**
+			 * @return 0 if the stream ended and dest is filled, negative errno otherwise
+			 */
+			virtual int finish() = 0;
+
+			static std::unique_ptr<StreamDecompress> createBzip(uint8_t *dest, uint64_t destSize);
+
+			static std::unique_ptr<StreamDecompress> createXz(uint8_t *dest, uint64_t destSize);
+
+			static std::unique_ptr<StreamDecompress> createZstd(uint8_t *dest, uint64_t destSize);
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_STREAM_DECOMPRESS_H
@@ -1,3 +1,7 @@
+#include <algorithm>
+#include <format>
+#include <list>
+
 #include "payload/LogBase.h"
 #include "payload/httpDownloadImpl/CprHttpDownload.h"
 #include "payload/httpDownloadImpl/HttpUtils.h"
@@ -33,6 +37,7 @@ namespace skkk {
 		session.SetLowSpeed(lowSpeed);
 		session.SetAcceptEncoding(cpr::AcceptEncoding{"disabled"});
 		session.SetConnectionPool(connectionPool);
+		curl_easy_setopt(session.GetCurlHolder()->handle, CURLOPT_TCP_KEEPALIVE, 1L);
 		if (startsWithIgnoreCase(cprUrl.c_str(), "https")) {
 			session.SetVerifySsl(sslVerification);
 			if (sslVerification) {
@@ -59,16 +64,102 @@ namespace skkk {
 	void CprHttpDownload::setUrl(const std::string &url) {
 		std::string tmp{url};
 		strTrim(tmp);
+		std::lock_guard lock{urlMutex};
 		this->cprUrl = tmp;
+		++urlVersion;
+	}
+
+	class CprThreadSession {
+		public:
+			uint64_t ownerId = 0;
+			uint64_t urlVersion = 0;
+			std::unique_ptr<cpr::Session> session;
+	};
+
+	cpr::Session &CprHttpDownload::getSession() const {
+		// Most recently used first, a worker may serve several instances, e.g. the mirrors
+		// of one payload or the jobs of a daemon on a shared pool
+		thread_local std::list<CprThreadSession> sessions;
+		std::lock_guard lock{urlMutex};
+		auto it = std::ranges::find(sessions, id, &CprThreadSession::ownerId);
+		if (it == sessions.end()) {
+			auto &ts = sessions.emplace_front(id, urlVersion, std::make_unique<cpr::Session>());
+			initSession(*ts.session);
+			++sessionCount;
+			// Sessions of instances no longer used by this thread
+			while (sessions.size() > MAX_THREAD_SESSIONS) {
+				sessions.pop_back();
+			}
+		} else {
+			sessions.splice(sessions.begin(), sessions, it);
+		}
+		auto &ts = sessions.front();
+		if (ts.urlVersion != urlVersion) {
+			// A new url of the same host keeps using the open connection
+			ts.session->SetUrl(cprUrl);
+			ts.urlVersion = urlVersion;
+		}
+		return *ts.session;
+	}
+
+	void CprHttpDownload::updateStats(cpr::Session &session) const {
+		CURL *curl = session.GetCurlHolder()->handle;
+		long numConnects = 0;
+		curl_off_t appConnectTime = 0;
+		++requestCount;
+		if (curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &numConnects) == CURLE_OK) {
+			if (numConnects > 0) {
+				connectCount += numConnects;
+			} else {
+				++reuseCount;
+			}
+		}
+		// Only a transfer that did a TLS handshake has an app connect time
+		if (curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &appConnectTime) == CURLE_OK &&
+		    appConnectTime > 0) {
+			++tlsHandshakeCount;
+		}
+	}
+
+	std::string CprHttpDownload::getStats() const {
+		return std::format("requests: {} sessions: {} connects: {} reused: {} tls handshakes: {}",
+		                   requestCount.load(), sessionCount.load(), connectCount.load(), reuseCount.load(),
+		                   tlsHandshakeCount.load());
 	}
 
 	uint64_t CprHttpDownload::getFileSize() const {
-		cpr::Session session;
-		initSession(session);
+		auto &session = getSession();
+		CURL *curl = session.GetCurlHolder()->handle;
+		// The session is shared with range requests, reset what a HEAD request leaves behind
+		curl_easy_setopt(curl, CURLOPT_RANGE, nullptr);
 		uint64_t fileSize = session.GetDownloadFileLength();
+		curl_easy_setopt(curl, CURLOPT_NOBODY, 0L);
+		curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+		updateStats(session);
 		return fileSize > 0 ? fileSize : 0;
 	}
 
+	std::string CprHttpDownload::getValidator() const {
+		auto &session = getSession();
+		CURL *curl = session.GetCurlHolder()->handle;
+		curl_easy_setopt(curl, CURLOPT_RANGE, nullptr);
+		const auto &r = session.Head();
+		curl_easy_setopt(curl, CURLOPT_NOBODY, 0L);
+		curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+		updateStats(session);
+		if (r.status_code != 200) {
+			return {};
+		}
+		// A weak ETag does not guarantee identical bytes, Last-Modified is used instead
+		if (auto it = r.header.find("ETag"); it != r.header.end() && !it->second.starts_with("W/")) {
+			return it->second;
+		}
+		if (auto it = r.header.find("Last-Modified"); it != r.header.end()) {
+			return it->second;
+		}
+		return {};
+	}
+
 	static bool writeDataStr(const std::string_view &data, intptr_t userdata) {
 		auto *dst = reinterpret_cast<std::string *>(userdata);
 		*dst += data;
@@ -76,14 +167,14 @@ namespace skkk {
 	}
 
 	std::tuple<bool, long> CprHttpDownload::download(std::string &data, uint64_t offset, uint64_t length) const {
-		cpr::Session session;
-		initSession(session);
+		auto &session = getSession();
 		session.SetRange(cpr::Range{offset, offset + length - 1});
 
 		const auto &r = session.Download(cpr::WriteCallback{
 			writeDataStr,
 			reinterpret_cast<intptr_t>(&data)
 		});
+		updateStats(session);
 		if (r.status_code == 206 && r.error.code == cpr::ErrorCode::OK &&
 		    r.downloaded_bytes == length) {
 			return {true, r.status_code};;
@@ -100,14 +191,14 @@ namespace skkk {
 	}
 
 	std::tuple<bool, long> CprHttpDownload::download(FileBuffer &fb, uint64_t offset, uint64_t length) const {
-		cpr::Session session;
-		initSession(session);
+		auto &session = getSession();
 		session.SetRange(cpr::Range{offset, offset + length - 1});
 
 		const auto &r = session.Download(cpr::WriteCallback{
 			writeDataFb,
 			reinterpret_cast<intptr_t>(&fb)
 		});
+		updateStats(session);
 		if (r.status_code == 206 && r.error.code == cpr::ErrorCode::OK &&
 		    r.downloaded_bytes == length) {
 			return {true, r.status_code};
@@ -118,8 +209,7 @@ namespace skkk {
 
 	std::tuple<bool, long> CprHttpDownload::download(FileBuffer &fb, uint64_t fbDataOffset, uint64_t offset,
 	                                                 uint64_t length) const {
-		cpr::Session session;
-		initSession(session);
+		auto &session = getSession();
 		session.SetRange(cpr::Range{offset, offset + length - 1});
 
 		uint8_t *backDataPtr = fb.data;
@@ -129,6 +219,7 @@ namespace skkk {
 			reinterpret_cast<intptr_t>(&fb)
 		});
 		fb.data = backDataPtr;
+		updateStats(session);
 
 		if (r.status_code == 206 && r.error.code == cpr::ErrorCode::OK &&
 		    r.downloaded_bytes == length) {
@@ -137,4 +228,63 @@ namespace skkk {
 		LOGCD("download failed hc={} msg={}", r.status_code, r.error.message);
 		return {false, r.status_code};;
 	}
+
+	class ScatterWriter {
+		public:
+			const std::vector<ScatterSegment> &segments;
+			const std::atomic_bool *cancel = nullptr;
+			size_t index = 0;
+			uint64_t segmentOffset = 0;
+
+		public:
+			ScatterWriter(const std::vector<ScatterSegment> &segments, const std::atomic_bool *cancel)
+				: segments(segments),
+				  cancel(cancel) {
+			}
+	};
+
+	static bool writeDataScatter(const std::string_view &data, intptr_t userdata) {
+		auto *w = reinterpret_cast<ScatterWriter *>(userdata);
+		if (w->cancel && *w->cancel) return false;
+		const char *src = data.data();
+		uint64_t remaining = data.size();
+		while (remaining > 0) {
+			if (w->index >= w->segments.size()) return false;
+			const auto &segment = w->segments[w->index];
+			const uint64_t len = std::min(remaining, segment.length - w->segmentOffset);
+			if (segment.data) {
+				memcpy(segment.data + w->segmentOffset, src, len);
+			} else if (segment.sink && !segment.sink->write(reinterpret_cast<const uint8_t *>(src), len)) {
+				return false;
+			}
+			src += len;
+			remaining -= len;
+			w->segmentOffset += len;
+			if (w->segmentOffset == segment.length) {
+				w->index++;
+				w->segmentOffset = 0;
+			}
+		}
+		return true;
+	}
+
+	std::tuple<bool, long> CprHttpDownload::downloadScatter(const std::vector<ScatterSegment> &segments,
+	                                                        uint64_t offset, uint64_t length,
+	                                                        const std::atomic_bool *cancel) const {
+		auto &session = getSession();
+		session.SetRange(cpr::Range{offset, offset + length - 1});
+
+		ScatterWriter writer{segments, cancel};
+		const auto &r = session.Download(cpr::WriteCallback{
+			writeDataScatter,
+			reinterpret_cast<intptr_t>(&writer)
+		});
+		updateStats(session);
+		if (r.status_code == 206 && r.error.code == cpr::ErrorCode::OK &&
+		    r.downloaded_bytes == length) {
+			return {true, r.status_code};
+		}
+		LOGCD("download failed hc={} msg={}", r.status_code, r.error.message);
+		return {false, r.status_code};
+	}
 }
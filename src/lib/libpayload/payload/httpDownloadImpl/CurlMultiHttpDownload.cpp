@@ -0,0 +1,238 @@
+#if defined(ENABLE_HTTP2)
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <future>
+
+#include "payload/LogBase.h"
+#include "payload/Utils.h"
+#include "payload/httpDownloadImpl/CurlMultiHttpDownload.h"
+
+namespace skkk {
+	class CurlMultiRequest {
+		public:
+			uint64_t offset = 0;
+			uint64_t length = 0;
+			// Either data or str receives the body
+			uint8_t *data = nullptr;
+			std::string *str = nullptr;
+			uint64_t written = 0;
+			CURLcode result = CURLE_OK;
+			long statusCode = 0;
+			std::promise<void> done;
+
+		public:
+			CurlMultiRequest(uint64_t offset, uint64_t length, uint8_t *data, std::string *str)
+				: offset(offset),
+				  length(length),
+				  data(data),
+				  str(str) {
+			}
+	};
+
+	static void initCurlGlobal() {
+		// Once per process and never cleaned up, other instances and cpr sessions may be live on any thread
+		static const CURLcode ret = [] {
+			const CURLcode code = curl_global_init(CURL_GLOBAL_DEFAULT);
+			if (code != CURLE_OK) LOGCE("HTTP/2: curl_global_init failed: {}", static_cast<int>(code));
+			return code;
+		}();
+		(void) ret;
+	}
+
+	CurlMultiHttpDownload::CurlMultiHttpDownload(const std::string &url, bool sslVerification,
+	                                             uint32_t maxStreams, uint32_t maxConnections)
+		: CprHttpDownload(url, sslVerification),
+		  maxStreams(std::max<uint32_t>(maxStreams, 1)),
+		  maxConnections(std::max<uint32_t>(maxConnections, 1)) {
+		initCurlGlobal();
+		multiUrl = url;
+		userAgent = cprHeader["User-Agent"];
+
+		// TLS sessions and DNS are shared by all handles, only the event loop uses them
+		share = curl_share_init();
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+
+		multi = curl_multi_init();
+		curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+		curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>(this->maxConnections));
+		curl_multi_setopt(multi, CURLMOPT_MAX_CONCURRENT_STREAMS, static_cast<long>(this->maxStreams));
+		eventThread = std::thread(&CurlMultiHttpDownload::eventLoop, this);
+		LOGCD("HTTP/2: streams={} connections={}", this->maxStreams, this->maxConnections);
+	}
+
+	CurlMultiHttpDownload::~CurlMultiHttpDownload() {
+		{
+			std::lock_guard lock{queueMutex};
+			isStopping = true;
+		}
+		curl_multi_wakeup(multi);
+		if (eventThread.joinable()) eventThread.join();
+		for (CURL *curl: idleHandles) {
+			curl_easy_cleanup(curl);
+		}
+		curl_multi_cleanup(multi);
+		curl_share_cleanup(share);
+	}
+
+	void CurlMultiHttpDownload::setUrl(const std::string &url) {
+		CprHttpDownload::setUrl(url);
+		std::string tmp{url};
+		strTrim(tmp);
+		std::lock_guard lock{multiUrlMutex};
+		multiUrl = tmp;
+	}
+
+	static size_t writeRequestData(char *ptr, size_t size, size_t nmemb, void *userdata) {
+		auto *request = static_cast<CurlMultiRequest *>(userdata);
+		const size_t len = size * nmemb;
+		// A server ignoring the range would overflow the target
+		if (request->written + len > request->length) return 0;
+		if (request->str) {
+			request->str->append(ptr, len);
+		} else {
+			memcpy(request->data + request->written, ptr, len);
+		}
+		request->written += len;
+		return len;
+	}
+
+	void CurlMultiHttpDownload::initHandle(CURL *curl, CurlMultiRequest &request) {
+		std::string url;
+		{
+			std::lock_guard lock{multiUrlMutex};
+			url = multiUrl;
+		}
+		const std::string range = std::format("{}-{}", request.offset, request.offset + request.length - 1);
+
+		curl_easy_reset(curl);
+		curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+		curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+		curl_easy_setopt(curl, CURLOPT_USERAGENT, userAgent.c_str());
+		curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+		curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+		curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+		// Wait for a multiplexed connection instead of opening a new one
+		curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+		curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+		curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, 5000L);
+		curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1024L * 10);
+		curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 5L);
+		curl_easy_setopt(curl, CURLOPT_SHARE, share);
+		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeRequestData);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &request);
+		curl_easy_setopt(curl, CURLOPT_PRIVATE, &request);
+		if (startsWithIgnoreCase(url, "https")) {
+			curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, sslVerification ? 1L : 0L);
+			curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, sslVerification ? 2L : 0L);
+			if (sslVerification) {
+#if defined(__linux__)
+				if (CA_BUNDLE != "NONE") {
+					curl_easy_setopt(curl, CURLOPT_CAINFO, CA_BUNDLE.c_str());
+				}
+				if (CA_PATH != "NONE") {
+					curl_easy_setopt(curl, CURLOPT_CAPATH, CA_PATH.c_str());
+				}
+#elif !defined(__ANDROID__)
+				curl_easy_setopt(curl, CURLOPT_SSL_OPTIONS, CURLSSLOPT_NATIVE_CA);
+#endif
+			}
+		}
+	}
+
+	void CurlMultiHttpDownload::eventLoop() {
+		uint32_t activeStreams = 0;
+		std::vector<CurlMultiRequest *> starting;
+
+		while (true) {
+			{
+				std::lock_guard lock{queueMutex};
+				if (isStopping && pendingRequests.empty() && activeStreams == 0) break;
+				while (activeStreams + starting.size() < maxStreams && !pendingRequests.empty()) {
+					starting.emplace_back(pendingRequests.front());
+					pendingRequests.pop_front();
+				}
+			}
+			for (auto *request: starting) {
+				CURL *curl = nullptr;
+				if (!idleHandles.empty()) {
+					curl = idleHandles.back();
+					idleHandles.pop_back();
+				} else {
+					curl = curl_easy_init();
+				}
+				initHandle(curl, *request);
+				curl_multi_add_handle(multi, curl);
+				activeStreams++;
+			}
+			starting.clear();
+
+			int stillRunning = 0, msgsInQueue = 0;
+			curl_multi_perform(multi, &stillRunning);
+			while (CURLMsg *msg = curl_multi_info_read(multi, &msgsInQueue)) {
+				if (msg->msg != CURLMSG_DONE) continue;
+				CURL *curl = msg->easy_handle;
+				CurlMultiRequest *request = nullptr;
+				long numConnects = 0, httpVersion = 0;
+				curl_easy_getinfo(curl, CURLINFO_PRIVATE, reinterpret_cast<char **>(&request));
+				request->result = msg->data.result;
+				curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &request->statusCode);
+				if (curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &numConnects) == CURLE_OK) {
+					multiConnectCount += numConnects;
+				}
+				if (curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &httpVersion) == CURLE_OK &&
+				    httpVersion == CURL_HTTP_VERSION_2_0) {
+					++http2Count;
+				}
+				++streamCount;
+				curl_multi_remove_handle(multi, curl);
+				idleHandles.emplace_back(curl);
+				activeStreams--;
+				request->done.set_value();
+			}
+			curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+		}
+	}
+
+	std::tuple<bool, long> CurlMultiHttpDownload::submit(CurlMultiRequest &request) const {
+		auto done = request.done.get_future();
+		{
+			std::lock_guard lock{queueMutex};
+			pendingRequests.emplace_back(&request);
+		}
+		curl_multi_wakeup(multi);
+		done.wait();
+
+		if (request.result == CURLE_OK && request.statusCode == 206 && request.written == request.length) {
+			return {true, request.statusCode};
+		}
+		LOGCD("HTTP/2: download failed hc={} msg={}", request.statusCode, curl_easy_strerror(request.result));
+		return {false, request.statusCode};
+	}
+
+	std::tuple<bool, long> CurlMultiHttpDownload::download(std::string &data, uint64_t offset,
+	                                                       uint64_t length) const {
+		CurlMultiRequest request{offset, length, nullptr, &data};
+		return submit(request);
+	}
+
+	std::tuple<bool, long> CurlMultiHttpDownload::download(FileBuffer &fb, uint64_t offset, uint64_t length) const {
+		return download(fb, 0, offset, length);
+	}
+
+	std::tuple<bool, long> CurlMultiHttpDownload::download(FileBuffer &fb, uint64_t fbDataOffset, uint64_t offset,
+	                                                       uint64_t length) const {
+		CurlMultiRequest request{offset, length, fb.data + fbDataOffset + fb.offset, nullptr};
+		const auto ret = submit(request);
+		fb.offset += request.written;
+		return ret;
+	}
+
+	std::string CurlMultiHttpDownload::getStats() const {
+		return std::format("streams: {} connects: {} http2: {} | {}",
+		                   streamCount.load(), multiConnectCount.load(), http2Count.load(),
+		                   CprHttpDownload::getStats());
+	}
+}
+#endif
@@ -0,0 +1,442 @@
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <print>
+
+#include "common/LogProgress.h"
+#include "common/TaskGroup.h"
+#include "common/threadpool.h"
+#include "payload/FileWriter.h"
+#include "payload/LogBase.h"
+#include "payload/Utils.h"
+#include "payload/common/io.h"
+#include "payload/mman/mmap.hpp"
+#include "payload/update_metadata.pb.h"
+#include "payload/verify/ImageVerifier.h"
+
+#include "RsEncoder.h"
+#include "VerityTasks.h"
+#include "ecc.h"
+#include "sha256Utils.h"
+
+using namespace chromeos_update_engine;
+
+namespace skkk {
+	ImageVerifier::ImageVerifier(const std::shared_ptr<PayloadInfo> &payloadInfo,
+	                             const std::vector<PartitionInfo> &partitions, const ExtractConfig &config)
+		: payloadInfo(payloadInfo),
+		  partitions(partitions),
+		  config(config) {
+	}
+
+#define PRINT_PROGRESS_CHECK_FMT \
+	BLUE_BOLD("CHECK  :   ") "%s" \
+	GREEN2_BOLD(" [ ") RED2("%2d%%") GREEN2_BOLD(" ]") \
+	"\r"
+
+	/**
+	 * Check state of one partition, tasks of a stage count down pendingTasks
+	 * and the last one starts the next stage.
+	 */
+	class ImageVerifierPartitionContext {
+		public:
+			const PartitionInfo &partInfo;
+			VerifyInfo info;
+			bool hasHashTree = false;
+			bool hasFec = false;
+			uint64_t hashTreeTaskNum = 0;
+			uint64_t fecTaskRounds = 0;
+			uint64_t fecTaskNum = 0;
+			std::unique_ptr<RsEncoder> encoder;
+
+			int fd = -1;
+			const uint8_t *data = nullptr;
+			uint64_t dataSize = 0;
+			int inFd = -1;
+			const uint8_t *inData = nullptr;
+			uint64_t inDataSize = 0;
+
+			std::atomic_uint64_t pendingTasks = 0;
+			uint64_t totalProgress = 0;
+			std::atomic_uint64_t reportedProgress = 0;
+
+			std::atomic_bool isHashMatched = false;
+			// Operations needing the old image when it is not available
+			std::atomic_uint64_t uncheckedOps = 0;
+			std::atomic_uint64_t failedOps = 0;
+			std::mutex mutex;
+			std::vector<BadBlockRange> badRanges;
+			std::string errMsg;
+			bool ret = false;
+
+		public:
+			explicit ImageVerifierPartitionContext(const PartitionInfo &partInfo)
+				: partInfo(partInfo),
+				  info(partInfo) {
+			}
+
+			void addBadRange(int type, uint64_t startBlock, uint64_t numBlocks) {
+				std::lock_guard lock{mutex};
+				badRanges.emplace_back(type, startBlock, numBlocks);
+			}
+	};
+
+	class ImageVerifierGraph {
+		public:
+			const ExtractConfig &config;
+			const uint8_t *payloadData;
+			const FileWriter &fileWriter;
+			TaskGroup partitionsGroup;
+			std::atomic_int progress = 0;
+			// Destroyed first, so no task is running once the group is gone
+			std::threadpool tp;
+
+			ImageVerifierGraph(const ExtractConfig &config, const uint8_t *payloadData,
+			                   const FileWriter &fileWriter, uint32_t threadNum)
+				: config(config),
+				  payloadData(payloadData),
+				  fileWriter(fileWriter),
+				  tp(threadNum) {
+			}
+	};
+
+	static void addProgress(ImageVerifierGraph &graph, ImageVerifierPartitionContext &ctx, uint64_t count) {
+		ctx.reportedProgress += count;
+		graph.progress += static_cast<int>(count);
+	}
+
+	/**
+	 * Compare unitCount units of unitSize bytes, runs of differing units are reported
+	 * as one range, unit i covers blocksPerUnit blocks from firstBlock + i * blocksPerUnit.
+	 */
+	static void compareUnits(ImageVerifierPartitionContext &ctx, int type, const uint8_t *expected,
+	                         const uint8_t *actual, uint64_t unitCount, uint64_t unitSize,
+	                         uint64_t firstBlock, uint64_t blocksPerUnit) {
+		uint64_t runStart = 0, runLength = 0;
+		for (uint64_t i = 0; i < unitCount; i++) {
+			if (memcmp(expected + i * unitSize, actual + i * unitSize, unitSize) != 0) {
+				if (runLength == 0) runStart = i;
+				runLength++;
+				continue;
+			}
+			if (runLength > 0) {
+				ctx.addBadRange(type, firstBlock + runStart * blocksPerUnit, runLength * blocksPerUnit);
+				runLength = 0;
+			}
+		}
+		if (runLength > 0) {
+			ctx.addBadRange(type, firstBlock + runStart * blocksPerUnit, runLength * blocksPerUnit);
+		}
+	}
+
+	static bool isSourceOperation(uint32_t type) {
+		return type == InstallOperation_Type_SOURCE_COPY ||
+		       type == InstallOperation_Type_SOURCE_BSDIFF ||
+		       type == InstallOperation_Type_BROTLI_BSDIFF ||
+		       type == InstallOperation_Type_PUFFDIFF ||
+		       type == InstallOperation_Type_ZUCCHINI ||
+		       type == InstallOperation_Type_LZ4DIFF_BSDIFF ||
+		       type == InstallOperation_Type_LZ4DIFF_PUFFDIFF;
+	}
+
+	/**
+	 * The operation is replayed into a scratch buffer and compared with its dst extents.
+	 */
+	static void checkOperationTask(const ImageVerifierGraph &graph, ImageVerifierPartitionContext &ctx,
+	                               const FileOperation &operation) {
+		const auto blockSize = ctx.partInfo.blockSize;
+		if (isSourceOperation(operation.type) && !ctx.inData) {
+			++ctx.uncheckedOps;
+			return;
+		}
+		std::vector<uint8_t> dstData(operation.dstTotalLength);
+		if (graph.fileWriter.writeDataToBuffer(graph.payloadData, ctx.inData, dstData.data(), operation)) {
+			++ctx.failedOps;
+			return;
+		}
+		const auto *expected = dstData.data();
+		for (const auto &dst: operation.dstExtents) {
+			if (dst.dataOffset + dst.dataLength > ctx.dataSize) {
+				ctx.addBadRange(BAD_RANGE_DATA, dst.dataOffset / blockSize, dst.dataLength / blockSize);
+			} else {
+				compareUnits(ctx, BAD_RANGE_DATA, expected, ctx.data + dst.dataOffset,
+				             dst.dataLength / blockSize, blockSize, dst.dataOffset / blockSize, 1);
+			}
+			expected += dst.dataLength;
+		}
+	}
+
+	static void checkHashTreeDataTask(ImageVerifierPartitionContext &ctx, uint64_t block, uint64_t blockCount) {
+		const auto &info = ctx.info;
+		const auto &topLevel = info.topHashLevel;
+		const uint64_t hashPos = block * SHA256_DIGEST_SIZE;
+		std::vector<uint8_t> hashData(blockCount * SHA256_DIGEST_SIZE);
+		const VerifyWriterHashTreeContext htCtx{
+			info, ctx.data + info.hashTreeDataExtentOffset, block * info.blockSize, 0, hashData.data(), blockCount
+		};
+		sha256HashTreeTopLevelTask(htCtx);
+		compareUnits(ctx, BAD_RANGE_HASH_TREE_DATA, hashData.data(), ctx.data + topLevel.hashOffset + hashPos,
+		             blockCount, SHA256_DIGEST_SIZE, ctx.partInfo.hashTreeDataExtent.dataOffset / ctx.partInfo.blockSize + block, 1);
+	}
+
+	/**
+	 * Every stored upper level is hashed from the stored level below it, the root is not
+	 * stored in the image.
+	 */
+	static void checkHashTreeLevelsTask(ImageVerifierPartitionContext &ctx) {
+		const auto &info = ctx.info;
+		const auto blockSize = info.blockSize;
+		const auto hashTreeSaltSize = info.hashTreeSalt.size();
+		const uint64_t SALT_VERIFY_SIZE = blockSize + hashTreeSaltSize;
+		std::vector<uint8_t> origData(SALT_VERIFY_SIZE);
+		auto *sha256Data = origData.data();
+		auto *readData = sha256Data + hashTreeSaltSize;
+		uint8_t hash[SHA256_DIGEST_SIZE] = {};
+		const auto *preLevel = &info.topHashLevel;
+		memcpy(sha256Data, info.hashTreeSalt.data(), hashTreeSaltSize);
+
+		for (const auto &level: info.hashLevels) {
+			const auto *preHashData = ctx.data + preLevel->hashOffset;
+			const auto *hashData = ctx.data + level.hashOffset;
+			uint64_t hashPos = 0;
+			for (uint64_t readPos = 0; readPos < preLevel->totalHashSize; readPos += blockSize) {
+				memcpy(readData, preHashData + readPos, blockSize);
+				if (!sha256(sha256Data, SALT_VERIFY_SIZE, hash) ||
+				    !sha256Equal(hash, hashData + hashPos, SHA256_DIGEST_SIZE)) {
+					ctx.addBadRange(BAD_RANGE_HASH_TREE, (level.hashOffset + hashPos) / blockSize, 1);
+				}
+				hashPos += SHA256_DIGEST_SIZE;
+			}
+			preLevel = &level;
+		}
+	}
+
+	static void checkFecTask(ImageVerifierPartitionContext &ctx, uint64_t roundsStart, uint64_t roundsEnd) {
+		const auto &info = ctx.info;
+		const uint64_t roundSize = info.blockSize * info.fecRoots;
+		std::vector<uint8_t> fecData((roundsEnd - roundsStart) * roundSize);
+		VerifyWriterFecContext fecCtx{info, *ctx.encoder, fecData.data(), ctx.data, roundsStart, roundsEnd};
+		encodeFecTask(fecCtx);
+		compareUnits(ctx, BAD_RANGE_FEC, fecData.data(), ctx.data + info.fecDataOffset + roundsStart * roundSize,
+		             roundsEnd - roundsStart, roundSize,
+		             info.fecDataOffset / info.blockSize + roundsStart * info.fecRoots, info.fecRoots);
+	}
+
+	static void finishPartitionTask(ImageVerifierGraph &graph, ImageVerifierPartitionContext &ctx) {
+		unmap(ctx.data, ctx.dataSize);
+		unmap(ctx.inData, ctx.inDataSize);
+		closeFd(ctx.fd);
+		closeFd(ctx.inFd);
+		ctx.encoder.reset();
+
+		// Adjacent ranges of the same type are reported as one
+		auto &badRanges = ctx.badRanges;
+		std::ranges::sort(badRanges, [](const BadBlockRange &a, const BadBlockRange &b) {
+			return a.type != b.type ? a.type < b.type : a.startBlock < b.startBlock;
+		});
+		std::vector<BadBlockRange> merged;
+		for (const auto &range: badRanges) {
+			if (!merged.empty() && merged.back().type == range.type &&
+			    merged.back().startBlock + merged.back().numBlocks >= range.startBlock) {
+				auto &last = merged.back();
+				last.numBlocks = std::max(last.startBlock + last.numBlocks,
+				                          range.startBlock + range.numBlocks) - last.startBlock;
+			} else {
+				merged.emplace_back(range);
+			}
+		}
+		badRanges = std::move(merged);
+
+		ctx.ret = ctx.errMsg.empty() && badRanges.empty() && ctx.failedOps == 0 &&
+		          (ctx.isHashMatched || ctx.partInfo.newHash.empty());
+		// Skipped stages still count, the shared progress has to reach its total
+		addProgress(graph, ctx, ctx.totalProgress - ctx.reportedProgress);
+		graph.partitionsGroup.done();
+	}
+
+	static void checkOperationsStage(ImageVerifierGraph &graph, ImageVerifierPartitionContext &ctx) {
+		const auto &operations = ctx.partInfo.operations;
+		if (ctx.isHashMatched || operations.empty()) {
+			finishPartitionTask(graph, ctx);
+			return;
+		}
+		// Only an image that fails its hash is checked per operation, to locate the bad blocks
+		ctx.pendingTasks = operations.size();
+		for (const auto &operation: operations) {
+			graph.tp.commit2([&graph, &ctx, &operation] {
+				checkOperationTask(graph, ctx, operation);
+				addProgress(graph, ctx, 1);
+				if (ctx.pendingTasks.fetch_sub(1) == 1) {
+					finishPartitionTask(graph, ctx);
+				}
+			});
+		}
+	}
+
+	static void commitCheckTask(ImageVerifierGraph &graph, ImageVerifierPartitionContext &ctx, auto &&task) {
+		graph.tp.commit2([&graph, &ctx, task] {
+			task();
+			addProgress(graph, ctx, 1);
+			if (ctx.pendingTasks.fetch_sub(1) == 1) {
+				checkOperationsStage(graph, ctx);
+			}
+		});
+	}
+
+	static void startPartitionTask(ImageVerifierGraph &graph, ImageVerifierPartitionContext &ctx) {
+		int ret = 0;
+		const auto &partInfo = ctx.partInfo;
+		const auto &info = ctx.info;
+		uint64_t taskNum = 1;
+
+		ret = mapRdByPath(ctx.fd, partInfo.outFilePath, ctx.data, ctx.dataSize);
+		if (ret) {
+			ctx.errMsg = std::format("open '{}' fail: {}", partInfo.outFilePath, strerror(abs(ret)));
+			finishPartitionTask(graph, ctx);
+			return;
+		}
+		if (ctx.dataSize < partInfo.size) {
+			ctx.errMsg = std::format("size {} is smaller than {}", ctx.dataSize, partInfo.size);
+			finishPartitionTask(graph, ctx);
+			return;
+		}
+		if ((ctx.hasHashTree || ctx.hasFec) && !isVerifyExtentValid(info, ctx.dataSize)) {
+			ctx.hasHashTree = ctx.hasFec = false;
+			ctx.errMsg = "hash tree or FEC extent out of image";
+		}
+		if (graph.config.isIncremental && !partInfo.oldFilePath.empty()) {
+			// Without the old image source operations are left unchecked
+			mapRdByPath(ctx.inFd, partInfo.oldFilePath, ctx.inData, ctx.inDataSize);
+		}
+
+		if (ctx.hasHashTree) taskNum += ctx.hashTreeTaskNum + 1;
+		if (ctx.hasFec) taskNum += ctx.fecTaskNum;
+		ctx.pendingTasks = taskNum;
+
+		commitCheckTask(graph, ctx, [&ctx, &partInfo] {
+			uint8_t hash[SHA256_DIGEST_SIZE] = {};
+			ctx.isHashMatched = partInfo.newHash.size() == SHA256_DIGEST_SIZE &&
+			                    sha256(ctx.data, partInfo.size, hash) &&
+			                    sha256Equal(hash, reinterpret_cast<const uint8_t *>(partInfo.newHash.data()),
+			                                SHA256_DIGEST_SIZE);
+		});
+		if (ctx.hasHashTree) {
+			const auto blockCount = info.topHashLevel.blockCount;
+			for (uint64_t block = 0; block < blockCount; block += HASH_TREE_CHUNK_BLOCKS) {
+				const uint64_t count = std::min<uint64_t>(HASH_TREE_CHUNK_BLOCKS, blockCount - block);
+				commitCheckTask(graph, ctx, [&ctx, block, count] {
+					checkHashTreeDataTask(ctx, block, count);
+				});
+			}
+			commitCheckTask(graph, ctx, [&ctx] {
+				checkHashTreeLevelsTask(ctx);
+			});
+		}
+		if (ctx.hasFec) {
+			for (uint64_t start = 0; start < info.fecRounds; start += ctx.fecTaskRounds) {
+				const uint64_t end = std::min(start + ctx.fecTaskRounds, info.fecRounds);
+				commitCheckTask(graph, ctx, [&ctx, start, end] {
+					checkFecTask(ctx, start, end);
+				});
+			}
+		}
+	}
+
+	static void initPartitionContext(ImageVerifierPartitionContext &ctx, uint32_t threadNum) {
+		auto &info = ctx.info;
+		ctx.hasHashTree = info.hasHashTreeDataExtent && info.initHashTreeLevel();
+		if (ctx.hasHashTree) {
+			ctx.hashTreeTaskNum = divRoundUp(info.topHashLevel.blockCount, HASH_TREE_CHUNK_BLOCKS);
+		}
+		if (info.hasFecDataExtent && info.fecRounds > 0 &&
+		    info.fecDataSize == fec_ecc_get_data_size(info.fecDataExtentSize, info.fecRoots)) {
+			ctx.encoder = std::make_unique<RsEncoder>(info.fecRoots);
+			ctx.hasFec = ctx.encoder->isValid();
+		}
+		if (ctx.hasFec) {
+			ctx.fecTaskRounds = roundUp(divRoundUp(info.fecRounds, threadNum), FEC_CHUNK_ROUNDS);
+			ctx.fecTaskNum = divRoundUp(info.fecRounds, ctx.fecTaskRounds);
+		}
+		ctx.totalProgress = 1 + ctx.partInfo.operations.size() +
+		                    (ctx.hasHashTree ? ctx.hashTreeTaskNum + 1 : 0) +
+		                    (ctx.hasFec ? ctx.fecTaskNum : 0);
+	}
+
+	static const char *getBadRangeTypeName(int type) {
+		switch (type) {
+			case BAD_RANGE_DATA:
+				return "data";
+			case BAD_RANGE_HASH_TREE_DATA:
+				return "hash tree data";
+			case BAD_RANGE_HASH_TREE:
+				return "hash tree";
+			case BAD_RANGE_FEC:
+				return "fec";
+			default:
+				return "unknown";
+		}
+	}
+
+	static void printCheckResult(const ImageVerifierPartitionContext &ctx) {
+		std::println(BLUE_BOLD("Check  : ") "{:18s}" BLUE_BOLD(" result: ") "{}",
+		             ctx.partInfo.name, ctx.ret ? GREEN2_BOLD("success") : RED2("fail"));
+		if (!ctx.errMsg.empty()) {
+			std::println("         {}", ctx.errMsg);
+		}
+		if (!ctx.isHashMatched && !ctx.partInfo.newHash.empty() && ctx.errMsg.empty()) {
+			std::println("         partition hash mismatch");
+		}
+		if (ctx.uncheckedOps > 0) {
+			std::println("         {} source operations unchecked, the old image is not available",
+			             ctx.uncheckedOps.load());
+		}
+		if (ctx.failedOps > 0) {
+			std::println("         {} operations could not be replayed", ctx.failedOps.load());
+		}
+		for (const auto &range: ctx.badRanges) {
+			std::println("         " RED2("{:15s}") " blocks [{}, {})",
+			             getBadRangeTypeName(range.type), range.startBlock, range.startBlock + range.numBlocks);
+		}
+	}
+
+	bool ImageVerifier::verifyPartitions() const {
+		bool ret = true;
+		uint64_t totalProgress = 0;
+		const uint32_t threadNum = std::max<uint32_t>(config.threadNum, 1);
+		const FileWriter fw{config.httpDownload, nullptr, config.retryPolicy};
+		std::vector<std::unique_ptr<ImageVerifierPartitionContext> > ctxs;
+
+		for (const auto &partInfo: partitions) {
+			auto &ctx = ctxs.emplace_back(std::make_unique<ImageVerifierPartitionContext>(partInfo));
+			initPartitionContext(*ctx, threadNum);
+			totalProgress += ctx->totalProgress;
+		}
+		if (ctxs.empty()) return false;
+
+		// wait
+		{
+			ImageVerifierGraph graph{config, payloadInfo->getPayloadData(), fw, threadNum};
+			graph.partitionsGroup.add(ctxs.size());
+			for (auto &ctx: ctxs) {
+				graph.tp.commit2([&graph, ctx = ctx.get()] {
+					startPartitionTask(graph, *ctx);
+				});
+			}
+			if (!config.isSilent) {
+				progressMT(PRINT_PROGRESS_CHECK_FMT, std::format("{:18}", std::format("{} partitions", ctxs.size())),
+				           totalProgress, graph.progress, true);
+			}
+			graph.partitionsGroup.wait();
+		}
+
+		for (const auto &ctx: ctxs) {
+			printCheckResult(*ctx);
+			ret &= ctx->ret;
+		}
+		return ret;
+	}
+}
@@ -0,0 +1,285 @@
+#include <cstring>
+
+#include "RsEncoder.h"
+#include "ecc.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RS_ENCODER_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define RS_ENCODER_NEON
+#endif
+
+namespace skkk {
+	static constexpr uint32_t GF_SIZE = FEC_RSM + 1;
+	static constexpr uint32_t GF_POLY = 0x11d;
+
+	class GaloisField {
+		public:
+			uint8_t alphaTo[GF_SIZE] = {};
+			uint8_t indexOf[GF_SIZE] = {};
+
+		public:
+			GaloisField() {
+				uint32_t sr = 1;
+				for (uint32_t i = 0; i < FEC_RSM; i++) {
+					indexOf[sr] = i;
+					alphaTo[i] = sr;
+					sr <<= 1;
+					if (sr & GF_SIZE) sr ^= GF_POLY;
+					sr &= FEC_RSM;
+				}
+			}
+
+			uint8_t mul(uint8_t a, uint8_t b) const {
+				if (a == 0 || b == 0) return 0;
+				return alphaTo[(indexOf[a] + indexOf[b]) % FEC_RSM];
+			}
+	};
+
+	static const GaloisField &getGaloisField() {
+		static const GaloisField gf;
+		return gf;
+	}
+
+#if defined(RS_ENCODER_X86) && defined(__SSSE3__)
+#define RS_ENCODER_HAS_SSSE3
+#endif
+
+	/**
+	 * Scatter the parity vectors of `lanes` codewords: vectors[t][k] -> parity[k * roots + t].
+	 */
+	static inline void storeParity(const uint8_t *vectors, uint32_t lanes, uint32_t roots, uint8_t *parity) {
+		for (uint32_t k = 0; k < lanes; k++) {
+			for (uint32_t t = 0; t < roots; t++) {
+				parity[k * roots + t] = vectors[t * lanes + k];
+			}
+		}
+	}
+
+#if defined(RS_ENCODER_HAS_SSSE3)
+	static uint64_t encodeSsse3(const uint8_t *nibbleTables, uint32_t roots, uint32_t rsn,
+	                            const uint8_t *const *blocks, uint64_t count, uint8_t *parity) {
+		constexpr uint32_t lanes = sizeof(__m128i);
+		const __m128i mask = _mm_set1_epi8(0x0f);
+		__m128i lo[RsEncoder::MAX_ROOTS], hi[RsEncoder::MAX_ROOTS], p[RsEncoder::MAX_ROOTS];
+		alignas(16) uint8_t out[RsEncoder::MAX_ROOTS * lanes];
+		const uint32_t last = roots - 1;
+		uint64_t k = 0;
+
+		for (uint32_t t = 0; t < roots; t++) {
+			lo[t] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(nibbleTables + t * 32));
+			hi[t] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(nibbleTables + t * 32 + 16));
+		}
+		for (; k + lanes <= count; k += lanes) {
+			for (uint32_t t = 0; t < roots; t++) p[t] = _mm_setzero_si128();
+			for (uint32_t j = 0; j < rsn; j++) {
+				__m128i fb = p[0];
+				if (blocks[j]) {
+					fb = _mm_xor_si128(fb, _mm_loadu_si128(reinterpret_cast<const __m128i *>(blocks[j] + k)));
+				}
+				const __m128i l = _mm_and_si128(fb, mask);
+				const __m128i h = _mm_and_si128(_mm_srli_epi64(fb, 4), mask);
+				for (uint32_t t = 0; t < last; t++) {
+					p[t] = _mm_xor_si128(p[t + 1], _mm_xor_si128(_mm_shuffle_epi8(lo[t], l),
+					                                             _mm_shuffle_epi8(hi[t], h)));
+				}
+				p[last] = _mm_xor_si128(_mm_shuffle_epi8(lo[last], l), _mm_shuffle_epi8(hi[last], h));
+			}
+			for (uint32_t t = 0; t < roots; t++) {
+				_mm_store_si128(reinterpret_cast<__m128i *>(out + t * lanes), p[t]);
+			}
+			storeParity(out, lanes, roots, parity + k * roots);
+		}
+		return k;
+	}
+#endif
+
+#if defined(RS_ENCODER_X86)
+	__attribute__((target("avx2")))
+	static uint64_t encodeAvx2(const uint8_t *nibbleTables, uint32_t roots, uint32_t rsn,
+	                           const uint8_t *const *blocks, uint64_t count, uint8_t *parity) {
+		constexpr uint32_t lanes = sizeof(__m256i);
+		const __m256i mask = _mm256_set1_epi8(0x0f);
+		__m256i lo[RsEncoder::MAX_ROOTS], hi[RsEncoder::MAX_ROOTS], p[RsEncoder::MAX_ROOTS];
+		alignas(32) uint8_t out[RsEncoder::MAX_ROOTS * lanes];
+		const uint32_t last = roots - 1;
+		uint64_t k = 0;
+
+		for (uint32_t t = 0; t < roots; t++) {
+			lo[t] = _mm256_broadcastsi128_si256(
+				_mm_loadu_si128(reinterpret_cast<const __m128i *>(nibbleTables + t * 32)));
+			hi[t] = _mm256_broadcastsi128_si256(
+				_mm_loadu_si128(reinterpret_cast<const __m128i *>(nibbleTables + t * 32 + 16)));
+		}
+		for (; k + lanes <= count; k += lanes) {
+			for (uint32_t t = 0; t < roots; t++) p[t] = _mm256_setzero_si256();
+			for (uint32_t j = 0; j < rsn; j++) {
+				__m256i fb = p[0];
+				if (blocks[j]) {
+					fb = _mm256_xor_si256(fb, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(blocks[j] + k)));
+				}
+				const __m256i l = _mm256_and_si256(fb, mask);
+				const __m256i h = _mm256_and_si256(_mm256_srli_epi64(fb, 4), mask);
+				for (uint32_t t = 0; t < last; t++) {
+					p[t] = _mm256_xor_si256(p[t + 1], _mm256_xor_si256(_mm256_shuffle_epi8(lo[t], l),
+					                                                   _mm256_shuffle_epi8(hi[t], h)));
+				}
+				p[last] = _mm256_xor_si256(_mm256_shuffle_epi8(lo[last], l), _mm256_shuffle_epi8(hi[last], h));
+			}
+			for (uint32_t t = 0; t < roots; t++) {
+				_mm256_store_si256(reinterpret_cast<__m256i *>(out + t * lanes), p[t]);
+			}
+			storeParity(out, lanes, roots, parity + k * roots);
+		}
+		return k;
+	}
+
+	__attribute__((target("avx512f,avx512bw")))
+	static uint64_t encodeAvx512(const uint8_t *nibbleTables, uint32_t roots, uint32_t rsn,
+	                             const uint8_t *const *blocks, uint64_t count, uint8_t *parity) {
+		constexpr uint32_t lanes = sizeof(__m512i);
+		const __m512i mask = _mm512_set1_epi8(0x0f);
+		__m512i lo[RsEncoder::MAX_ROOTS], hi[RsEncoder::MAX_ROOTS], p[RsEncoder::MAX_ROOTS];
+		alignas(64) uint8_t out[RsEncoder::MAX_ROOTS * lanes];
+		const uint32_t last = roots - 1;
+		uint64_t k = 0;
+
+		for (uint32_t t = 0; t < roots; t++) {
+			lo[t] = _mm512_broadcast_i32x4(
+				_mm_loadu_si128(reinterpret_cast<const __m128i *>(nibbleTables + t * 32)));
+			hi[t] = _mm512_broadcast_i32x4(
+				_mm_loadu_si128(reinterpret_cast<const __m128i *>(nibbleTables + t * 32 + 16)));
+		}
+		for (; k + lanes <= count; k += lanes) {
+			for (uint32_t t = 0; t < roots; t++) p[t] = _mm512_setzero_si512();
+			for (uint32_t j = 0; j < rsn; j++) {
+				__m512i fb = p[0];
+				if (blocks[j]) {
+					fb = _mm512_xor_si512(fb, _mm512_loadu_si512(blocks[j] + k));
+				}
+				const __m512i l = _mm512_and_si512(fb, mask);
+				const __m512i h = _mm512_and_si512(_mm512_srli_epi64(fb, 4), mask);
+				for (uint32_t t = 0; t < last; t++) {
+					p[t] = _mm512_xor_si512(p[t + 1], _mm512_xor_si512(_mm512_shuffle_epi8(lo[t], l),
+					                                                   _mm512_shuffle_epi8(hi[t], h)));
+				}
+				p[last] = _mm512_xor_si512(_mm512_shuffle_epi8(lo[last], l), _mm512_shuffle_epi8(hi[last], h));
+			}
+			for (uint32_t t = 0; t < roots; t++) {
+				_mm512_store_si512(out + t * lanes, p[t]);
+			}
+			storeParity(out, lanes, roots, parity + k * roots);
+		}
+		return k;
+	}
+#endif
+
+#if defined(RS_ENCODER_NEON)
+	static uint64_t encodeNeon(const uint8_t *nibbleTables, uint32_t roots, uint32_t rsn,
+	                           const uint8_t *const *blocks, uint64_t count, uint8_t *parity) {
+		constexpr uint32_t lanes = sizeof(uint8x16_t);
+		const uint8x16_t mask = vdupq_n_u8(0x0f);
+		uint8x16_t lo[RsEncoder::MAX_ROOTS], hi[RsEncoder::MAX_ROOTS], p[RsEncoder::MAX_ROOTS];
+		alignas(16) uint8_t out[RsEncoder::MAX_ROOTS * lanes];
+		const uint32_t last = roots - 1;
+		uint64_t k = 0;
+
+		for (uint32_t t = 0; t < roots; t++) {
+			lo[t] = vld1q_u8(nibbleTables + t * 32);
+			hi[t] = vld1q_u8(nibbleTables + t * 32 + 16);
+		}
+		for (; k + lanes <= count; k += lanes) {
+			for (uint32_t t = 0; t < roots; t++) p[t] = vdupq_n_u8(0);
+			for (uint32_t j = 0; j < rsn; j++) {
+				uint8x16_t fb = p[0];
+				if (blocks[j]) {
+					fb = veorq_u8(fb, vld1q_u8(blocks[j] + k));
+				}
+				const uint8x16_t l = vandq_u8(fb, mask);
+				const uint8x16_t h = vshrq_n_u8(fb, 4);
+				for (uint32_t t = 0; t < last; t++) {
+					p[t] = veorq_u8(p[t + 1], veorq_u8(vqtbl1q_u8(lo[t], l), vqtbl1q_u8(hi[t], h)));
+				}
+				p[last] = veorq_u8(vqtbl1q_u8(lo[last], l), vqtbl1q_u8(hi[last], h));
+			}
+			for (uint32_t t = 0; t < roots; t++) {
+				vst1q_u8(out + t * lanes, p[t]);
+			}
+			storeParity(out, lanes, roots, parity + k * roots);
+		}
+		return k;
+	}
+#endif
+
+	RsEncoder::RsEncoder(uint32_t roots)
+		: roots(roots) {
+		if (!isValid()) return;
+		const auto &gf = getGaloisField();
+		rsn = FEC_RSM - roots;
+
+		// Generator polynomial, first root 0, primitive element 1 (see FEC_PARAMS)
+		uint8_t genpoly[GF_SIZE] = {1};
+		for (uint32_t i = 0; i < roots; i++) {
+			genpoly[i + 1] = 1;
+			for (uint32_t j = i; j > 0; j--) {
+				genpoly[j] = genpoly[j - 1] ^ gf.mul(genpoly[j], gf.alphaTo[i]);
+			}
+			genpoly[0] = gf.mul(genpoly[0], gf.alphaTo[i]);
+		}
+
+		// Parity position t is updated with feedback * genpoly[roots - 1 - t]
+		nibbleTables.resize(roots * 32);
+		mulTables.resize(roots * GF_SIZE);
+		for (uint32_t t = 0; t < roots; t++) {
+			const uint8_t coef = genpoly[roots - 1 - t];
+			for (uint32_t n = 0; n < 16; n++) {
+				nibbleTables[t * 32 + n] = gf.mul(coef, n);
+				nibbleTables[t * 32 + 16 + n] = gf.mul(coef, n << 4);
+			}
+			for (uint32_t n = 0; n < GF_SIZE; n++) {
+				mulTables[t * GF_SIZE + n] = gf.mul(coef, n);
+			}
+		}
+
+#if defined(RS_ENCODER_X86)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512bw")) {
+			kernel = encodeAvx512;
+		} else if (__builtin_cpu_supports("avx2")) {
+			kernel = encodeAvx2;
+		}
+#if defined(RS_ENCODER_HAS_SSSE3)
+		else {
+			kernel = encodeSsse3;
+		}
+#endif
+#elif defined(RS_ENCODER_NEON)
+		kernel = encodeNeon;
+#endif
+	}
+
+	void RsEncoder::encode(const uint8_t *const *blocks, uint64_t count, uint8_t *parity) const {
+		const uint32_t last = roots - 1;
+		uint8_t p[MAX_ROOTS] = {};
+		uint64_t k = 0;
+
+		if (kernel) {
+			k = kernel(nibbleTables.data(), roots, rsn, blocks, count, parity);
+		}
+		// Remaining codewords
+		for (; k < count; k++) {
+			memset(p, 0, roots);
+			for (uint32_t j = 0; j < rsn; j++) {
+				const uint8_t fb = (blocks[j] ? blocks[j][k] : 0) ^ p[0];
+				const uint8_t *mul = mulTables.data();
+				for (uint32_t t = 0; t < last; t++, mul += GF_SIZE) {
+					p[t] = p[t + 1] ^ mul[fb];
+				}
+				p[last] = mul[fb];
+			}
+			memcpy(parity + k * roots, p, roots);
+		}
+	}
+}
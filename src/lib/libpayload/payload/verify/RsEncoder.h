@@ -0,0 +1,52 @@
+#ifndef PAYLOAD_EXTRACT_RSENCODER_H
+#define PAYLOAD_EXTRACT_RSENCODER_H
+
+#include <cinttypes>
+#include <vector>
+
+namespace skkk {
+	/**
+	 * RS(255, 255 - roots) encoder over GF(2^8), compatible with fec_rs
+	 * init_rs_char(FEC_PARAMS(roots)) + encode_rs_char.
+	 *
+	 * Codewords are encoded column-wise: symbol j of codeword k is blocks[j][k],
+	 * so many interleaved codewords are encoded per vector instruction.
+	 * Constant multiplies use split nibble tables (SSSE3/AVX2/AVX-512BW, NEON).
+	 */
+	class RsEncoder {
+		public:
+			static constexpr uint32_t MAX_ROOTS = 64;
+
+		private:
+			uint32_t roots = 0;
+			uint32_t rsn = 0;
+			// Low/high nibble product tables, 32 bytes per parity position
+			std::vector<uint8_t> nibbleTables;
+			// Full product tables, 256 bytes per parity position
+			std::vector<uint8_t> mulTables;
+
+			using encodeKernelPtr = uint64_t (*)(const uint8_t *nibbleTables, uint32_t roots, uint32_t rsn,
+			                                     const uint8_t *const *blocks, uint64_t count, uint8_t *parity);
+			encodeKernelPtr kernel = nullptr;
+
+		public:
+			explicit RsEncoder(uint32_t roots);
+
+			uint32_t getRoots() const { return roots; }
+
+			uint32_t getRsn() const { return rsn; }
+
+			bool isValid() const { return roots > 0 && roots <= MAX_ROOTS; }
+
+			/**
+			 * Encode `count` interleaved codewords.
+			 *
+			 * @param blocks rsn pointers, symbol j of codeword k is blocks[j][k], nullptr is all zero
+			 * @param count number of codewords
+			 * @param parity parity of codeword k is written to parity[k * roots, (k + 1) * roots)
+			 */
+			void encode(const uint8_t *const *blocks, uint64_t count, uint8_t *parity) const;
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_RSENCODER_H
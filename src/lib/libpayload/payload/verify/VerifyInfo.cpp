@@ -1,3 +1,4 @@
+#include <ranges>
 #include <string>
 
 #include "payload/PartitionInfo.h"
@@ -12,8 +13,6 @@ namespace skkk {
 		realHashSize = blockCount * SHA256_DIGEST_SIZE;
 		totalHashSize = alignUp(realHashSize, blockSize);
 		paddingSize = totalHashSize - realHashSize;
-		data.resize(totalHashSize, 0);
-		hashData = data.data();
 	}
 
 	VerifyInfo::VerifyInfo(const PartitionInfo &partInfo) {
@@ -34,7 +33,41 @@ namespace skkk {
 		fecRoots = partInfo.fecRoots;
 		fecRsn = FEC_RSM - fecRoots;
 		fecRounds = divRoundUp(fecDataExtentSize / blockSize, fecRsn);
-		fecData.resize(fecDataSize, 0);
+	}
+
+	/**
+	 * Only the level sizes and their offsets in the hash tree extent are computed here.
+	 * The extent is laid out from the level below the root down to the data level.
+	 */
+	bool VerifyInfo::initHashTreeLevel() {
+		topHashLevel = {hashTreeDataExtentSize, static_cast<uint32_t>(blockSize)};
+		hashLevels.clear();
+		uint64_t blockCount = topHashLevel.blockCount;
+		uint64_t totalHashTotal = topHashLevel.totalHashSize;
+		uint64_t totalCalcCount = blockCount;
+		uint64_t levelsSize = topHashLevel.totalHashSize;
+		if (blockCount == 0) return false;
+		while (blockCount != 1) {
+			const auto &level = hashLevels.emplace_back(totalHashTotal, blockSize);
+			blockCount = level.blockCount;
+			totalHashTotal = level.totalHashSize;
+			totalCalcCount += blockCount;
+			levelsSize += level.totalHashSize;
+		}
+		hashTreeTotalProgress = totalCalcCount;
+		if (hashLevels.empty()) return false;
+		rootHashLevel = hashLevels.back();
+		hashLevels.pop_back();
+		levelsSize -= rootHashLevel.totalHashSize;
+		if (levelsSize > hashTreeDataSize) return false;
+
+		uint64_t hashOffset = hashTreeDataOffset;
+		for (auto &level: std::ranges::reverse_view(hashLevels)) {
+			level.hashOffset = hashOffset;
+			hashOffset += level.totalHashSize;
+		}
+		topHashLevel.hashOffset = hashOffset;
+		return true;
 	}
 
 	bool VerifyInfo::checkCalcHashTreeSuccessful() const {
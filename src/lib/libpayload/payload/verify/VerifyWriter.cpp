@@ -1,8 +1,10 @@
+#include <atomic>
 #include <cinttypes>
+#include <memory>
 #include <print>
-#include <ranges>
 
 #include "common/LogProgress.h"
+#include "common/TaskGroup.h"
 #include "common/threadpool.h"
 #include "payload/ExtractConfig.h"
 #include "payload/LogBase.h"
@@ -11,32 +13,20 @@
 #include "payload/mman/mmap.hpp"
 #include "payload/verify/VerifyWriter.h"
 
+#include "RsEncoder.h"
+#include "VerityTasks.h"
 #include "ecc.h"
 #include "sha256Utils.h"
 
-extern "C" {
-#include "fec.h"
-}
-
 namespace skkk {
-	enum FMT_TYPE {
-		HASH_TREE_FMT = 0,
-		FEC_FMT
-	};
-
 	VerifyWriter::VerifyWriter(const std::vector<PartitionInfo> &partitions,
 	                           const ExtractConfig &config)
 		: partitions(partitions),
 		  config(config) {
 	}
 
-#define PRINT_PROGRESS_HASH_FMT \
-	BLUE_BOLD("HASH :   ") "%s" \
-	GREEN2_BOLD(" [ ") RED2("%2d%%") GREEN2_BOLD(" ]") \
-	"\r"
-
-#define PRINT_PROGRESS_FEC_FMT \
-	BLUE_BOLD("FEC  :   ") "%s" \
+#define PRINT_PROGRESS_VERIFY_FMT \
+	BLUE_BOLD("VERIFY :   ") "%s" \
 	GREEN2_BOLD(" [ ") RED2("%2d%%") GREEN2_BOLD(" ]") \
 	"\r"
 
@@ -45,120 +35,32 @@ namespace skkk {
 		return format;
 	}
 
-	static void printProgressMT(bool isSilent, const std::string &partName, int fmtType, uint64_t totalSize,
-	                            const std::atomic_int &progress, bool hasEnter) {
-		if (!isSilent) {
-			const char *fmt;
-			switch (fmtType) {
-				case HASH_TREE_FMT:
-					fmt = PRINT_PROGRESS_HASH_FMT;
-					break;
-				case FEC_FMT:
-					fmt = PRINT_PROGRESS_FEC_FMT;
-					break;
-				default:
-					fmt = PRINT_PROGRESS_HASH_FMT;
-			}
-			std::string tag = getPrintMsg(partName);
-			progressMT(fmt, tag,
-			           totalSize, progress, hasEnter);
-		}
-	}
-
-	void VerifyWriter::initHashTreeLevel() {
-		for (const auto &partInfo: partitions) {
-			if (partInfo.hasHashTreeDataExtent) {
-				auto &verifyInfo = verifyInfos.emplace_back(partInfo);
-				auto &topLevel = verifyInfo.topHashLevel;
-				topLevel = {verifyInfo.hashTreeDataExtentSize, partInfo.blockSize};
-				uint64_t blockCount = topLevel.blockCount;
-				uint64_t totalHashTotal = topLevel.totalHashSize;
-				uint64_t totalCalcCount = blockCount;
-				while (blockCount != 1) {
-					const auto &level = verifyInfo.hashLevels.emplace_back(totalHashTotal, partInfo.blockSize);
-					blockCount = level.blockCount;
-					totalHashTotal = level.totalHashSize;
-					totalCalcCount += blockCount;
-				}
-				verifyInfo.hashTreeTotalProgress = totalCalcCount;
-			}
-		}
-	}
-
-	static void sha256HashTreeTopLevelTask(const VerifyWriterHashTreeContext &ctx) {
-		int ret = -1;
-		const auto &info = ctx.verifyInfo;
-		const auto &excSize = info.hashTreeExcSize;
-		const auto &calcProgress = info.hashTreeProgress;
-		const auto hashTreeSalt = info.hashTreeSalt.data();
-		const auto readFilePos = ctx.readFilePos;
-		const auto writeHashPos = ctx.writeHashPos;
-		auto *hashData = ctx.hashData;
-		const auto blockSize = info.blockSize;
-		const auto hashTreeSaltSize = info.hashTreeSalt.size();
-		const auto SALT_VERIFY_SIZE = blockSize + hashTreeSaltSize;
-		std::vector<uint8_t> origData(SALT_VERIFY_SIZE);
-		auto *sha256Data = origData.data();
-		auto *readData = sha256Data + hashTreeSaltSize;
-
-		memcpy(sha256Data, hashTreeSalt, hashTreeSaltSize);
-		ret = memcpy(readData, ctx.inData + readFilePos, blockSize) == readData ? 0 : -EIO;
-		if (ret) goto exit;
-		if (!sha256(sha256Data, SALT_VERIFY_SIZE, hashData + writeHashPos)) {
-			ret = -EIO;
-		}
-
-	exit:
-		if (ret) ++*excSize;
-		++*calcProgress;
-	}
-
-	bool VerifyWriter::handleHashTreeDataByInfo(const VerifyInfo &info) const {
-		int ret = 0, inFd = -1;
-		uint64_t readPos = 0, writeHashPos = 0;
-		std::future<void> progressThread;
+	/**
+	 * Upper levels are hashed from the level below, already in the image, the root level last.
+	 *
+	 * @return number of hashed blocks
+	 */
+	static uint64_t sha256HashTreeUpperLevels(const VerifyInfo &info, uint8_t *data) {
+		uint64_t readPos = 0, writeHashPos = 0, hashedBlocks = 0;
 		const auto &currentProgress = info.hashTreeProgress;
 		const auto &hashTreeExcSize = info.hashTreeExcSize;
-		auto &levels = info.hashLevels;
+		const auto &levels = info.hashLevels;
 		const auto &topLevel = info.topHashLevel;
 		const auto *preLevel = &topLevel;
-		auto &rootLevel = info.rootHashLevel;
-		auto *preHashData = preLevel->hashData;
+		const auto *preHashData = data + topLevel.hashOffset;
 		const auto blockSize = info.blockSize;
 		const auto hashTreeSaltSize = info.hashTreeSalt.size();
 		const uint64_t SALT_VERIFY_SIZE = blockSize + hashTreeSaltSize;
 		std::vector<uint8_t> origData(SALT_VERIFY_SIZE);
 		auto *sha256Data = origData.data();
 		auto *readData = sha256Data + hashTreeSaltSize;
-		uint64_t inDataSize = 0;
-		const uint8_t *inData = nullptr;
 		memcpy(sha256Data, info.hashTreeSalt.data(), hashTreeSaltSize);
 
-		ret = mapRdByPath(inFd, info.outFilePath, inData, inDataSize);
-		if (ret) {
-			goto exit;
-		}
-
-		// wait
-		{
-			progressThread = std::async(std::launch::async, printProgressMT, config.isSilent, info.name,
-			                            HASH_TREE_FMT, info.hashTreeTotalProgress, std::ref(*currentProgress),
-			                            true);
-			std::vector<VerifyWriterHashTreeContext> ctxs;
-			ctxs.reserve(topLevel.blockCount);
-			std::threadpool tp{config.threadNum};
-			while (readPos < info.hashTreeDataExtentSize) {
-				auto &ctx = ctxs.emplace_back(info, inData, readPos,
-				                              writeHashPos, preHashData);
-				tp.commit(sha256HashTreeTopLevelTask, std::ref(ctx));
-				readPos += blockSize;
-				writeHashPos += SHA256_DIGEST_SIZE;
-			}
-		}
-
-		readPos = writeHashPos = 0;
-		for (const auto &level: levels) {
-			auto *hashData = level.hashData;
+		memset(data + topLevel.hashOffset + topLevel.realHashSize, 0, topLevel.paddingSize);
+		for (size_t i = 0; i <= levels.size(); i++) {
+			const bool isRoot = i == levels.size();
+			const auto &level = isRoot ? info.rootHashLevel : levels[i];
+			auto *hashData = isRoot ? info.rootHash.data() : data + level.hashOffset;
 			while (readPos < preLevel->totalHashSize) {
 				memcpy(readData, preHashData + readPos, blockSize);
 				if (!sha256(sha256Data, SALT_VERIFY_SIZE, hashData + writeHashPos)) {
@@ -167,170 +69,199 @@ namespace skkk {
 				readPos += blockSize;
 				writeHashPos += SHA256_DIGEST_SIZE;
 				++*currentProgress;
+				++hashedBlocks;
 			}
+			if (!isRoot) memset(hashData + level.realHashSize, 0, level.paddingSize);
 			readPos = writeHashPos = 0;
 			preLevel = &level;
-			preHashData = level.hashData;
+			preHashData = hashData;
 		}
-		rootLevel = levels.back();
-		levels.pop_back();
-		std::ranges::reverse(levels);
-		levels.emplace_back(topLevel);
-
-	exit:
-		if (progressThread.valid()) progressThread.wait();
-		if (ret) ++*hashTreeExcSize;
-		unmap(inData, inDataSize);
-		closeFd(inFd);
-		return info.checkCalcHashTreeSuccessful();
+		return hashedBlocks;
 	}
 
-	bool VerifyWriter::updateHashTreeByInfo(const VerifyInfo &info) {
-		bool ret = -1;
-		int outFd = openFileRW(info.outFilePath);
-		if (outFd > 0) {
-			const auto &levels = info.hashLevels;
-			uint64_t hashPos = info.hashTreeDataOffset;
-			for (const auto &level: levels) {
-				ret = blobWrite(outFd, level.hashData, hashPos,
-				                level.totalHashSize);
-				if (ret) {
-					goto exit;
-				}
-				hashPos += level.totalHashSize;
-			}
-		}
-	exit:
-		closeFd(outFd);
-		return !ret;
+	static void printVerifyResult(const std::string &name, int ret) {
+		std::println(BLUE_BOLD("Verify : ") "{:18s}" BLUE_BOLD(" result: ") "{}",
+		             name, ret ? GREEN2_BOLD("success") : RED2("fail"));
 	}
 
+
 	/**
-	 * Reference: https://android.googlesource.com/platform/system/update_engine/+/refs/heads/main/payload_consumer/verity_writer_android.cc#328
-	 *
-	 * @param ctx
+	 * Verity state of one partition, it only lives until the partition is written back.
 	 */
-	static void encodeFecTask(const VerifyWriterFecContext &ctx) {
-		int ret = -1;
-		const auto &info = ctx.verifyInfo;
-		auto &currentProgress = info.fecProgress;
-		auto &fecExcSize = info.fecExcSize;
-		const auto fecRoots = info.fecRoots;
-		const auto fecRsn = info.fecRsn;
-		const auto dataSize = info.fecDataExtentSize;
-		const auto blockSize = info.blockSize;
-		const auto *inData = ctx.inData;
-		const auto roundsIdx = ctx.roundsIdx;
-		const auto rounds = info.fecRounds;
-		const auto dataOffset = info.fecDataExtentOffset;
-		const auto fecWriteOffset = roundsIdx * blockSize * fecRoots;
-		auto *fecData = ctx.fecData;
-		const uint32_t rsBlockSize = blockSize * fecRsn;
+	class VerifyWriterPartitionContext {
+		public:
+			VerifyInfo info;
+			int fd = -1;
+			uint8_t *data = nullptr;
+			uint64_t dataSize = 0;
+			std::unique_ptr<RsEncoder> encoder;
+			std::vector<VerifyWriterHashTreeContext> hashTreeCtxs;
+			std::vector<VerifyWriterFecContext> fecCtxs;
+			// Tasks of the running stage, the last one to finish runs the next stage
+			std::atomic_uint64_t pendingTasks = 0;
+			uint64_t totalProgress = 0;
+			std::atomic_uint64_t reportedProgress = 0;
+			bool ret = false;
+
+			explicit VerifyWriterPartitionContext(const PartitionInfo &partInfo)
+				: info(partInfo) {
+			}
+	};
 
-		std::unique_ptr<void, decltype(&free_rs_char)> rs_char{init_rs_char(FEC_PARAMS(fecRoots)), &free_rs_char};
-		std::vector<uint8_t> rsBlocksData(rsBlockSize);
-		auto *rsBlocks = rsBlocksData.data();
-		std::vector<uint8_t> bufferData(blockSize);
-		auto *buffer = bufferData.data();
+	class VerifyWriterGraph {
+		public:
+			TaskGroup partitionsGroup;
+			std::atomic_int progress = 0;
+			// Destroyed first, so no task is running once the group is gone
+			std::threadpool tp;
 
-		for (size_t j = 0; j < fecRsn; j++) {
-			uint64_t offset =
-					fec_ecc_interleave(roundsIdx * fecRsn * blockSize + j, fecRsn, rounds);
-			if (offset < dataSize) {
-				ret = memcpy(buffer, inData + dataOffset + offset, blockSize) == buffer ? 0 : -EIO;
-				if (ret) {
-					++*fecExcSize;
-					goto exit;
-				}
+			explicit VerifyWriterGraph(uint32_t threadNum)
+				: tp(threadNum) {
 			}
-			for (size_t k = 0; k < blockSize; k++) {
-				rsBlocks[k * fecRsn + j] = buffer[k];
-			}
-			memset(buffer, 0, blockSize);
-		}
-
-		for (size_t j = 0; j < blockSize; j++) {
-			encode_rs_char(rs_char.get(),
-			               rsBlocks + j * fecRsn,
-			               fecData + fecWriteOffset + j * fecRoots);
-		}
+	};
 
-	exit:
-		++*currentProgress;
+	static void addProgress(VerifyWriterGraph &graph, VerifyWriterPartitionContext &ctx, uint64_t count) {
+		ctx.reportedProgress += count;
+		graph.progress += static_cast<int>(count);
 	}
 
+	static void finishPartitionTask(VerifyWriterGraph &graph, VerifyWriterPartitionContext &ctx) {
+		const auto &info = ctx.info;
+		bool hashTreeSuccessful = info.checkCalcHashTreeSuccessful();
+		bool fecSuccessful = info.hasFecDataExtent && info.checkCalcFecSuccessful();
+
+		if (ctx.data && mapSync(ctx.data, ctx.dataSize)) {
+			hashTreeSuccessful = fecSuccessful = false;
+		}
+		unmap(ctx.data, ctx.dataSize);
+		closeFd(ctx.fd);
+		ctx.data = nullptr;
+		ctx.ret = info.hasFecDataExtent ? hashTreeSuccessful && fecSuccessful : hashTreeSuccessful;
+
+		ctx.hashTreeCtxs.clear();
+		ctx.hashTreeCtxs.shrink_to_fit();
+		ctx.fecCtxs.clear();
+		ctx.fecCtxs.shrink_to_fit();
+		ctx.encoder.reset();
+		// Skipped stages still count, the shared progress has to reach its total
+		addProgress(graph, ctx, ctx.totalProgress - ctx.reportedProgress);
+		graph.partitionsGroup.done();
+	}
 
-	bool VerifyWriter::handleFecDataByInfo(const VerifyInfo &info) const {
-		int ret = 0, inFd = -1;
-		const auto fecDataSize = info.fecDataSize;
-		const auto fecRoots = info.fecRoots;
+	static void startFecTask(VerifyWriterGraph &graph, VerifyWriterPartitionContext &ctx, uint32_t threadNum) {
+		const auto &info = ctx.info;
 		const auto fecRounds = info.fecRounds;
-		const auto &currentProgress = info.fecProgress;
-		auto &fecExcSize = info.fecExcSize;
-		const uint8_t *inData = nullptr;
-		uint64_t inDataSize = 0;
 
-		ret = mapRdByPath(inFd, info.outFilePath, inData, inDataSize);
-		if (ret) {
-			goto exit;
+		if (info.fecDataSize != fec_ecc_get_data_size(info.fecDataExtentSize, info.fecRoots)) {
+			finishPartitionTask(graph, ctx);
+			return;
+		}
+		ctx.encoder = std::make_unique<RsEncoder>(info.fecRoots);
+		if (!ctx.encoder->isValid() || fecRounds == 0) {
+			++*info.fecExcSize;
+			finishPartitionTask(graph, ctx);
+			return;
 		}
 
-		if (fecDataSize == fec_ecc_get_data_size(info.fecDataExtentSize, fecRoots)) {
-			//wait
-			{
-				std::vector<VerifyWriterFecContext> ctxs;
-				ctxs.reserve(fecRounds);
-				std::threadpool tp{config.threadNum};
-				for (int i = 0; i < fecRounds; i++) {
-					auto &ctx = ctxs.emplace_back(info, const_cast<uint8_t *>(info.fecData.data()), inData, i);
-					tp.commit(encodeFecTask, std::ref(ctx));
+		// Contiguous ranges of rounds, whole chunks each
+		const uint64_t taskRounds = roundUp(divRoundUp(fecRounds, threadNum), FEC_CHUNK_ROUNDS);
+		const uint64_t taskNum = divRoundUp(fecRounds, taskRounds);
+		ctx.fecCtxs.reserve(taskNum);
+		for (uint64_t start = 0; start < fecRounds; start += taskRounds) {
+			ctx.fecCtxs.emplace_back(info, *ctx.encoder,
+			                         ctx.data + info.fecDataOffset + start * info.blockSize * info.fecRoots,
+			                         ctx.data, start, std::min(start + taskRounds, fecRounds));
+		}
+		// Indexed, the last task to finish releases the contexts
+		ctx.pendingTasks = taskNum;
+		for (uint64_t i = 0; i < taskNum; i++) {
+			graph.tp.commit2([&graph, &ctx, &fecCtx = ctx.fecCtxs[i]] {
+				encodeFecTask(fecCtx);
+				addProgress(graph, ctx, fecCtx.roundsEnd - fecCtx.roundsStart);
+				if (ctx.pendingTasks.fetch_sub(1) == 1) {
+					finishPartitionTask(graph, ctx);
 				}
-				printProgressMT(config.isSilent, info.name, FEC_FMT,
-				                fecRounds, std::ref(*currentProgress), true);
-			}
+			});
 		}
-
-	exit:
-		if (ret) ++*fecExcSize;
-		unmap(inData, inDataSize);
-		closeFd(inFd);
-		return info.checkCalcFecSuccessful();
 	}
 
-	bool VerifyWriter::updateFecByInfo(const VerifyInfo &info) {
-		int ret = -1, outFd = -1;
-		outFd = openFileRW(info.outFilePath);
-		if (outFd < 0) {
-			goto exit;
+	static void hashUpperLevelsTask(VerifyWriterGraph &graph, VerifyWriterPartitionContext &ctx, uint32_t threadNum) {
+		const auto &info = ctx.info;
+		addProgress(graph, ctx, sha256HashTreeUpperLevels(info, ctx.data));
+		if (info.checkCalcHashTreeSuccessful() && info.hasFecDataExtent) {
+			startFecTask(graph, ctx, threadNum);
+		} else {
+			finishPartitionTask(graph, ctx);
 		}
-		ret = blobWrite(outFd, info.fecData.data(), info.fecDataOffset, info.fecDataSize);
-
-	exit:
-		closeFd(outFd);
-		return !ret;
 	}
 
-	static void printVerifyResult(const std::string &name, int ret) {
-		std::println(BLUE_BOLD("Verify : ") "{:18s}" BLUE_BOLD(" result: ") "{}",
-		             name, ret ? GREEN2_BOLD("success") : RED2("fail"));
+	static void startPartitionTask(VerifyWriterGraph &graph, VerifyWriterPartitionContext &ctx, uint32_t threadNum) {
+		auto &info = ctx.info;
+		const auto &topLevel = info.topHashLevel;
+
+		if (mapRwByPath(ctx.fd, info.outFilePath, ctx.data, ctx.dataSize) ||
+		    !isVerifyExtentValid(info, ctx.dataSize)) {
+			finishPartitionTask(graph, ctx);
+			return;
+		}
+
+		const uint64_t taskNum = divRoundUp(topLevel.blockCount, HASH_TREE_CHUNK_BLOCKS);
+		ctx.hashTreeCtxs.reserve(taskNum);
+		for (uint64_t block = 0; block < topLevel.blockCount; block += HASH_TREE_CHUNK_BLOCKS) {
+			ctx.hashTreeCtxs.emplace_back(info, ctx.data + info.hashTreeDataExtentOffset,
+			                              block * info.blockSize, block * SHA256_DIGEST_SIZE,
+			                              ctx.data + topLevel.hashOffset,
+			                              std::min<uint64_t>(HASH_TREE_CHUNK_BLOCKS, topLevel.blockCount - block));
+		}
+		ctx.pendingTasks = taskNum;
+		for (uint64_t i = 0; i < taskNum; i++) {
+			graph.tp.commit2([&graph, &ctx, &htCtx = ctx.hashTreeCtxs[i], threadNum] {
+				sha256HashTreeTopLevelTask(htCtx);
+				addProgress(graph, ctx, htCtx.blockCount);
+				if (ctx.pendingTasks.fetch_sub(1) == 1) {
+					hashUpperLevelsTask(graph, ctx, threadNum);
+				}
+			});
+		}
 	}
 
 	void VerifyWriter::updateVerifyData() const {
-		for (const auto &info: verifyInfos) {
-			bool hashTreeSuccessful = false, fecSuccessful = false;
-			if (handleHashTreeDataByInfo(info)) {
-				if (updateHashTreeByInfo(info)) {
-					hashTreeSuccessful = true;
-				}
+		uint64_t totalProgress = 0;
+		std::vector<std::unique_ptr<VerifyWriterPartitionContext> > ctxs;
+
+		for (const auto &partInfo: partitions) {
+			if (!partInfo.hasHashTreeDataExtent) continue;
+			auto ctx = std::make_unique<VerifyWriterPartitionContext>(partInfo);
+			auto &info = ctx->info;
+			if (!info.initHashTreeLevel()) {
+				printVerifyResult(info.name, false);
+				continue;
 			}
-			if (hashTreeSuccessful && info.hasFecDataExtent) {
-				if (handleFecDataByInfo(info)) {
-					fecSuccessful = updateFecByInfo(info);
-				}
+			ctx->totalProgress = info.hashTreeTotalProgress + (info.hasFecDataExtent ? info.fecRounds : 0);
+			totalProgress += ctx->totalProgress;
+			ctxs.emplace_back(std::move(ctx));
+		}
+		if (ctxs.empty()) return;
+
+		// wait
+		{
+			const uint32_t threadNum = std::max<uint32_t>(config.threadNum, 1);
+			VerifyWriterGraph graph{threadNum};
+			graph.partitionsGroup.add(ctxs.size());
+			for (auto &ctx: ctxs) {
+				graph.tp.commit2([&graph, ctx = ctx.get(), threadNum] {
+					startPartitionTask(graph, *ctx, threadNum);
+				});
+			}
+			if (!config.isSilent) {
+				progressMT(PRINT_PROGRESS_VERIFY_FMT, getPrintMsg(std::format("{} partitions", ctxs.size())),
+				           totalProgress, graph.progress, true);
 			}
-			printVerifyResult(info.name, info.hasFecDataExtent
-				                             ? hashTreeSuccessful && fecSuccessful
-				                             : hashTreeSuccessful);
+			graph.partitionsGroup.wait();
+		}
+
+		for (const auto &ctx: ctxs) {
+			printVerifyResult(ctx->info.name, ctx->ret);
 		}
 	}
 }
@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "payload/Utils.h"
+
+#include "RsEncoder.h"
+#include "VerityTasks.h"
+#include "ecc.h"
+#include "sha256Utils.h"
+
+namespace skkk {
+	void sha256HashTreeTopLevelTask(const VerifyWriterHashTreeContext &ctx) {
+		const auto &info = ctx.verifyInfo;
+		const auto &excSize = info.hashTreeExcSize;
+		const auto &calcProgress = info.hashTreeProgress;
+		const auto hashTreeSalt = info.hashTreeSalt.data();
+		auto *hashData = ctx.hashData;
+		const auto blockSize = info.blockSize;
+		const auto hashTreeSaltSize = info.hashTreeSalt.size();
+		const auto SALT_VERIFY_SIZE = blockSize + hashTreeSaltSize;
+		std::vector<uint8_t> origData(SALT_VERIFY_SIZE);
+		auto *sha256Data = origData.data();
+		auto *readData = sha256Data + hashTreeSaltSize;
+		uint64_t readFilePos = ctx.readFilePos;
+		uint64_t writeHashPos = ctx.writeHashPos;
+
+		memcpy(sha256Data, hashTreeSalt, hashTreeSaltSize);
+		for (uint64_t i = 0; i < ctx.blockCount; i++) {
+			memcpy(readData, ctx.inData + readFilePos, blockSize);
+			if (!sha256(sha256Data, SALT_VERIFY_SIZE, hashData + writeHashPos)) {
+				++*excSize;
+			}
+			readFilePos += blockSize;
+			writeHashPos += SHA256_DIGEST_SIZE;
+		}
+		*calcProgress += ctx.blockCount;
+	}
+
+	/**
+	 * Reference: https://android.googlesource.com/platform/system/update_engine/+/refs/heads/main/payload_consumer/verity_writer_android.cc#328
+	 *
+	 * Round r reads block r of every stripe (stripe j starts at j * rounds * FEC_BLOCKSIZE), so
+	 * consecutive rounds read consecutive blocks. A chunk of rounds is encoded as one run of
+	 * codewords, each stripe is read as a single sequential span.
+	 *
+	 * @param ctx
+	 */
+	void encodeFecTask(VerifyWriterFecContext &ctx) {
+		const auto &info = ctx.verifyInfo;
+		auto &currentProgress = info.fecProgress;
+		const auto fecRoots = info.fecRoots;
+		const auto fecRsn = info.fecRsn;
+		const auto dataSize = info.fecDataExtentSize;
+		const auto blockSize = info.blockSize;
+		const auto *inData = ctx.inData;
+		const auto rounds = info.fecRounds;
+		const auto dataOffset = info.fecDataExtentOffset;
+		auto *fecData = ctx.fecData;
+		auto &rsBlocks = ctx.rsBlocks;
+		auto &tailBlock = ctx.tailBlock;
+
+		rsBlocks.resize(fecRsn);
+		for (uint64_t roundsIdx = ctx.roundsStart; roundsIdx < ctx.roundsEnd; roundsIdx += FEC_CHUNK_ROUNDS) {
+			const uint64_t chunkRounds = std::min<uint64_t>(FEC_CHUNK_ROUNDS, ctx.roundsEnd - roundsIdx);
+			const uint64_t chunkSize = chunkRounds * blockSize;
+			const auto fecWriteOffset = (roundsIdx - ctx.roundsStart) * blockSize * fecRoots;
+
+			for (size_t j = 0; j < fecRsn; j++) {
+				uint64_t offset =
+						fec_ecc_interleave(roundsIdx * fecRsn * blockSize + j, fecRsn, rounds);
+				if (offset + chunkSize <= dataSize) {
+					rsBlocks[j] = inData + dataOffset + offset;
+				} else if (offset < dataSize) {
+					// Only the stripe holding the end of data is partially zero
+					tailBlock.assign(chunkSize, 0);
+					memcpy(tailBlock.data(), inData + dataOffset + offset, dataSize - offset);
+					rsBlocks[j] = tailBlock.data();
+				} else {
+					rsBlocks[j] = nullptr;
+				}
+			}
+			ctx.encoder.encode(rsBlocks.data(), chunkSize, fecData + fecWriteOffset);
+			*currentProgress += chunkRounds;
+		}
+	}
+
+	bool isVerifyExtentValid(const VerifyInfo &info, uint64_t dataSize) {
+		if (info.hashTreeDataExtentOffset + info.hashTreeDataExtentSize > dataSize ||
+		    info.hashTreeDataOffset + info.hashTreeDataSize > dataSize) {
+			return false;
+		}
+		if (info.hasFecDataExtent) {
+			return info.fecDataExtentOffset + info.fecDataExtentSize <= dataSize &&
+			       info.fecDataOffset + info.fecDataSize <= dataSize;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,28 @@
+#ifndef PAYLOAD_EXTRACT_VERITYTASKS_H
+#define PAYLOAD_EXTRACT_VERITYTASKS_H
+
+#include <cinttypes>
+
+#include "payload/verify/VerifyInfo.h"
+#include "payload/verify/VerifyWriter.h"
+
+namespace skkk {
+	// Rounds encoded per FEC chunk, each stripe is read in spans of FEC_CHUNK_ROUNDS blocks
+	static constexpr uint64_t FEC_CHUNK_ROUNDS = 64;
+	// Data blocks hashed per task, 1 MiB of 4 KiB blocks
+	static constexpr uint64_t HASH_TREE_CHUNK_BLOCKS = 256;
+
+	/**
+	 * Hash ctx.blockCount data blocks into ctx.hashData + ctx.writeHashPos.
+	 */
+	void sha256HashTreeTopLevelTask(const VerifyWriterHashTreeContext &ctx);
+
+	/**
+	 * Encode rounds [roundsStart, roundsEnd), parity of roundsStart is written to ctx.fecData.
+	 */
+	void encodeFecTask(VerifyWriterFecContext &ctx);
+
+	bool isVerifyExtentValid(const VerifyInfo &info, uint64_t dataSize);
+}
+
+#endif //PAYLOAD_EXTRACT_VERITYTASKS_H
@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <future>
+
+#include <payload/LogBase.h>
+#include <payload/Utils.h>
+#include <payload/common/io.h>
+
+#include "BatchRunner.h"
+
+namespace skkk {
+	BatchRunner::BatchRunner(int argc, char **argv, const ExtractOperation &eo, ParseOperation parseOperation)
+		: baseArgs(ExtractJob::getBaseArgs(argc, argv, {"--batch"})),
+		  jobListPath(eo.batchPath),
+		  parseOperation(parseOperation) {
+		const uint32_t threadNum = eo.threadNum > 0 ? eo.threadNum : eo.hardwareConcurrency;
+		uint32_t maxInFlight = eo.downloadMaxInFlight;
+		if (maxInFlight == 0) {
+			maxInFlight = std::max<uint32_t>(threadNum * 4, 16);
+		}
+		workerPool = std::make_shared<WorkerPool>(threadNum);
+		downloadPool = std::make_shared<WorkerPool>(maxInFlight);
+	}
+
+	static void splitJobArgs(std::vector<std::string> &args, const std::string &line) {
+		std::string arg;
+		bool isQuoted = false, hasArg = false;
+		for (const char c: line) {
+			if (c == '"') {
+				isQuoted = !isQuoted;
+				hasArg = true;
+			} else if (!isQuoted && (c == ' ' || c == '\t' || c == '\r')) {
+				if (hasArg) args.emplace_back(std::move(arg));
+				arg.clear();
+				hasArg = false;
+			} else {
+				arg += c;
+				hasArg = true;
+			}
+		}
+		if (hasArg) args.emplace_back(std::move(arg));
+	}
+
+	bool BatchRunner::readJobs(std::vector<std::vector<std::string>> &jobs) const {
+		std::vector<std::string> lines;
+		if (!fileExists(jobListPath) || !readAllLines(jobListPath, lines)) {
+			LOGCE("Batch: failed to read job list: '{}'", jobListPath);
+			return false;
+		}
+		for (const auto &line: lines) {
+			std::vector<std::string> args;
+			splitJobArgs(args, line);
+			if (!args.empty() && !args[0].starts_with("#")) {
+				jobs.emplace_back(std::move(args));
+			}
+		}
+		return !jobs.empty();
+	}
+
+	std::unique_ptr<ExtractJob> BatchRunner::prepareJob(const std::vector<std::string> &jobArgs, int &ret) const {
+		auto job = std::make_unique<ExtractJob>();
+		std::vector<std::string> args{baseArgs};
+		args.insert(args.end(), jobArgs.begin(), jobArgs.end());
+		if (job->parse(parseOperation, std::move(args)) != RET_EXTRACT_CONFIG_DONE) {
+			ret = RET_EXTRACT_INIT_FAIL;
+			return job;
+		}
+		if (job->eo.remoteUpdate || !job->eo.batchPath.empty()) {
+			LOGCE("Batch: -R and --batch are not supported in a job");
+			ret = RET_EXTRACT_INIT_FAIL;
+			return job;
+		}
+		job->eo.workerPool = workerPool;
+		job->eo.downloadPool = downloadPool;
+		ret = job->prepare();
+		return job;
+	}
+
+	int BatchRunner::run() {
+		std::vector<std::vector<std::string>> jobs;
+		uint32_t failCount = 0;
+		int ret = RET_EXTRACT_DONE;
+		if (!readJobs(jobs)) {
+			return RET_EXTRACT_INIT_FAIL;
+		}
+
+		using PreparedJob = std::pair<std::unique_ptr<ExtractJob>, int>;
+		auto prepare = [this](const std::vector<std::string> &jobArgs) {
+			int prepareRet = RET_EXTRACT_DONE;
+			auto job = prepareJob(jobArgs, prepareRet);
+			return PreparedJob{std::move(job), prepareRet};
+		};
+		std::future<PreparedJob> next = std::async(std::launch::async, prepare, std::cref(jobs[0]));
+		for (uint64_t i = 0; i < jobs.size(); i++) {
+			auto [job, jobRet] = next.get();
+			if (i + 1 < jobs.size()) {
+				next = std::async(std::launch::async, prepare, std::cref(jobs[i + 1]));
+			}
+			LOGCI(GREEN2_BOLD("Batch: ") "job " RED2("{}") "/{} '{}'", i + 1, jobs.size(),
+			      job->eo.getPayloadPath());
+			if (jobRet == RET_EXTRACT_DONE) {
+				jobRet = job->run(nullptr);
+			}
+			if (jobRet != RET_EXTRACT_DONE) {
+				failCount++;
+				ret = jobRet;
+				LOGCE("Batch: job {} failed ({})", i + 1, jobRet);
+			}
+		}
+		LOGCI(GREEN2_BOLD("Batch: ") RED2("{}") " jobs, " RED2("{}") " failed", jobs.size(), failCount);
+		return ret;
+	}
+}
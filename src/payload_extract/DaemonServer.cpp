@@ -0,0 +1,280 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <format>
+#include <thread>
+#include <sys/stat.h>
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include <payload/LogBase.h>
+#include <payload/common/io.h>
+
+#include "DaemonServer.h"
+#include "JsonLine.h"
+
+namespace skkk {
+	DaemonConnection::DaemonConnection(int fd)
+		: fd(fd) {
+	}
+
+	DaemonConnection::~DaemonConnection() {
+		closeFd(fd);
+	}
+
+	bool DaemonConnection::send(const std::string &line) {
+#if !defined(_WIN32)
+		std::lock_guard lock{writeMutex};
+		const std::string data = line + "\n";
+		uint64_t offset = 0;
+		while (offset < data.size()) {
+			// A client that went away must not kill the daemon with SIGPIPE
+			const ssize_t n = ::send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			offset += n;
+		}
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	DaemonServer::DaemonServer(int argc, char **argv, const ExtractOperation &eo, ParseOperation parseOperation)
+		: baseArgs(ExtractJob::getBaseArgs(argc, argv, {"--daemon", "--daemon-jobs"})),
+		  socketPath(eo.daemonSocketPath),
+		  parseOperation(parseOperation),
+		  maxJobs(std::max<uint32_t>(eo.daemonMaxJobs, 1)) {
+		const uint32_t threadNum = eo.threadNum > 0 ? eo.threadNum : eo.hardwareConcurrency;
+		uint32_t maxInFlight = eo.downloadMaxInFlight;
+		if (maxInFlight == 0) {
+			maxInFlight = std::max<uint32_t>(threadNum * 4, 16);
+		}
+		workerPool = std::make_shared<WorkerPool>(threadNum);
+		downloadPool = std::make_shared<WorkerPool>(maxInFlight);
+	}
+
+	DaemonServer::~DaemonServer() {
+		joinClients(true);
+		if (listenFd >= 0) {
+			closeFd(listenFd);
+			remove(socketPath.c_str());
+		}
+	}
+
+	bool DaemonServer::initSocket() {
+#if !defined(_WIN32)
+		sockaddr_un addr = {};
+		struct stat st = {};
+		if (socketPath.size() >= sizeof(addr.sun_path)) {
+			LOGCE("Daemon: socket path too long: '{}'", socketPath);
+			return false;
+		}
+		// A socket left by a daemon that was killed
+		if (lstat(socketPath.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+			remove(socketPath.c_str());
+		}
+		addr.sun_family = AF_UNIX;
+		memcpy(addr.sun_path, socketPath.c_str(), socketPath.size());
+		listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (listenFd < 0) {
+			LOGCE("Daemon: failed to create socket: {}", strerror(errno));
+			return false;
+		}
+		if (bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) || listen(listenFd, 16)) {
+			LOGCE("Daemon: failed to listen on '{}': {}", socketPath, strerror(errno));
+			closeFd(listenFd);
+			return false;
+		}
+		return true;
+#else
+		LOGCE("Daemon: not supported on this platform");
+		return false;
+#endif
+	}
+
+	int DaemonServer::run() {
+		if (!initSocket()) {
+			return RET_EXTRACT_INIT_FAIL;
+		}
+#if !defined(_WIN32)
+		signal(SIGPIPE, SIG_IGN);
+		LOGCI(GREEN2_BOLD("Daemon: ") "listening on '{}', up to " RED2("{}") " jobs", socketPath, maxJobs);
+		while (true) {
+			const int fd = accept(listenFd, nullptr, nullptr);
+			if (fd < 0) {
+				if (errno == EINTR || errno == ECONNABORTED) continue;
+				LOGCE("Daemon: accept failed: {}", strerror(errno));
+				break;
+			}
+			joinClients(false);
+			auto &client = clients.emplace_back();
+			client.conn = std::make_shared<DaemonConnection>(fd);
+			client.thread = std::thread(&DaemonServer::handleClient, this, std::ref(client));
+		}
+		// Jobs still running use the pools and slots of the server, they are finished first
+		joinClients(true);
+#endif
+		return RET_EXTRACT_FAIL_EXIT;
+	}
+
+	void DaemonServer::joinClients(bool isStopping) {
+		for (auto it = clients.begin(); it != clients.end();) {
+			if (!isStopping && !it->isDone) {
+				++it;
+				continue;
+			}
+#if !defined(_WIN32)
+			// Ends the wait for the next request, a running job still sends its result
+			if (isStopping) shutdown(it->conn->fd, SHUT_RD);
+#endif
+			if (it->thread.joinable()) it->thread.join();
+			it = clients.erase(it);
+		}
+	}
+
+	void DaemonServer::handleClient(DaemonClient &client) {
+		const auto &conn = client.conn;
+#if !defined(_WIN32)
+		std::string buf;
+		char data[4096];
+		while (true) {
+			const ssize_t n = recv(conn->fd, data, sizeof(data), 0);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) break;
+			buf.append(data, n);
+			uint64_t pos;
+			while ((pos = buf.find('\n')) != std::string::npos) {
+				const std::string line = buf.substr(0, pos);
+				buf.erase(0, pos + 1);
+				if (line.find_first_not_of(" \t\r") != std::string::npos) {
+					handleRequest(*conn, line);
+				}
+			}
+			if (buf.size() > MAX_LINE_SIZE) {
+				conn->send(R"({"event":"error","error":"request too long"})");
+				break;
+			}
+		}
+#endif
+		client.isDone = true;
+	}
+
+	static std::string getErrorResult(const std::string &id, int code, const std::string &error) {
+		return std::format(R"({{"id":{},"event":"result","code":{},"error":{}}})",
+		                   jsonString(id), code, jsonString(error));
+	}
+
+	void DaemonServer::handleRequest(DaemonConnection &conn, const std::string &line) {
+		JsonObject request;
+		if (!parseJsonObject(line, request)) {
+			conn.send(getErrorResult("", RET_EXTRACT_CONFIG_FAIL, "invalid request"));
+			return;
+		}
+		const std::string id = request["id"].text;
+		const std::string &command = request["command"].text;
+		const std::string &targets = request["targets"].text;
+		std::vector<std::string> args{baseArgs};
+		if (!request["input"].text.empty()) {
+			args.insert(args.end(), {"-i", request["input"].text});
+		}
+		if (!request["outdir"].text.empty()) {
+			args.insert(args.end(), {"-o", request["outdir"].text});
+		}
+		if (command == "print") {
+			args.emplace_back(targets.empty() ? "-p" : "--print=" + targets);
+		} else if (command == "extract" || command == "verify") {
+			if (command == "verify") args.emplace_back("--verify");
+			args.emplace_back(targets.empty() ? "-x" : "--extract=" + targets);
+		} else {
+			conn.send(getErrorResult(id, RET_EXTRACT_CONFIG_FAIL, "unknown command: " + command));
+			return;
+		}
+		args.insert(args.end(), request["args"].items.begin(), request["args"].items.end());
+
+		ExtractJob job;
+		auto &eo = job.eo;
+		if (job.parse(parseOperation, std::move(args)) != RET_EXTRACT_CONFIG_DONE) {
+			conn.send(getErrorResult(id, RET_EXTRACT_CONFIG_FAIL, "invalid options"));
+			return;
+		}
+		if (eo.payloadType == PAYLOAD_TYPE_STREAM || eo.remoteUpdate || !eo.batchPath.empty() ||
+		    !eo.daemonSocketPath.empty()) {
+			conn.send(getErrorResult(id, RET_EXTRACT_CONFIG_FAIL, "stdin, -R, --batch and --daemon are not supported"));
+			return;
+		}
+		eo.workerPool = workerPool;
+		eo.downloadPool = downloadPool;
+		eo.jobId = nextJobId++;
+		// Progress goes to the client instead of the daemon output
+		eo.progressCallback = [&conn, &id](const std::string &partName, uint64_t done, uint64_t total) {
+			conn.send(std::format(R"({{"id":{},"event":"progress","partition":{},"done":{},"total":{}}})",
+			                      jsonString(id), jsonString(partName), done, total));
+		};
+
+		acquireSlot(conn, id);
+		const int ret = runJob(conn, id, job);
+		releaseSlot();
+
+		std::string partitions;
+		if (job.pw) {
+			for (const auto &info: job.pw->getPartitions()) {
+				if (!partitions.empty()) partitions += ',';
+				partitions += std::format(R"({{"name":{},"size":{},"sha256":{})", jsonString(info.name), info.size,
+				                          jsonString(info.newHashHexStr));
+				if (command == "extract") {
+					partitions += std::format(R"(,"path":{},"success":{})", jsonString(info.outFilePath),
+					                          info.isExtractionSuccessful);
+				}
+				partitions += '}';
+			}
+		}
+		conn.send(std::format(R"({{"id":{},"event":"result","code":{},"partitions":[{}]}})",
+		                      jsonString(id), ret, partitions));
+	}
+
+	int DaemonServer::runJob(DaemonConnection &conn, const std::string &id, ExtractJob &job) {
+		conn.send(std::format(R"({{"id":{},"event":"started"}})", jsonString(id)));
+		int ret = job.prepare();
+		// Printing writes to the daemon output, the partitions are in the result line instead
+		if (ret == RET_EXTRACT_DONE && !job.isPrintOnly()) {
+			ret = job.run(nullptr);
+		}
+		const auto &eo = job.eo;
+		if (ret == RET_EXTRACT_DONE && !eo.isVerifyImages && (eo.isExtractAll || eo.isExtractTarget)) {
+			for (const auto &info: job.pw->getPartitions()) {
+				if (!info.isExtractionSuccessful) {
+					ret = RET_EXTRACT_FAIL_SKIP;
+					break;
+				}
+			}
+		}
+		return ret;
+	}
+
+	void DaemonServer::acquireSlot(DaemonConnection &conn, const std::string &id) {
+		std::unique_lock lock{slotMutex};
+		const uint64_t ticket = nextTicket++;
+		const uint64_t queued = ticket - servingTicket;
+		lock.unlock();
+		conn.send(std::format(R"({{"id":{},"event":"accepted","queued":{}}})", jsonString(id), queued));
+
+		lock.lock();
+		// Jobs start in order of arrival, as soon as one of the slots is free
+		slotCv.wait(lock, [&] { return ticket == servingTicket && runningJobs < maxJobs; });
+		servingTicket++;
+		runningJobs++;
+		slotCv.notify_all();
+	}
+
+	void DaemonServer::releaseSlot() {
+		{
+			std::lock_guard lock{slotMutex};
+			runningJobs--;
+		}
+		slotCv.notify_all();
+	}
+}
@@ -0,0 +1,126 @@
+#include <getopt.h>
+#include <mutex>
+
+#include <payload/LogBase.h>
+#include <payload/verify/VerifyWriter.h>
+
+#include "ExtractJob.h"
+
+namespace skkk {
+	std::vector<std::string> ExtractJob::getBaseArgs(int argc, char **argv,
+	                                                 std::initializer_list<std::string_view> options) {
+		std::vector<std::string> args;
+		for (int i = 0; i < argc; i++) {
+			const std::string_view arg = argv[i];
+			bool isSkipped = false;
+			for (const auto &option: options) {
+				if (arg == option) {
+					// Value in the next argument, options with optional values are not skipped here
+					isSkipped = true;
+					i++;
+					break;
+				}
+				if (arg.starts_with(option) && arg.size() > option.size() && arg[option.size()] == '=') {
+					isSkipped = true;
+					break;
+				}
+			}
+			if (!isSkipped) {
+				args.emplace_back(arg);
+			}
+		}
+		return args;
+	}
+
+	int ExtractJob::parse(ParseOperation parseOperation, std::vector<std::string> args) {
+		// getopt keeps its state in globals, one job is parsed at a time
+		static std::mutex parseMutex;
+		std::vector<char *> argv;
+		for (auto &arg: args) {
+			argv.emplace_back(arg.data());
+		}
+		argv.emplace_back(nullptr);
+
+		std::lock_guard lock{parseMutex};
+#if defined(__APPLE__) || defined(__FreeBSD__)
+		optreset = 1;
+		optind = 1;
+#else
+		optind = 0;
+#endif
+		return parseOperation(static_cast<int>(args.size()), argv.data(), eo);
+	}
+
+	int ExtractJob::prepare() {
+		bool err = false;
+
+		// Parse payload.bin
+		if (!payloadParser.parse(eo)) {
+			return RET_EXTRACT_INIT_FAIL;
+		}
+
+		// PartitionWriter
+		pw = payloadParser.getPartitionWriter();
+
+		if (!eo.getTargetName().empty()) {
+			err = pw->initPartitionsByTarget();
+		} else if (eo.isPrintAll || eo.isExtractAll) {
+			err = pw->initPartitions();
+		}
+		if (!err) {
+			LOGCE("Cannot find the image file to be extracted!");
+			return RET_EXTRACT_INIT_PART_FAIL;
+		}
+		return RET_EXTRACT_DONE;
+	}
+
+	bool ExtractJob::isPrintOnly() const {
+		return eo.isPrintTarget || eo.isPrintAll;
+	}
+
+	int ExtractJob::run(RemoteUpdater *ru) {
+		if (isPrintOnly()) {
+			pw->printPartitionsInfo();
+			return RET_EXTRACT_DONE;
+		}
+
+		// VerifyWriter, verity state is only allocated while a partition is updated
+		const auto vw = pw->getVerifyWriter();
+
+		LOGCI(GREEN2_BOLD("Starting..."));
+
+		if (eo.isVerifyImages) {
+			if (!pw->getImageVerifier()->verifyPartitions()) {
+				return RET_EXTRACT_VERIFY_FAIL;
+			}
+			return RET_EXTRACT_DONE;
+		}
+
+		if (eo.isExtractAll || eo.isExtractTarget) {
+			if (eo.createExtractOutDir()) {
+				return RET_EXTRACT_CREATE_DIR_FAIL;
+			}
+
+			if (eo.isUrl && ru && ru->initRemoteUpdate()) {
+				ru->startMonitor(pw->getDownloadScheduler());
+			}
+
+			pw->extractPartitions();
+
+			if (ru) {
+				ru->stopMonitor();
+			}
+
+			if (eo.isUrl) {
+				if (const auto stats = eo.httpDownload->getStats(); !stats.empty()) {
+					LOGCI(GREEN2_BOLD("HTTP: ") "{}", stats);
+				}
+			}
+		}
+
+		if (eo.isIncremental && eo.isVerifyUpdate) {
+			vw->updateVerifyData();
+		}
+		return RET_EXTRACT_DONE;
+	}
+}
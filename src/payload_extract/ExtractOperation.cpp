@@ -63,6 +63,9 @@ namespace skkk {
 		isUrl = startsWithIgnoreCase(payloadPath, "https://") ||
 		        startsWithIgnoreCase(payloadPath, "http://");
 		payloadType = isUrl ? PAYLOAD_TYPE_URL : PAYLOAD_TYPE_BIN;
+		if (payloadPath == "-") {
+			payloadType = PAYLOAD_TYPE_STREAM;
+		}
 	}
 
 	void ExtractOperation::initHttpDownload() {
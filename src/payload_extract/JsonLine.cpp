@@ -0,0 +1,160 @@
+#include <format>
+
+#include "JsonLine.h"
+
+namespace skkk {
+	class JsonReader {
+		std::string_view data;
+		uint64_t pos = 0;
+
+		public:
+			explicit JsonReader(std::string_view data)
+				: data(data) {
+			}
+
+			void skipSpace() {
+				while (pos < data.size() && (data[pos] == ' ' || data[pos] == '\t' ||
+				                             data[pos] == '\r' || data[pos] == '\n')) {
+					pos++;
+				}
+			}
+
+			bool consume(char c) {
+				skipSpace();
+				if (pos < data.size() && data[pos] == c) {
+					pos++;
+					return true;
+				}
+				return false;
+			}
+
+			bool isEnd() {
+				skipSpace();
+				return pos == data.size();
+			}
+
+			static void appendUtf8(std::string &out, uint32_t cp) {
+				if (cp < 0x80) {
+					out += static_cast<char>(cp);
+				} else if (cp < 0x800) {
+					out += static_cast<char>(0xc0 | cp >> 6);
+					out += static_cast<char>(0x80 | (cp & 0x3f));
+				} else {
+					out += static_cast<char>(0xe0 | cp >> 12);
+					out += static_cast<char>(0x80 | (cp >> 6 & 0x3f));
+					out += static_cast<char>(0x80 | (cp & 0x3f));
+				}
+			}
+
+			bool readString(std::string &out) {
+				if (!consume('"')) return false;
+				while (pos < data.size()) {
+					const char c = data[pos++];
+					if (c == '"') return true;
+					if (c != '\\') {
+						out += c;
+						continue;
+					}
+					if (pos >= data.size()) return false;
+					switch (const char e = data[pos++]) {
+						case 'b': out += '\b';
+							break;
+						case 'f': out += '\f';
+							break;
+						case 'n': out += '\n';
+							break;
+						case 'r': out += '\r';
+							break;
+						case 't': out += '\t';
+							break;
+						case 'u': {
+							// Surrogate pairs are not joined, paths and names are expected
+							if (pos + 4 > data.size()) return false;
+							uint32_t cp = 0;
+							for (int i = 0; i < 4; i++) {
+								const char h = data[pos++];
+								cp <<= 4;
+								if (h >= '0' && h <= '9') cp |= h - '0';
+								else if (h >= 'a' && h <= 'f') cp |= h - 'a' + 10;
+								else if (h >= 'A' && h <= 'F') cp |= h - 'A' + 10;
+								else return false;
+							}
+							appendUtf8(out, cp);
+							break;
+						}
+						default:
+							out += e;
+					}
+				}
+				return false;
+			}
+
+			bool readScalar(std::string &out) {
+				skipSpace();
+				if (pos < data.size() && data[pos] == '"') {
+					return readString(out);
+				}
+				while (pos < data.size() && data[pos] != ',' && data[pos] != '}' && data[pos] != ']' &&
+				       data[pos] != ' ' && data[pos] != '\t') {
+					if (data[pos] == '{' || data[pos] == '[' || data[pos] == '"') return false;
+					out += data[pos++];
+				}
+				return !out.empty();
+			}
+
+			bool readValue(JsonValue &value) {
+				if (!consume('[')) {
+					return readScalar(value.text);
+				}
+				value.isArray = true;
+				if (consume(']')) return true;
+				do {
+					if (!readScalar(value.items.emplace_back())) return false;
+				} while (consume(','));
+				return consume(']');
+			}
+	};
+
+	bool parseJsonObject(std::string_view line, JsonObject &object) {
+		JsonReader reader{line};
+		if (!reader.consume('{')) return false;
+		if (reader.consume('}')) return reader.isEnd();
+		do {
+			std::string key;
+			JsonValue value;
+			if (!reader.readString(key) || !reader.consume(':') || !reader.readValue(value)) {
+				return false;
+			}
+			object[key] = std::move(value);
+		} while (reader.consume(','));
+		return reader.consume('}') && reader.isEnd();
+	}
+
+	std::string jsonString(std::string_view str) {
+		std::string out;
+		out.reserve(str.size() + 2);
+		out += '"';
+		for (const char c: str) {
+			switch (c) {
+				case '"': out += "\\\"";
+					break;
+				case '\\': out += "\\\\";
+					break;
+				case '\n': out += "\\n";
+					break;
+				case '\r': out += "\\r";
+					break;
+				case '\t': out += "\\t";
+					break;
+				default:
+					if (static_cast<unsigned char>(c) < 0x20) {
+						out += std::format("\\u{:04x}", static_cast<unsigned char>(c));
+					} else {
+						out += c;
+					}
+			}
+		}
+		out += '"';
+		return out;
+	}
+}
@@ -1,26 +1,29 @@
+#include <cerrno>
+#include <cstring>
+#include <format>
 #include <memory>
+#include <sys/stat.h>
+#if !defined(_WIN32)
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 
 #include <payload/common/io.h>
 #include <payload/LogBase.h>
-#include <payload/mman/mmap.hpp>
+#include <payload/Utils.h>
 
+#include "JsonLine.h"
 #include "RemoteUpdater.h"
 
 namespace skkk {
 	RemoteUpdater::RemoteUpdater(const ExtractConfig &config)
 		: config(config) {
-		contextFilePath = config.getOutDir() + "/remote_ctl";
+		socketPath = config.getOutDir() + "/remote_ctl";
 	}
 
 	RemoteUpdater::~RemoteUpdater() {
-		monitoring = false;
-		if (context) {
-			munmap(context, contextSize);
-		}
-		closeFd(mapFd);
-		if (firstStage && fileExists(contextFilePath)) {
-			remove(contextFilePath.c_str());
-		}
+		stopMonitor();
 	}
 
 	static void printRemoteResult(const std::string &text, bool success) {
@@ -29,53 +32,248 @@ namespace skkk {
 		printf(success ? successFmt : failFmt, text.c_str());
 	}
 
-	bool RemoteUpdater::initRemoteUpdate(bool firstStage) {
-		uint64_t size = contextSize;
-		int flag = O_RDWR | O_BINARY;
-		this->firstStage = firstStage;
+#if !defined(_WIN32)
+	static bool initSocketAddr(const std::string &path, sockaddr_un &addr) {
+		if (path.size() >= sizeof(addr.sun_path)) {
+			LOGCE("Remote: socket path too long: '{}'", path);
+			return false;
+		}
+		addr = {};
+		addr.sun_family = AF_UNIX;
+		memcpy(addr.sun_path, path.c_str(), path.size());
+		return true;
+	}
 
-		if (firstStage) flag |= O_CREAT | O_TRUNC;
-		mapFd = open(contextFilePath.c_str(), flag, 0644);
-		if (mapFd > 0) {
-			if (!payload_ftruncate(mapFd, contextSize)) {
-				return mapByPath(mapFd, contextFilePath, context, size, false) == 0;
-			}
-			close(mapFd);
+	static bool sendLine(int fd, const std::string &line) {
+		const std::string data = line + "\n";
+		uint64_t offset = 0;
+		while (offset < data.size()) {
+			const ssize_t n = ::send(fd, data.data() + offset, data.size() - offset, MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			offset += n;
+		}
+		return true;
+	}
+#endif
+
+	bool RemoteUpdater::initRemoteUpdate() {
+#if !defined(_WIN32)
+		sockaddr_un addr = {};
+		struct stat st = {};
+		if (!initSocketAddr(socketPath, addr)) goto fail;
+		// A socket of a killed run, or the control file of older versions
+		if (lstat(socketPath.c_str(), &st) == 0 && (S_ISSOCK(st.st_mode) || S_ISREG(st.st_mode))) {
+			remove(socketPath.c_str());
+		}
+		listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (listenFd < 0) goto fail;
+		if (bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) || listen(listenFd, 4)) {
+			closeFd(listenFd);
+			goto fail;
+		}
+		if (pipe(wakeFds)) {
+			closeFd(listenFd);
+			remove(socketPath.c_str());
+			goto fail;
 		}
-		printRemoteResult("Failed to initialize!", false);
+		return true;
+
+	fail:
+		LOGCW("Remote: control socket unavailable: '{}', -R and --remote do not reach this run", socketPath);
+#else
+		LOGCW("Remote: not supported on Windows, -R and --remote do not reach this run");
+#endif
 		return false;
 	}
 
-	void RemoteUpdater::notifyRemoteUpdate() const {
-		if (config.isUrl && context) {
-			std::string url = config.getPayloadPath();
-			strncpy(context->url, url.c_str(), url.size());
-			context->url[url.size()] = '\0';
-			context->startUpdate = true;
-			printRemoteResult("Update successful!", true);
+	bool RemoteUpdater::notifyRemoteUpdate(const std::string &command) const {
+#if !defined(_WIN32)
+		sockaddr_un addr = {};
+		std::string name = command, value, answer;
+		JsonObject reply;
+		char buf[4096];
+		int fd = -1;
+
+		if (command.empty()) {
+			if (!config.isUrl) {
+				printRemoteResult("Not a url: " + config.getPayloadPath(), false);
+				return false;
+			}
+			name = "url";
+			value = config.getPayloadPath();
+		} else if (const auto pos = command.find('='); pos != std::string::npos) {
+			name = command.substr(0, pos);
+			value = command.substr(pos + 1);
+		}
+
+		if (!initSocketAddr(socketPath, addr)) return false;
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))) {
+			closeFd(fd);
+			printRemoteResult(std::format("No running extraction on '{}'", socketPath), false);
+			return false;
 		}
+		sendLine(fd, std::format(R"({{"version":{},"command":{},"value":{}}})",
+		                         PROTOCOL_VERSION, jsonString(name), jsonString(value)));
+		shutdown(fd, SHUT_WR);
+		while (answer.find('\n') == std::string::npos) {
+			const ssize_t n = recv(fd, buf, sizeof(buf), 0);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) break;
+			answer.append(buf, n);
+		}
+		closeFd(fd);
+		answer = answer.substr(0, answer.find('\n'));
+
+		if (!parseJsonObject(answer, reply) || reply["ok"].text != "true") {
+			printRemoteResult(reply["error"].text.empty() ? "No answer" : reply["error"].text, false);
+			return false;
+		}
+		if (reply["alive"].text == "false") {
+			printRemoteResult("Update successful! Ranges failed before it, extract again to complete them", false);
+			return true;
+		}
+		printRemoteResult(name == "stats" ? answer : "Update successful!", true);
+		return true;
+#else
+		printRemoteResult("Not supported on this platform", false);
+		return false;
+#endif
 	}
 
-	void RemoteUpdater::handleRemoteUpdate() {
-		std::unique_lock lock{mutex_};
-		if (context->startUpdate) {
-			printRemoteResult(context->url, true);
-			context->startUpdate = false;
-			config.httpDownload->setUrl(context->url);
+	static std::string getErrorReply(uint32_t version, const std::string &error) {
+		return std::format(R"({{"version":{},"ok":false,"error":{}}})", version, jsonString(error));
+	}
+
+	static bool parseNumber(const std::string &value, uint64_t &n) {
+		char *endPtr;
+		if (value.empty()) return false;
+		n = strtoull(value.c_str(), &endPtr, 0);
+		return *endPtr == '\0';
+	}
+
+	std::string RemoteUpdater::handleRequest(const std::string &line) const {
+		JsonObject request;
+		uint64_t n = 0;
+		if (!parseJsonObject(line, request)) {
+			return getErrorReply(PROTOCOL_VERSION, "invalid request");
+		}
+		if (request["version"].text != std::to_string(PROTOCOL_VERSION)) {
+			return getErrorReply(PROTOCOL_VERSION, std::format("unsupported version: '{}'", request["version"].text));
+		}
+		const std::string &command = request["command"].text;
+		const std::string &value = request["value"].text;
+		const bool isNumeric = command == "downloads" || command == "threads" || command == "bandwidth";
+		if (isNumeric && !parseNumber(value, n)) {
+			return getErrorReply(PROTOCOL_VERSION, std::format("invalid value: '{}'", value));
+		}
+		if (command != "url" && !downloadScheduler) {
+			return getErrorReply(PROTOCOL_VERSION, "no download running");
+		}
+
+		if (command == "url") {
+			if (value.empty()) {
+				return getErrorReply(PROTOCOL_VERSION, "empty url");
+			}
+			printRemoteResult(value, true);
+			// Requests in flight finish on the old url, retries and new ones use this one
+			config.httpDownload->setUrl(value);
+			// Ranges that gave up are failed, the later ones download again
+			const bool isAlive = !downloadScheduler || !downloadScheduler->resetFailed();
+			LOGCD("Remote: url={} alive={}", value, isAlive);
+			return std::format(R"({{"version":{},"ok":true,"alive":{}}})", PROTOCOL_VERSION, isAlive);
+		} else if (command == "pause" || command == "resume") {
+			downloadScheduler->setPaused(command == "pause");
+			printRemoteResult(command == "pause" ? "Paused" : "Resumed", true);
+		} else if (command == "downloads") {
+			downloadScheduler->setMaxLimit(n);
+		} else if (command == "threads") {
+			downloadScheduler->setDecodeLimit(n);
+		} else if (command == "bandwidth") {
+			downloadScheduler->setRateLimit(n);
+		} else if (command == "stats") {
+			const auto m = downloadScheduler->getMetrics();
+			// Flat like every line of the protocol
+			return std::format(R"({{"version":{},"ok":true,"limit":{},"peak_limit":{},"max_limit":{},)"
+			                   R"("in_flight":{},"decode_limit":{},"decoding":{},"paused":{},"bandwidth":{},)"
+			                   R"("bytes":{},"throughput":{:.0f},"failed":{},"hedged":{},"http":{}}})",
+			                   PROTOCOL_VERSION, m.limit, m.peakLimit, m.maxLimit, m.inFlight, m.decodeLimit,
+			                   m.decoding, m.isPaused, m.rateLimit, m.totalBytes, m.throughput, m.failCount,
+			                   m.hedgeCount, jsonString(config.httpDownload->getStats()));
+		} else {
+			return getErrorReply(PROTOCOL_VERSION, std::format("unknown command: '{}'", command));
 		}
+		LOGCD("Remote: {}={}", command, value);
+		return std::format(R"({{"version":{},"ok":true}})", PROTOCOL_VERSION);
 	}
 
 	void RemoteUpdater::monitor() {
+#if !defined(_WIN32)
 		while (monitoring) {
-			handleRemoteUpdate();
-			sleep(1);
+			pollfd fds[2] = {{listenFd, POLLIN, 0}, {wakeFds[0], POLLIN, 0}};
+			// Sleeps until a client connects or the extraction ends
+			if (poll(fds, 2, -1) < 0) {
+				if (errno == EINTR) continue;
+				break;
+			}
+			if (fds[1].revents) break;
+			if (!(fds[0].revents & POLLIN)) continue;
+
+			int fd = accept(listenFd, nullptr, nullptr);
+			if (fd < 0) continue;
+			// A client that does not send must not block the channel
+			timeval timeout = {1, 0};
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			std::string buf;
+			char data[4096];
+			while (buf.size() <= MAX_LINE_SIZE) {
+				const ssize_t n = recv(fd, data, sizeof(data), 0);
+				if (n < 0 && errno == EINTR) continue;
+				if (n <= 0) break;
+				buf.append(data, n);
+				uint64_t pos;
+				while ((pos = buf.find('\n')) != std::string::npos) {
+					const std::string line = buf.substr(0, pos);
+					buf.erase(0, pos + 1);
+					sendLine(fd, handleRequest(line));
+				}
+			}
+			// Last request without a newline
+			if (!buf.empty() && buf.size() <= MAX_LINE_SIZE) {
+				sendLine(fd, handleRequest(buf));
+			}
+			closeFd(fd);
 		}
+#endif
 	}
 
-	void RemoteUpdater::startMonitor() {
-		if (!monitoring && context) {
+	void RemoteUpdater::startMonitor(const std::shared_ptr<DownloadScheduler> &scheduler) {
+		if (!monitoring && listenFd >= 0) {
+			downloadScheduler = scheduler;
+			// Expired urls wait for -R while the socket listens
+			if (downloadScheduler) downloadScheduler->setUrlReplaceable(true);
 			monitoring = true;
 			monitorFuture = std::async(std::launch::async, &RemoteUpdater::monitor, std::ref(*this));
 		}
 	}
+
+	void RemoteUpdater::stopMonitor() {
+		if (monitoring) {
+			monitoring = false;
+#if !defined(_WIN32)
+			if (write(wakeFds[1], "x", 1) < 0) {
+				LOGCD("Remote: failed to wake the monitor: {}", strerror(errno));
+			}
+#endif
+			monitorFuture.wait();
+			if (downloadScheduler) downloadScheduler->setUrlReplaceable(false);
+		}
+		if (listenFd >= 0) {
+			closeFd(listenFd);
+			remove(socketPath.c_str());
+		}
+		closeFd(wakeFds[0]);
+		closeFd(wakeFds[1]);
+	}
 }
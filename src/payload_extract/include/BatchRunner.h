@@ -0,0 +1,41 @@
+#ifndef PAYLOAD_EXTRACT_BATCHRUNNER_H
+#define PAYLOAD_EXTRACT_BATCHRUNNER_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <payload/WorkerPool.h>
+
+#include "ExtractJob.h"
+
+namespace skkk {
+	/**
+	 * Runs the jobs of a job list in one process. Each line of the list holds the
+	 * options of one job, e.g. "-i ota.zip -X boot -o out/ota", added to the options
+	 * of the command line. All jobs share the worker pools, so decoder contexts and
+	 * http connections of the workers are reused.
+	 *
+	 * The next job is parsed while the current one is still extracting, its manifest
+	 * download or parsing overlaps with the writing of the previous payload.
+	 */
+	class BatchRunner {
+		std::vector<std::string> baseArgs;
+		std::string jobListPath;
+		ParseOperation parseOperation;
+		std::shared_ptr<WorkerPool> workerPool;
+		std::shared_ptr<WorkerPool> downloadPool;
+
+		public:
+			BatchRunner(int argc, char **argv, const ExtractOperation &eo, ParseOperation parseOperation);
+
+			int run();
+
+		private:
+			bool readJobs(std::vector<std::vector<std::string>> &jobs) const;
+
+			std::unique_ptr<ExtractJob> prepareJob(const std::vector<std::string> &jobArgs, int &ret) const;
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_BATCHRUNNER_H
@@ -0,0 +1,96 @@
+#ifndef PAYLOAD_EXTRACT_DAEMONSERVER_H
+#define PAYLOAD_EXTRACT_DAEMONSERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <payload/WorkerPool.h>
+
+#include "ExtractJob.h"
+
+namespace skkk {
+	class DaemonConnection {
+		std::mutex writeMutex;
+
+		public:
+			int fd = -1;
+
+		public:
+			explicit DaemonConnection(int fd);
+
+			~DaemonConnection();
+
+			bool send(const std::string &line);
+	};
+
+	class DaemonClient {
+		public:
+			std::shared_ptr<DaemonConnection> conn;
+			std::thread thread;
+			std::atomic_bool isDone = false;
+	};
+
+	/**
+	 * Resident extraction service on a Unix domain socket. A client writes one JSON
+	 * request per line, e.g.
+	 *   {"id":"1","command":"extract","input":"ota.zip","outdir":"out","targets":"boot","args":["-T","8"]}
+	 * command is extract, verify or print, args are further command line options.
+	 * The answers are JSON lines with the same id: accepted, started, progress of
+	 * each partition and the result. Requests of one connection run one after another.
+	 *
+	 * Jobs share the worker pools and take turns on them, at most maxJobs run at once,
+	 * others wait in order of arrival. The options of the daemon command line, e.g.
+	 * --index-dir and --cache-dir, apply to every job, so manifests and downloaded
+	 * data are reused by later requests.
+	 */
+	class DaemonServer {
+		static constexpr uint64_t MAX_LINE_SIZE = 1024 * 1024;
+
+		std::vector<std::string> baseArgs;
+		std::string socketPath;
+		ParseOperation parseOperation;
+		uint32_t maxJobs = 1;
+		std::shared_ptr<WorkerPool> workerPool;
+		std::shared_ptr<WorkerPool> downloadPool;
+		int listenFd = -1;
+		std::atomic_uint64_t nextJobId = 1;
+		// Only used by the accepting thread, joined before the server goes away
+		std::list<DaemonClient> clients;
+
+		std::mutex slotMutex;
+		std::condition_variable slotCv;
+		uint64_t nextTicket = 0;
+		uint64_t servingTicket = 0;
+		uint32_t runningJobs = 0;
+
+		public:
+			DaemonServer(int argc, char **argv, const ExtractOperation &eo, ParseOperation parseOperation);
+
+			~DaemonServer();
+
+			int run();
+
+		private:
+			bool initSocket();
+
+			void handleClient(DaemonClient &client);
+
+			void joinClients(bool isStopping);
+
+			void handleRequest(DaemonConnection &conn, const std::string &line);
+
+			int runJob(DaemonConnection &conn, const std::string &id, ExtractJob &job);
+
+			void acquireSlot(DaemonConnection &conn, const std::string &id);
+
+			void releaseSlot();
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_DAEMONSERVER_H
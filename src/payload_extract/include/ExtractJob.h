@@ -0,0 +1,62 @@
+#ifndef PAYLOAD_EXTRACT_EXTRACTJOB_H
+#define PAYLOAD_EXTRACT_EXTRACTJOB_H
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <payload/PartitionWriter.h>
+#include <payload/PayloadParser.h>
+
+#include "ExtractOperation.h"
+#include "RemoteUpdater.h"
+
+namespace skkk {
+	using ParseOperation = int (*)(int argc, char **argv, ExtractOperation &eo);
+
+	/**
+	 * One payload from parsing to the printed, verified or extracted partitions,
+	 * prepare() only reads, so it can run while another job is still writing.
+	 */
+	class ExtractJob {
+		public:
+			ExtractOperation eo;
+			PayloadParser payloadParser;
+			std::shared_ptr<PartitionWriter> pw;
+
+		public:
+			ExtractJob() = default;
+
+			ExtractJob(const ExtractJob &other) = delete;
+
+			ExtractJob &operator=(const ExtractJob &other) = delete;
+
+			/**
+			 * Command line without the given long options and their values, the
+			 * options left apply to every job of batch and daemon mode.
+			 */
+			static std::vector<std::string> getBaseArgs(int argc, char **argv,
+			                                            std::initializer_list<std::string_view> options);
+
+			/**
+			 * Parses args like a command line, args[0] is the program name.
+			 */
+			int parse(ParseOperation parseOperation, std::vector<std::string> args);
+
+			/**
+			 * Parses the payload and selects the partitions.
+			 */
+			int prepare();
+
+			bool isPrintOnly() const;
+
+			/**
+			 * Prints, verifies or extracts the partitions, ru follows url changes
+			 * while a url is extracted, it may be null.
+			 */
+			int run(RemoteUpdater *ru);
+	};
+}
+
+#endif //PAYLOAD_EXTRACT_EXTRACTJOB_H
@@ -15,6 +15,13 @@ namespace skkk {
 			bool isPrintTarget = false;
 			bool isExtractAll = false;
 			bool isExtractTarget = false;
+			// Job list of batch mode, see BatchRunner
+			std::string batchPath;
+			// Socket of daemon mode and the jobs it runs at once, see DaemonServer
+			std::string daemonSocketPath;
+			uint32_t daemonMaxJobs = 2;
+			// Sent to a running extraction by --remote, see RemoteUpdater
+			std::string remoteCommand;
 
 		public:
 			ExtractOperation() = default;
@@ -0,0 +1,33 @@
+#ifndef PAYLOAD_EXTRACT_JSONLINE_H
+#define PAYLOAD_EXTRACT_JSONLINE_H
+
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace skkk {
+	class JsonValue {
+		public:
+			bool isArray = false;
+			// String value, numbers, true, false and null as written
+			std::string text;
+			// Items of an array, same as text
+			std::vector<std::string> items;
+	};
+
+	typedef std::map<std::string, JsonValue> JsonObject;
+
+	/**
+	 * Flat JSON object of one line of the daemon or remote control protocol, the values are strings,
+	 * numbers, literals or arrays of those, nested objects are rejected.
+	 */
+	bool parseJsonObject(std::string_view line, JsonObject &object);
+
+	/**
+	 * Quoted and escaped JSON string.
+	 */
+	std::string jsonString(std::string_view str);
+}
+
+#endif //PAYLOAD_EXTRACT_JSONLINE_H
@@ -1,26 +1,39 @@
 #ifndef PAYLOAD_EXTRACT_REMOTEUPDATE_H
 #define PAYLOAD_EXTRACT_REMOTEUPDATE_H
 
+#include <atomic>
 #include <future>
-#include <mutex>
+#include <memory>
+#include <string>
 
+#include <payload/DownloadScheduler.h>
 #include <payload/ExtractConfig.h>
 
 namespace skkk {
-	class RemoteContext {
-		public:
-			bool startUpdate = false;
-			char url[1024] = {};
-	};
-
+	/**
+	 * Control channel of a running url extraction, a Unix domain socket named remote_ctl
+	 * in the out dir. A client writes one JSON request per line and gets one JSON answer:
+	 *   {"version":1,"command":"downloads","value":"8"}
+	 *   {"version":1,"ok":true}
+	 * Commands:
+	 *   url <url>          following requests go to the new url, e.g. a refreshed signed link
+	 *   pause, resume      requests in flight finish, new ones wait
+	 *   downloads <n>      cap of the range requests in flight
+	 *   threads <n>        operations decoded at once
+	 *   bandwidth <n>      bytes per second of all requests, 0 is unlimited
+	 *   stats              snapshot of the download metrics
+	 * A request with another version is refused, so older clients fail loudly.
+	 */
 	class RemoteUpdater {
-			std::mutex mutex_;
-			int mapFd = -1;
-			RemoteContext *context = nullptr;
-			static constexpr uint32_t contextSize = sizeof(RemoteContext);
-			bool firstStage = false;
+			static constexpr uint32_t PROTOCOL_VERSION = 1;
+			static constexpr uint64_t MAX_LINE_SIZE = 64 * 1024;
+
 			const ExtractConfig &config;
-			std::string contextFilePath;
+			std::string socketPath;
+			int listenFd = -1;
+			// Wakes the monitor on shutdown
+			int wakeFds[2] = {-1, -1};
+			std::shared_ptr<DownloadScheduler> downloadScheduler;
 			std::future<void> monitorFuture;
 			std::atomic<bool> monitoring = false;
 
@@ -29,15 +42,25 @@ namespace skkk {
 
 			~RemoteUpdater();
 
-			bool initRemoteUpdate(bool firstStage);
+			/**
+			 * Listens on the socket, called by the extraction. A failure is only
+			 * a warning, the extraction runs on without remote control.
+			 */
+			bool initRemoteUpdate();
 
-			void notifyRemoteUpdate() const;
+			/**
+			 * Client side, sends command to the running extraction and prints the answer.
+			 * An empty command swaps to the url of the config.
+			 */
+			bool notifyRemoteUpdate(const std::string &command) const;
 
-			void handleRemoteUpdate();
+			std::string handleRequest(const std::string &line) const;
 
 			void monitor();
 
-			void startMonitor();
+			void startMonitor(const std::shared_ptr<DownloadScheduler> &scheduler);
+
+			void stopMonitor();
 	};
 }
 
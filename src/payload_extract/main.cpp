@@ -6,29 +6,32 @@
 
 #include <payload/ExtractConfig.h>
 #include <payload/LogBase.h>
-#include <payload/PartitionWriter.h>
-#include <payload/PayloadParser.h>
 #include <payload/Utils.h>
-#include <payload/verify/VerifyWriter.h>
 
+#include "BatchRunner.h"
+#include "DaemonServer.h"
+#include "ExtractJob.h"
 #include "ExtractOperation.h"
 #include "RemoteUpdater.h"
 
 using namespace skkk;
 
 static void usage(const ExtractOperation &eo) {
-	char buf[4096] = {};
+	char buf[8192] = {};
 	// @formatter:off
 	snprintf(buf, sizeof(buf) - 1,
 			 BROWN("usage: [options]") "\n"
 			 "  " GREEN2_BOLD("-h, --help") "           " BROWN("Display this help and exit") "\n"
-			 "  " GREEN2_BOLD("-i, --input=[PATH]") "   " BROWN("File path or URL") "\n"
+			 "  " GREEN2_BOLD("-i, --input=[PATH]") "   " BROWN("File path or URL, repeat -i to add mirror URLs of the same file") "\n"
+			 "  "             "               "       "      " BROWN("  - reads payload.bin or an uncompressed ZIP from stdin in one pass") "\n"
 			 "  " GREEN2_BOLD("--incremental=X") "      " BROWN("Old directory, Catalog requiring incremental patching") "\n"
 			 "  " GREEN2_BOLD("--verify-update") "      " BROWN("  In the incremental mode, The dm-verify verified file") "\n"
 			 "  "             "               "       "      " BROWN("  does not contain HASH_TREE and FEC. Only files that") "\n"
 			 "  "             "               "       "      " BROWN("  have successfully updated this information can undergo") "\n"
 			 "  "             "               "       "      " BROWN("  SHA256 verification.") "\n"
 			 "  " GREEN2_BOLD("--verify-update=X") "    " BROWN("  Only Verify and update the specified targets: [boot,odm,...]") "\n"
+			 "  " GREEN2_BOLD("--verify") "             " BROWN("Check existing images in the output dir against the payload,") "\n"
+			 "  "             "               "       "      " BROWN("  without writing, use with -x or -X") "\n"
 			 "  " GREEN2_BOLD("-p") "                   " BROWN("Print all info") "\n"
 			 "  " GREEN2_BOLD("-P, --print=X") "        " BROWN("Print the specified targets: [boot,odm,...]") "\n"
 	         "  " GREEN2_BOLD("-x") "                   " BROWN("Extract all items") "\n"
@@ -37,10 +40,32 @@ static void usage(const ExtractOperation &eo) {
 	         "  " GREEN2_BOLD("-s") "                   " BROWN("Silent mode, Don't show progress") "\n"
 	         "  " GREEN2_BOLD("-T#") "                  " BROWN("[") GREEN2_BOLD("1-%u") BROWN("] Use # threads, default: -T0, is ") GREEN2_BOLD("%u") "\n"
 	         "  " GREEN2_BOLD("-k") "                   " BROWN("Skip SSL verification") "\n"
+	         "  " GREEN2_BOLD("--range-size=X") "       " BROWN("URL: Merge nearby operation data into requests of up to X bytes,") "\n"
+	         "  "             "               "       "      " BROWN("  default: 8388608, 0 is one request per operation") "\n"
+	         "  " GREEN2_BOLD("--range-gap=X") "        " BROWN("URL: Max unused bytes between merged operation data, default: 65536") "\n"
+	         "  " GREEN2_BOLD("--http2[=N]") "          " BROWN("URL: Multiplex requests as N HTTP/2 streams, default: 32") "\n"
+	         "  " GREEN2_BOLD("--http2-conns=N") "      " BROWN("URL: Max HTTP/2 connections, default: 2") "\n"
+	         "  " GREEN2_BOLD("--download-max=N") "     " BROWN("URL: Max range requests in flight, adapted to throughput,") "\n"
+	         "  "             "               "       "      " BROWN("  default: 0, is max(threads * 4, 16)") "\n"
+	         "  " GREEN2_BOLD("--retries=N") "          " BROWN("URL: Attempts per range request, default: 8, 0 retries forever") "\n"
+	         "  "             "               "       "      " BROWN("  401, 403 and 410 wait for a new url from -R instead of using up attempts") "\n"
+	         "  " GREEN2_BOLD("--hedge=P") "            " BROWN("URL: Duplicate ranges slower than the P percentile, default: 95, 0 is off") "\n"
+	         "  " GREEN2_BOLD("--cache-dir=X") "        " BROWN("URL: Keep downloaded data in dir X and reuse it in later runs") "\n"
+	         "  " GREEN2_BOLD("--cache-size=X") "       " BROWN("URL: Max cache size in bytes, default: 4294967296") "\n"
+	         "  " GREEN2_BOLD("--prefetch=X") "         " BROWN("File: Read ahead up to X bytes of upcoming data, default: 268435456, 0 is off") "\n"
+	         "  " GREEN2_BOLD("--stream-buffer=X") "    " BROWN("Stdin: Max bytes read ahead of the decoders, default: 268435456") "\n"
+	         "  " GREEN2_BOLD("--index-dir=X") "        " BROWN("Keep a parsed manifest index in dir X, later runs start without parsing") "\n"
+	         "  " GREEN2_BOLD("--batch=X") "            " BROWN("Run the jobs in file X, one line of options per job, e.g.") "\n"
+	         "  "             "               "       "      " BROWN("  -i ota.zip -X boot -o out/ota, other options apply to all jobs") "\n"
+	         "  " GREEN2_BOLD("--daemon=X") "           " BROWN("Serve extract, verify and print jobs as JSON lines on unix socket X,") "\n"
+	         "  "             "               "       "      " BROWN("  other options apply to all jobs") "\n"
+	         "  " GREEN2_BOLD("--daemon-jobs=N") "      " BROWN("Daemon: Max jobs running at once, default: 2") "\n"
 	         "  " GREEN2_BOLD("-o, --outdir=X") "       " BROWN("Output dir") "\n"
 	         "  " GREEN2_BOLD("--out-config=X") "       " BROWN("Output config file, One config per line: [boot:/path/to/xxx]") "\n"
-	         "  " GREEN2_BOLD("-R") "                   " BROWN("Modify the URL in the remote config") "\n"
+	         "  " GREEN2_BOLD("-R") "                   " BROWN("Send the URL to the extraction running in the output directory") "\n"
 	         "  "             "               "       "      " BROWN("  May need to specify the output directory") "\n"
+	         "  " GREEN2_BOLD("--remote=X") "           " BROWN("Send command X to the extraction running in the output directory:") "\n"
+	         "  "             "               "       "      " BROWN("  pause, resume, downloads=N, threads=N, bandwidth=N (bytes/s), stats") "\n"
 	         "  " GREEN2_BOLD("-V, --version") "        " BROWN("Print the version info") "\n",
 	         eo.limitHardwareConcurrency,
 	         eo.hardwareConcurrency
@@ -72,6 +97,23 @@ static option argOptions[] = {
 	{"incremental", required_argument, nullptr, 200},
 	{"verify-update", optional_argument, nullptr, 201},
 	{"out-config",required_argument, nullptr, 202},
+	{"verify", no_argument, nullptr, 203},
+	{"range-size", required_argument, nullptr, 204},
+	{"range-gap", required_argument, nullptr, 205},
+	{"http2", optional_argument, nullptr, 206},
+	{"http2-conns", required_argument, nullptr, 207},
+	{"cache-dir", required_argument, nullptr, 208},
+	{"cache-size", required_argument, nullptr, 209},
+	{"download-max", required_argument, nullptr, 210},
+	{"retries", required_argument, nullptr, 211},
+	{"hedge", required_argument, nullptr, 212},
+	{"prefetch", required_argument, nullptr, 213},
+	{"stream-buffer", required_argument, nullptr, 214},
+	{"index-dir", required_argument, nullptr, 215},
+	{"batch", required_argument, nullptr, 216},
+	{"daemon", required_argument, nullptr, 217},
+	{"daemon-jobs", required_argument, nullptr, 218},
+	{"remote", required_argument, nullptr, 219},
 	{nullptr, no_argument, nullptr, 0},
 };
 
@@ -89,9 +131,14 @@ static int parseExtractOperation(const int argc, char **argv, ExtractOperation &
 				goto exit;
 			case 'i':
 				if (optarg) {
-					eo.setPayloadPath(optarg);
+					// Further -i are mirrors of the first url
+					if (eo.getPayloadPath().empty()) {
+						eo.setPayloadPath(optarg);
+					} else {
+						eo.addMirrorUrl(optarg);
+					}
 				}
-				LOGCD("path={}", eo.getPayloadPath());
+				LOGCD("path={} mirrors={}", eo.getPayloadPath(), eo.getMirrorUrls().size());
 				break;
 			case 'k':
 				eo.sslVerification = false;
@@ -165,6 +212,143 @@ static int parseExtractOperation(const int argc, char **argv, ExtractOperation &
 				}
 				LOGCD("outConfigPath={}", eo.getOutConfigPath());
 				break;
+			case 203:
+				eo.isVerifyImages = true;
+				LOGCD("isVerifyImages={}", eo.isVerifyImages);
+				break;
+			case 204:
+			case 205:
+				if (optarg) {
+					char *endPtr;
+					uint64_t n = strtoull(optarg, &endPtr, 0);
+					if (*endPtr == '\0') {
+						if (opt == 204) {
+							eo.rangeTargetSize = n;
+						} else {
+							eo.rangeGapTolerance = n;
+						}
+					}
+				}
+				LOGCD("rangeTargetSize={} rangeGapTolerance={}", eo.rangeTargetSize, eo.rangeGapTolerance);
+				break;
+			case 206:
+				eo.http2Streams = 32;
+				if (optarg) {
+					char *endPtr;
+					uint32_t n = strtoul(optarg, &endPtr, 0);
+					if (*endPtr == '\0') {
+						eo.http2Streams = n;
+					}
+				}
+				LOGCD("http2Streams={}", eo.http2Streams);
+				break;
+			case 207:
+				if (optarg) {
+					char *endPtr;
+					uint32_t n = strtoul(optarg, &endPtr, 0);
+					if (*endPtr == '\0' && n > 0) {
+						eo.http2Connections = n;
+					}
+				}
+				LOGCD("http2Connections={}", eo.http2Connections);
+				break;
+			case 208:
+				if (optarg) {
+					eo.setCacheDir(optarg);
+				}
+				LOGCD("cacheDir={}", eo.getCacheDir());
+				break;
+			case 209:
+				if (optarg) {
+					char *endPtr;
+					uint64_t n = strtoull(optarg, &endPtr, 0);
+					if (*endPtr == '\0') {
+						eo.cacheMaxSize = n;
+					}
+				}
+				LOGCD("cacheMaxSize={}", eo.cacheMaxSize);
+				break;
+			case 210:
+				if (optarg) {
+					char *endPtr;
+					uint32_t n = strtoul(optarg, &endPtr, 0);
+					if (*endPtr == '\0') {
+						eo.downloadMaxInFlight = n;
+					}
+				}
+				LOGCD("downloadMaxInFlight={}", eo.downloadMaxInFlight);
+				break;
+			case 211:
+			case 212:
+				if (optarg) {
+					char *endPtr;
+					uint32_t n = strtoul(optarg, &endPtr, 0);
+					if (*endPtr == '\0') {
+						if (opt == 211) {
+							eo.retryPolicy.maxAttempts = n;
+						} else {
+							eo.retryPolicy.hedgePercentile = std::min(n, 100u);
+						}
+					}
+				}
+				LOGCD("maxAttempts={} hedgePercentile={}", eo.retryPolicy.maxAttempts,
+				      eo.retryPolicy.hedgePercentile);
+				break;
+			case 213:
+				if (optarg) {
+					char *endPtr;
+					uint64_t n = strtoull(optarg, &endPtr, 0);
+					if (*endPtr == '\0') {
+						eo.prefetchBudget = n;
+					}
+				}
+				LOGCD("prefetchBudget={}", eo.prefetchBudget);
+				break;
+			case 214:
+				if (optarg) {
+					char *endPtr;
+					uint64_t n = strtoull(optarg, &endPtr, 0);
+					if (*endPtr == '\0') {
+						eo.streamBufferSize = n;
+					}
+				}
+				LOGCD("streamBufferSize={}", eo.streamBufferSize);
+				break;
+			case 215:
+				if (optarg) {
+					eo.setIndexDir(optarg);
+				}
+				LOGCD("indexDir={}", eo.getIndexDir());
+				break;
+			case 216:
+				if (optarg) {
+					eo.batchPath = optarg;
+				}
+				LOGCD("batchPath={}", eo.batchPath);
+				break;
+			case 217:
+				if (optarg) {
+					eo.daemonSocketPath = optarg;
+				}
+				LOGCD("daemonSocketPath={}", eo.daemonSocketPath);
+				break;
+			case 218:
+				if (optarg) {
+					char *endPtr;
+					uint32_t n = strtoul(optarg, &endPtr, 0);
+					if (*endPtr == '\0' && n > 0) {
+						eo.daemonMaxJobs = n;
+					}
+				}
+				LOGCD("daemonMaxJobs={}", eo.daemonMaxJobs);
+				break;
+			case 219:
+				eo.remoteUpdate = true;
+				if (optarg) {
+					eo.remoteCommand = optarg;
+				}
+				LOGCD("remoteCommand={}", eo.remoteCommand);
+				break;
 			default:
 				usage(eo);
 				printVersion();
@@ -173,6 +357,20 @@ static int parseExtractOperation(const int argc, char **argv, ExtractOperation &
 	}
 
 	if (enterCheckOpt) {
+		// Jobs are checked one by one by BatchRunner and DaemonServer
+		if (!eo.batchPath.empty() || !eo.daemonSocketPath.empty()) {
+			ret = RET_EXTRACT_CONFIG_DONE;
+			goto exit;
+		}
+
+		// Remote commands only need the out dir of the running extraction
+		if (!eo.remoteCommand.empty()) {
+			ret = eo.initOutDir();
+			if (ret) goto exit;
+			ret = RET_EXTRACT_CONFIG_DONE;
+			goto exit;
+		}
+
 		if (eo.getPayloadPath().empty()) {
 			ret = RET_EXTRACT_OPEN_FILE;
 			goto exit;
@@ -183,8 +381,12 @@ static int parseExtractOperation(const int argc, char **argv, ExtractOperation &
 
 		eo.initHttpDownload();
 		LOGCD("httpDownload={}", eo.httpDownload != nullptr);
+		if (eo.isUrl && !eo.httpDownload) {
+			ret = RET_EXTRACT_INIT_FAIL;
+			goto exit;
+		}
 
-		if (eo.payloadType != PAYLOAD_TYPE_URL) {
+		if (eo.payloadType != PAYLOAD_TYPE_URL && eo.payloadType != PAYLOAD_TYPE_STREAM) {
 			if (!fileExists(eo.getPayloadPath())) {
 				LOGCE("payload file '{}' does not exist", eo.getPayloadPath().c_str());
 				ret = RET_EXTRACT_OPEN_FILE;
@@ -263,7 +465,6 @@ static void enableWinTerminalColor(DWORD handle) {
 
 int main(const int argc, char *argv[]) {
 	int ret = RET_EXTRACT_DONE;
-	bool err = false;
 	timeval start{}, end{};
 
 #if defined(_WIN32)
@@ -282,86 +483,41 @@ int main(const int argc, char *argv[]) {
 	gettimeofday(&start, nullptr);
 
 	// Config
-	ExtractOperation eo;
-	PayloadParser payloadParser;
+	ExtractJob job;
+	auto &eo = job.eo;
 	std::shared_ptr<RemoteUpdater> ru;
-	std::shared_ptr<PartitionWriter> pw;
-	std::shared_ptr<VerifyWriter> vw;
 	if (parseExtractOperation(argc, argv, eo) != RET_EXTRACT_CONFIG_DONE) {
 		ret = RET_EXTRACT_INIT_FAIL;
 		goto exit;
 	}
 
-	// RemoteUpdater
-	ru = std::make_shared<RemoteUpdater>(eo);
-	if (eo.remoteUpdate) {
-		if (!ru->initRemoteUpdate(false)) {
-			ret = RET_EXTRACT_INIT_FAIL;
-			goto exit;
-		}
-		ru->notifyRemoteUpdate();
-		goto exit;
+	if (!eo.batchPath.empty()) {
+		BatchRunner batchRunner{argc, argv, eo, parseExtractOperation};
+		ret = batchRunner.run();
+		goto end;
 	}
 
-	// Parse payload.bin
-	if (!payloadParser.parse(eo)) {
-		ret = RET_EXTRACT_INIT_FAIL;
+	if (!eo.daemonSocketPath.empty()) {
+		DaemonServer daemonServer{argc, argv, eo, parseExtractOperation};
+		ret = daemonServer.run();
 		goto exit;
 	}
 
-	// PartitionWriter
-	pw = payloadParser.getPartitionWriter();
-
-	if (!eo.getTargetName().empty()) {
-		err = pw->initPartitionsByTarget();
-	} else if (eo.isPrintAll || eo.isExtractAll) {
-		err = pw->initPartitions();
-	}
-	if (!err) {
-		ret = RET_EXTRACT_INIT_PART_FAIL;
-		LOGCE("Cannot find the image file to be extracted!");
+	// RemoteUpdater
+	ru = std::make_shared<RemoteUpdater>(eo);
+	if (eo.remoteUpdate) {
+		ret = ru->notifyRemoteUpdate(eo.remoteCommand) ? RET_EXTRACT_DONE : RET_EXTRACT_INIT_FAIL;
 		goto exit;
 	}
 
-	// VerifyWriter
-	vw = pw->getVerifyWriter();
-	vw->initHashTreeLevel();
+	ret = job.prepare();
+	if (ret != RET_EXTRACT_DONE) goto exit;
 
-	if (eo.isPrintTarget || eo.isPrintAll) {
-		pw->printPartitionsInfo();
+	ret = job.run(ru.get());
+	if (job.isPrintOnly() || ret == RET_EXTRACT_CREATE_DIR_FAIL || ret == RET_EXTRACT_INIT_FAIL) {
 		goto exit;
 	}
 
-	LOGCI(GREEN2_BOLD("Starting..."));
-
-	if (eo.isExtractAll || eo.isExtractTarget) {
-		err = eo.createExtractOutDir();
-		if (err) {
-			ret = RET_EXTRACT_CREATE_DIR_FAIL;
-			goto exit;
-		}
-
-		if (eo.isUrl) {
-			if (!ru->initRemoteUpdate(true)) {
-				ret = RET_EXTRACT_INIT_FAIL;
-				goto exit;
-			}
-			ru->startMonitor();
-		}
-
-		pw->extractPartitions();
-
-		if (eo.isIncremental && eo.isVerifyUpdate) {
-			vw->updateVerifyData();
-		}
-		goto end;
-	}
-
-	if (eo.isIncremental && eo.isVerifyUpdate) {
-		vw->updateVerifyData();
-		goto end;
-	}
-
 end:
 	// End time
 	gettimeofday(&end, nullptr);